@@ -0,0 +1,641 @@
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <BearLibTerminal.h>
+
+#include "Actor.hpp"
+#include "AnsiTerminal.hpp"
+#include "Arena.hpp"
+#include "Bot.hpp"
+#include "Caves.hpp"
+#include "Dungeon.hpp"
+#include "Engine.hpp"
+#include "FlowField.hpp"
+#include "Fov.hpp"
+#include "InfluenceMap.hpp"
+#include "Frame.hpp"
+#include "Jobs.hpp"
+#include "LevelAnalysis.hpp"
+#include "Map.hpp"
+#include "Net.hpp"
+#include "PathFinding.hpp"
+#include "PathService.hpp"
+#include "Profiler.hpp"
+#include "Renderer.hpp"
+#include "Replay.hpp"
+#include "Scheduler.hpp"
+#include "Snapshot.hpp"
+#include "SpatialGrid.hpp"
+#include "Sync.hpp"
+#include "Trace.hpp"
+
+extern long long g_stubPuts;
+
+struct BenchResult
+{
+  std::string name;
+  int samples;
+  int opsPerSample;
+  double meanNs;
+  double medianNs;
+  double minNs;
+  double maxNs;
+};
+
+static std::vector<BenchResult> g_results;
+
+// Sums up per operation times in ns
+static void report(const std::string& name, int opsPerSample, std::vector<double>& times)
+{
+  int samples = static_cast<int>(times.size());
+  std::sort(times.begin(), times.end());
+
+  double sum = 0;
+  for (double t : times)
+    sum += t;
+
+  BenchResult result{ name, samples, opsPerSample, sum / samples, times[times.size() / 2], times.front(), times.back() };
+  g_results.push_back(result);
+  std::cerr << name << ": median " << result.medianNs << " ns/op, min " << result.minNs << " ns/op" << std::endl;
+}
+
+// Times `samples` calls of f, each call performing opsPerSample operations
+template <typename F>
+static void bench(const std::string& name, int samples, int opsPerSample, F&& f)
+{
+  f(); // warm up
+  std::vector<double> times;
+  times.reserve(static_cast<size_t>(samples));
+  for (int i = 0; i < samples; i++)
+  {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    auto end = std::chrono::steady_clock::now();
+    times.push_back(std::chrono::duration<double, std::nano>(end - start).count() / opsPerSample);
+  }
+  report(name, opsPerSample, times);
+}
+
+// Open map with randomly placed single rock tiles
+static void makeObstacleMap(Map& map, double density, unsigned int seed)
+{
+  std::mt19937 gen(seed);
+  std::bernoulli_distribution rock(density);
+  for (int y = 0; y < map.map_h; y++)
+  {
+    for (int x = 0; x < map.map_w; x++)
+    {
+      bool edge = x == 0 || y == 0 || x == map.map_w - 1 || y == map.map_h - 1;
+      bool blocking = edge || rock(gen);
+      map.board[y][x] = Point(x, y, blocking, blocking ? TERRAIN::ROCK : TERRAIN::CAVE);
+    }
+  }
+}
+
+static Point randomFloor(Map& map, std::mt19937& gen)
+{
+  std::uniform_int_distribution<int> randX(1, map.map_w - 2);
+  std::uniform_int_distribution<int> randY(1, map.map_h - 2);
+  while (true)
+  {
+    Point p(randX(gen), randY(gen));
+    if (!map.board[p.y][p.x].blocking)
+      return p;
+  }
+}
+
+static void benchPathfinding()
+{
+  const int QUERIES = 32;
+  const std::pair<int, int> sizes[] = { { 64, 32 }, { 100, 50 }, { 256, 128 }, { 512, 256 } };
+  const double densities[] = { 0.0, 0.2, 0.35 };
+  for (auto [w, h] : sizes)
+  {
+    for (double density : densities)
+    {
+      Map map(w, h);
+      makeObstacleMap(map, density, 1);
+      AStar astar(map);
+      std::mt19937 gen(2);
+      std::vector<std::pair<Point, Point>> queries;
+      for (int i = 0; i < QUERIES; i++)
+      {
+        queries.emplace_back(randomFloor(map, gen), randomFloor(map, gen));
+      }
+
+      size_t steps = 0;
+      std::string name = "astar/" + std::to_string(w) + "x" + std::to_string(h) + "/rock" + std::to_string(static_cast<int>(density * 100));
+      int samples = w * h > 50000 ? 5 : 20;
+      bench(name, samples, QUERIES, [&]() {
+        for (auto& [from, to] : queries)
+        {
+          steps += astar.findPath(from, to).size();
+        }
+      });
+    }
+  }
+
+  // The game's own level, enemy corner to player corner
+  Map map(100, 50);
+  map.reset(1);
+  map.makeRooms(15);
+  AStar astar(map);
+  Point from = map.getStartCoords(false);
+  Point to = map.getStartCoords(true);
+  size_t steps = 0;
+  bench("astar/level100x50/corner", 200, 1, [&]() { steps += astar.findPath(from, to).size(); });
+}
+
+static void benchGeneration()
+{
+  struct Case
+  {
+    int w, h, rooms;
+  };
+  const Case cases[] = { { 100, 50, 10 }, { 100, 50, 15 }, { 160, 80, 20 }, { 240, 120, 40 }, { 320, 160, 80 }, { 1000, 500, 600 } };
+  for (auto c : cases)
+  {
+    // Routed tunnels, then the straight ones they replaced
+    for (bool routed : { true, false })
+    {
+      Arena arena(64 * 1024);
+      Map map(c.w, c.h, arena.resource());
+      map.routedTunnels = routed;
+      unsigned int seed = 0;
+      std::string name = (routed ? "rooms/" : "rooms/straight/") + std::to_string(c.rooms) + "@" + std::to_string(c.w) + "x" + std::to_string(c.h);
+      bench(name, c.rooms > 100 ? 5 : 50, 1, [&]() {
+        arena.release();
+        map.reset(seed++);
+        map.makeRooms(c.rooms);
+      });
+    }
+  }
+}
+
+static void benchRender()
+{
+  Engine eng(100, 50, 15, 1);
+  long long puts = g_stubPuts;
+  bench("render/frame100x50", 200, 1, [&]() { eng.render(); });
+
+  Map map(100, 50);
+  map.reset(1);
+  map.makeRooms(15);
+  Frame frame;
+  frame.resize(map.map_w, map.map_h);
+  bench("render/map100x50", 200, 1, [&]() { map.render(frame); });
+  bench("render/draw100x50", 200, 1, [&]() { frame.draw(); });
+
+  Actors actors;
+  ActorId player = actors.create(ActorKind::PLAYER, '@', "cyan");
+  actors.move(player, map.getStartCoords(true), map);
+  bench("render/actor", 1000, 1000, [&]() {
+    frame.clear();
+    for (int i = 0; i < 1000; i++)
+    {
+      actors.render(ActorKind::PLAYER, frame);
+    }
+  });
+
+  std::cerr << "stub terminal cells written: " << g_stubPuts - puts << std::endl;
+}
+
+// Writes a scripted recording: unpause, then a key every 50 frames, one
+// millisecond per frame, so each game runs until death or the timer
+static void writeScriptedGames(const std::string& path, int games, int w = 100, int h = 50, int rooms = 15, int horde = 0,
+                               uint64_t flags = 0)
+{
+  Recorder recorder;
+  recorder.open(path.c_str(), w, h, rooms, horde, flags);
+  std::mt19937 gen(3);
+  const int keys[] = { TK_UP, TK_DOWN, TK_LEFT, TK_RIGHT, TK_W, TK_A, TK_S, TK_D, TK_SHIFT, TK_SPACE };
+  std::uniform_int_distribution<int> randKey(0, 9);
+  for (int g = 0; g < games; g++)
+  {
+    recorder.beginGame(static_cast<unsigned int>(100 + g));
+    recorder.frame(1, TK_ENTER);
+    for (int frame = 1; frame < 31000; frame++)
+    {
+      recorder.frame(1, frame % 50 == 0 ? keys[randKey(gen)] : 0);
+    }
+  }
+  recorder.flush();
+}
+
+// Plays every game of a recording headless, returns the frames played
+static long long replayAll(const std::string& path)
+{
+  Replay replay;
+  unsigned int seed{};
+  replay.open(path.c_str());
+  replay.nextGame(seed);
+  Engine eng(replay.width, replay.height, replay.rooms, seed, true);
+  if (replay.horde > 0)
+  {
+    HordeConfig horde;
+    horde.enemies = replay.horde;
+    eng.horde(horde);
+  }
+  eng.fieldOfView((replay.flags & REPLAY_FOV) != 0);
+  eng.influence((replay.flags & REPLAY_INFLUENCE) != 0);
+  eng.replay(&replay);
+  long long frames = 0;
+  while (true)
+  {
+    eng.gameLoop();
+    frames += eng.getFrames();
+    if (!replay.nextGame(seed))
+      break;
+    eng.reset(seed);
+  }
+  return frames;
+}
+
+static void benchEngine()
+{
+  std::string path = (std::filesystem::temp_directory_path() / "deungeon_bench.rec").string();
+  writeScriptedGames(path, 4);
+
+  long long frames = 0;
+  int runs = 0;
+  bench("engine/replay4games", 5, 1, [&]() {
+    frames += replayAll(path);
+    runs++;
+  });
+  std::cerr << "engine frames per run: " << frames / runs << std::endl;
+  std::filesystem::remove(path);
+}
+
+static void benchHorde()
+{
+  std::string path = (std::filesystem::temp_directory_path() / "deungeon_horde.rec").string();
+  for (int enemies : { 500, 2000, 5000 })
+  {
+    writeScriptedGames(path, 1, 320, 160, 80, enemies);
+    long long frames = 0;
+    int runs = 0;
+    bench("horde/" + std::to_string(enemies) + "@320x160", 3, 1, [&]() {
+      frames += replayAll(path);
+      runs++;
+    });
+    std::cerr << "horde frames per run: " << frames / runs << std::endl;
+  }
+
+  writeScriptedGames(path, 1, 320, 160, 80, 2000, REPLAY_INFLUENCE);
+  long long frames = 0;
+  int runs = 0;
+  bench("horde/2000@320x160/influence", 3, 1, [&]() {
+    frames += replayAll(path);
+    runs++;
+  });
+  std::cerr << "horde frames per run: " << frames / runs << std::endl;
+  std::filesystem::remove(path);
+
+  // One flow field rebuild, what every player step costs a horde
+  Map map(320, 160);
+  map.reset(1);
+  map.makeRooms(80);
+  FlowField flow;
+  Point goal = map.getStartCoords(true);
+  bench("horde/flowfield40", 200, 1, [&]() { flow.build(map, goal, 40); });
+
+  // Blurring the density layer, done once per tick with moved enemies
+  InfluenceMap influence;
+  influence.resize(map.map_w, map.map_h);
+  for (int i = 0; i < 2000; i++)
+  {
+    influence.addEnemy(map.getRandomCoords());
+  }
+  bench("horde/blur320x160", 200, 1, [&]() {
+    influence.moveEnemy(goal, goal);
+    influence.addEnemy(goal);
+    influence.blur();
+  });
+}
+
+static void benchFov()
+{
+  Map map(100, 50);
+  map.reset(1);
+  map.makeRooms(15);
+  std::vector<Point> origins;
+  for (int i = 0; i < 64; i++)
+  {
+    origins.push_back(map.getRandomCoords());
+  }
+
+  // Every query a fresh origin, then the same ones again from the cache
+  FieldOfView fov;
+  bench("fov/compute12", 50, 64, [&]() {
+    fov.clear();
+    for (Point p : origins)
+    {
+      fov.from(map, p, Engine::FOV_RADIUS);
+    }
+  });
+  bench("fov/cached12", 200, 64, [&]() {
+    for (Point p : origins)
+    {
+      fov.from(map, p, Engine::FOV_RADIUS);
+    }
+  });
+  int seen = 0;
+  bench("fov/cansee", 200, 64, [&]() {
+    for (size_t i = 0; i < origins.size(); i++)
+    {
+      seen += fov.canSee(map, origins[i], origins[(i + 1) % origins.size()], Engine::FOV_RADIUS);
+    }
+  });
+}
+
+// Capture and restore of a running game, classic and with a horde
+static void benchSnapshot()
+{
+  for (int enemies : { 0, 2000 })
+  {
+    Engine eng(enemies > 0 ? 320 : 100, enemies > 0 ? 160 : 50, enemies > 0 ? 80 : 15, 1, true, 1);
+    HordeConfig horde;
+    horde.enemies = enemies;
+    eng.horde(horde);
+    eng.step(TK_ENTER, 1);
+    for (int i = 0; i < 200; i++)
+    {
+      eng.step(0, 5);
+    }
+
+    std::string suffix = enemies > 0 ? "/horde2000" : "/classic";
+    Snapshot snapshot;
+    bench("snapshot/capture" + suffix, 200, 1, [&]() { eng.capture(snapshot); });
+    bench("snapshot/restore" + suffix, 200, 1, [&]() { eng.restore(snapshot); });
+    bench("snapshot/restore+10frames" + suffix, 50, 1, [&]() {
+      eng.restore(snapshot);
+      for (int i = 0; i < 10; i++)
+      {
+        eng.step(0, 5);
+      }
+    });
+  }
+}
+
+// What a server does per tick on top of the game: mirror it, encode what
+// changed over one 20 ms tick, and the whole world for a joining client
+static void benchSync()
+{
+  Engine eng(320, 160, 80, 1, true, 1);
+  HordeConfig horde;
+  horde.enemies = 2000;
+  eng.horde(horde);
+  eng.step(TK_ENTER, 1);
+  for (int i = 0; i < 100; i++)
+  {
+    eng.step(0, 5);
+  }
+
+  WorldMirror before;
+  WorldMirror after;
+  before.capture(eng);
+  for (int i = 0; i < 4; i++)
+  {
+    eng.step(0, 5);
+  }
+  ByteWriter out;
+  bench("sync/capture/horde2000", 200, 1, [&]() { after.capture(eng); });
+  bench("sync/delta/horde2000", 200, 1, [&]() {
+    out.bytes.clear();
+    after.encode(before, out);
+  });
+  bench("sync/full/horde2000", 50, 1, [&]() {
+    out.bytes.clear();
+    after.encode(WorldMirror(), out);
+  });
+}
+
+// Taking the stairs of a horde dungeon up and down: with the game played in
+// between, so the dungeon's thread has the next floor ready, and back to
+// back, so each transition waits for it
+static void benchFloors()
+{
+  Engine eng(320, 160, 80, 1, true, 1);
+  HordeConfig horde;
+  horde.enemies = 2000;
+  eng.horde(horde);
+  eng.floors(8, 1);
+  eng.step(TK_ENTER, 1);
+
+  int direction = 1;
+  auto walk = [&]() {
+    if (!eng.takeStairs(direction))
+    {
+      direction = -direction;
+      eng.takeStairs(direction);
+    }
+  };
+  std::vector<double> times;
+  for (int i = 0; i < 40; i++)
+  {
+    for (int frame = 0; frame < 10; frame++)
+    {
+      eng.step(0, 5);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    auto start = std::chrono::steady_clock::now();
+    walk();
+    times.push_back(std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count());
+  }
+  report("floors/stairs/horde2000", 1, times);
+  bench("floors/stairs-back-to-back/horde2000", 40, 1, walk);
+}
+
+// Cave levels: the game's own map, then each pass of the generator on a
+// grid far larger than any level
+static void benchCaves()
+{
+  for (auto size : { std::pair{ 100, 50 }, std::pair{ 320, 160 } })
+  {
+    Arena arena(64 * 1024);
+    Map map(size.first, size.second, arena.resource());
+    unsigned int seed = 0;
+    bench("caves/" + std::to_string(size.first) + "x" + std::to_string(size.second), 50, 1, [&]() {
+      arena.release();
+      map.reset(seed++);
+      map.makeCaves();
+    });
+  }
+
+  const int n = 4096;
+  CaveGrid grid(n, n);
+  std::mt19937 gen(1);
+  std::string name = "caves/" + std::to_string(n) + "x" + std::to_string(n);
+  bench(name + "/fill", 10, 1, [&]() { grid.fill(gen, CAVE_ROCK_PERCENT); });
+  bench(name + "/smooth", 10, 1, [&]() { grid.smooth(); });
+  bench(name + "/generate", 10, 1, [&]() {
+    grid.fill(gen, CAVE_ROCK_PERCENT);
+    for (int i = 0; i < CAVE_STEPS; i++)
+    {
+      grid.smooth();
+    }
+    grid.connect(CAVE_MIN_SIZE);
+  });
+}
+
+// Measuring a level that is already generated: the game's own, and a big
+// one with a horde to walk to
+static void benchAnalysis()
+{
+  LevelAnalyzer analyzer;
+  Engine level(100, 50, 15, 1, true, 1);
+  bench("analysis/level100x50", 200, 1, [&]() { analyzer.analyze(level); });
+
+  Engine big(320, 160, 80, 1, true, 1);
+  HordeConfig horde;
+  horde.enemies = 2000;
+  big.horde(horde);
+  bench("analysis/level320x160/horde2000", 100, 1, [&]() { analyzer.analyze(big); });
+}
+
+// Escape sequences for a whole screen, and for a frame in which only the
+// player and the timer changed
+static void benchAnsi()
+{
+  Map map(100, 50);
+  map.reset(1);
+  map.makeRooms(15);
+  Frame frame;
+  frame.resize(map.map_w, map.map_h);
+  map.render(frame);
+  Actors actors;
+  ActorId player = actors.create(ActorKind::PLAYER, '@', "cyan");
+  actors.move(player, map.getStartCoords(true), map);
+  actors.render(ActorKind::PLAYER, frame);
+  frame.print(0, 0, 0xFFFFFFFF, "Time: 30");
+
+  AnsiTerminal terminal;
+  std::string out;
+  bench("ansi/full100x50", 200, 1, [&]() {
+    out.clear();
+    terminal.invalidate();
+    terminal.compose(frame, out);
+  });
+  size_t fullBytes = out.size();
+
+  int step = 0;
+  terminal.compose(frame, out);
+  bench("ansi/step100x50", 1000, 1, [&]() {
+    step++;
+    int dx = step % 2 == 0 ? 1 : -1;
+    if (!actors.move(player, dx, 0, map))
+    {
+      actors.move(player, -dx, 0, map);
+    }
+    frame.clear();
+    actors.render(ActorKind::PLAYER, frame);
+    frame.print(0, 0, 0xFFFFFFFF, "Time: " + std::to_string(step % 30));
+    map.render(frame);
+    out.clear();
+    terminal.compose(frame, out);
+  });
+
+  std::cerr << "ansi bytes: full frame " << fullBytes << ", step " << out.size() << std::endl;
+}
+
+static void writeJson(std::ostream& out)
+{
+  out << std::fixed << std::setprecision(1);
+  out << "{\n  \"benchmarks\": [\n";
+  for (size_t i = 0; i < g_results.size(); i++)
+  {
+    const BenchResult& r = g_results[i];
+    out << "    { \"name\": \"" << r.name << "\", \"samples\": " << r.samples
+        << ", \"ops_per_sample\": " << r.opsPerSample
+        << ", \"mean_ns\": " << r.meanNs << ", \"median_ns\": " << r.medianNs
+        << ", \"min_ns\": " << r.minNs << ", \"max_ns\": " << r.maxNs << " }"
+        << (i + 1 < g_results.size() ? ",\n" : "\n");
+  }
+  out << "  ]\n}\n";
+}
+
+// DEUngeon.Bench [output.json] [astar|rooms|render|engine|horde|fov|snapshot|sync|floors|caves|analysis|ansi]
+// in either order. Progress goes to stderr, so stdout is only the JSON.
+int main(int argc, char* argv[])
+{
+  struct Group
+  {
+    const char* name;
+    void (*run)();
+  };
+  const Group groups[] = {
+    { "astar", benchPathfinding }, { "rooms", benchGeneration }, { "render", benchRender }, { "engine", benchEngine },
+    { "horde", benchHorde }, { "fov", benchFov }, { "snapshot", benchSnapshot }, { "sync", benchSync },
+    { "floors", benchFloors }, { "caves", benchCaves }, { "analysis", benchAnalysis }, { "ansi", benchAnsi },
+  };
+
+  std::string group;
+  const char* path = nullptr;
+  for (int i = 1; i < argc; i++)
+  {
+    auto known = std::find_if(std::begin(groups), std::end(groups), [&](const Group& g) { return g.name == std::string(argv[i]); });
+    if (known != std::end(groups) && group.empty())
+    {
+      group = argv[i];
+    }
+    else if (known == std::end(groups) && !path)
+    {
+      path = argv[i];
+    }
+    else
+    {
+      std::cerr << "usage: DEUngeon.Bench [output.json] [group]" << std::endl;
+      return 1;
+    }
+  }
+
+  std::ofstream file;
+  if (path)
+  {
+    file.open(path, std::ios::trunc);
+    if (!file)
+    {
+      std::cerr << "Cannot write results: " << path << std::endl;
+      return 1;
+    }
+  }
+
+  for (const Group& g : groups)
+  {
+    if (group.empty() || group == g.name)
+      g.run();
+  }
+
+  std::ostream& out = path ? static_cast<std::ostream&>(file) : std::cout;
+  writeJson(out);
+  out.flush();
+  if (!out)
+  {
+    std::cerr << "Cannot write results: " << (path ? path : "stdout") << std::endl;
+    return 1;
+  }
+  return 0;
+}
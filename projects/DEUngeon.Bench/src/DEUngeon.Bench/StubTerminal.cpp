@@ -0,0 +1,50 @@
+#include <cstdint>
+
+#include <BearLibTerminal.h>
+
+// Headless stand-in for BearLibTerminal. Calls are only counted so that
+// render benchmarks measure the game side of a frame, not a window.
+long long g_stubPuts = 0;
+long long g_stubColors = 0;
+long long g_stubRefreshes = 0;
+
+extern "C"
+{
+  int terminal_open() { return 1; }
+  void terminal_close() {}
+  int terminal_set8(const int8_t*) { return 1; }
+  int terminal_set16(const int16_t*) { return 1; }
+  int terminal_set32(const int32_t*) { return 1; }
+  void terminal_refresh() { g_stubRefreshes++; }
+  void terminal_clear() {}
+  void terminal_clear_area(int, int, int, int) {}
+  void terminal_crop(int, int, int, int) {}
+  void terminal_layer(int) {}
+  void terminal_color(color_t) { g_stubColors++; }
+  void terminal_bkcolor(color_t) {}
+  void terminal_composition(int) {}
+  void terminal_put(int, int, int) { g_stubPuts++; }
+  void terminal_print_ext8(int, int, int, int, int, const int8_t*, int* out_w, int* out_h)
+  {
+    if (out_w) *out_w = 0;
+    if (out_h) *out_h = 0;
+  }
+  void terminal_print_ext16(int, int, int, int, int, const int16_t*, int* out_w, int* out_h)
+  {
+    if (out_w) *out_w = 0;
+    if (out_h) *out_h = 0;
+  }
+  void terminal_print_ext32(int, int, int, int, int, const int32_t*, int* out_w, int* out_h)
+  {
+    if (out_w) *out_w = 0;
+    if (out_h) *out_h = 0;
+  }
+  int terminal_has_input() { return 0; }
+  int terminal_state(int) { return 0; }
+  int terminal_read() { return 0; }
+  int terminal_peek() { return 0; }
+  void terminal_delay(int) {}
+  color_t color_from_name8(const int8_t*) { return 0xFFFFFFFF; }
+  color_t color_from_name16(const int16_t*) { return 0xFFFFFFFF; }
+  color_t color_from_name32(const int32_t*) { return 0xFFFFFFFF; }
+}
@@ -1,157 +1,455 @@
 #pragma once
 
 #include "Map.hpp"
+#include "SpatialGrid.hpp"
 
-class Actor
+using ActorId = int;
+
+enum class ActorKind : uint8_t
 {
-private:
-  int x;
-  int y;
+  PLAYER,
+  ENEMY,
+  DASH,
+  DESTROY,
+  COUNT
+};
+
+// One actor as plain data, for snapshots
+struct ActorRecord
+{
+  ActorId id;
+  ActorKind kind;
   char sym;
-  std::string color;
-  bool alive;
-  std::string originalColor;
+  uint8_t colorId;
+  uint8_t originalColorId;
+  bool faded;
+  Point pos;
+  int moveDelay;
+  int originalMoveDelay;
+  long long moveTimer;
+  int cellDepth;
+};
+
+// Palette entry of a snapshot. Color ids are only meaningful together with
+// the palette they index, which grows in the order colors are first used.
+struct ColorName
+{
+  char name[32];
+};
+
+// Packed actor components. Every array is indexed by slot; actors keep a
+// stable id and dead ones are swap-removed so systems walk contiguous memory.
+class Actors
+{
 public:
-  Actor(char s, std::string scolor);
-  Point getPos();
-  char getSym() const;
-  std::string& getColor();
-  void setColor(std::string scolor);
-  bool canWalk(int dx, int dy, Map& map) const;
-  bool move(int dx, int dy, Map& map);
-  void move(Point pos, Map& map);
-  void changeColor(std::string scolor);
-  void revertColor();
-  void fade();
-  void unfade();
-  bool isAlive() const;
-  void kill();
-  void revive();
-  void render();
+  static constexpr ActorId NONE{ -1 };
+
+  std::vector<ActorId> id;
+  std::vector<ActorKind> kind;
+  std::vector<Point> pos;
+  std::vector<char> sym;
+  std::vector<uint8_t> colorId;
+  std::vector<uint8_t> originalColorId;
+  std::vector<bool> faded;
+  std::vector<int> moveDelay;
+  std::vector<int> originalMoveDelay;
+  std::vector<long long> moveTimer;
+
+  ActorId create(ActorKind k, char s, const char* color, int delay = 0, long long timer = 0);
+  void destroy(ActorId a);
+  void clear();
+  void track(ActorKind k, SpatialGrid* grid);
+  int size() const;
+  int slot(ActorId a) const;
+  bool isAlive(ActorId a) const;
+  Point getPos(ActorId a) const;
+  bool canWalk(int cx, int cy, Map& map) const;
+  bool move(ActorId a, int dx, int dy, Map& map);
+  void move(ActorId a, Point p, Map& map);
+  uint8_t getColor(ActorId a) const;
+  uint8_t color(const char* name);
+  void setColor(ActorId a, uint8_t c);
+  void changeColor(ActorId a, uint8_t c);
+  void revertColor(ActorId a);
+  void fade(ActorId a);
+  void unfade(ActorId a);
+  void stun(ActorId a);
+  void unstun(ActorId a);
+  bool isStunned(ActorId a) const;
+  void rage(ActorId a, uint8_t c, int times = 1);
+  color_t drawColor(int s) const;
+  void render(ActorKind k, Frame& frame) const;
+  void save(std::vector<ActorRecord>& records, std::vector<ActorId>& freeIds, std::vector<ColorName>& palette) const;
+  void restore(const std::vector<ActorRecord>& records, const std::vector<ActorId>& freeIds, int ids,
+               const std::vector<ColorName>& palette, long long shift = 0);
+  int ids() const;
+
+private:
+  std::vector<int> m_slot;
+  std::vector<ActorId> m_free;
+  std::vector<std::string> m_colorNames;
+  std::vector<color_t> m_colors;
+  std::vector<color_t> m_darkerColors;
+  SpatialGrid* m_grids[static_cast<int>(ActorKind::COUNT)]{};
+
+  SpatialGrid* gridOf(int s) const;
+  void place(int s, Point p);
 };
 
-Actor::Actor(char s, std::string scolor)
+ActorId Actors::create(ActorKind k, char s, const char* color, int delay, long long timer)
 {
-  x = 0;
-  y = 0;
-  sym = s;
-  color = scolor;
-  originalColor = scolor;
-  alive = true;
+  ActorId a;
+  if (!m_free.empty())
+  {
+    a = m_free.back();
+    m_free.pop_back();
+  }
+  else
+  {
+    a = static_cast<ActorId>(m_slot.size());
+    m_slot.push_back(NONE);
+  }
+
+  uint8_t c = this->color(color);
+  m_slot[static_cast<size_t>(a)] = size();
+  id.push_back(a);
+  kind.push_back(k);
+  pos.emplace_back(0, 0);
+  sym.push_back(s);
+  colorId.push_back(c);
+  originalColorId.push_back(c);
+  faded.push_back(false);
+  moveDelay.push_back(delay);
+  originalMoveDelay.push_back(delay);
+  moveTimer.push_back(timer);
+
+  if (SpatialGrid* grid = m_grids[static_cast<int>(k)])
+  {
+    grid->insert(a, pos.back());
+  }
+
+  return a;
 }
 
-Point Actor::getPos()
+void Actors::destroy(ActorId a)
 {
-  return Point(x, y);
+  int s = slot(a);
+  if (s == NONE)
+    return;
+
+  if (SpatialGrid* grid = gridOf(s))
+  {
+    grid->remove(a);
+  }
+
+  // Move the last actor into the freed slot
+  auto dst = static_cast<size_t>(s);
+  auto src = id.size() - 1;
+  if (dst != src)
+  {
+    id[dst] = id[src];
+    kind[dst] = kind[src];
+    pos[dst] = pos[src];
+    sym[dst] = sym[src];
+    colorId[dst] = colorId[src];
+    originalColorId[dst] = originalColorId[src];
+    faded[dst] = faded[src];
+    moveDelay[dst] = moveDelay[src];
+    originalMoveDelay[dst] = originalMoveDelay[src];
+    moveTimer[dst] = moveTimer[src];
+    m_slot[static_cast<size_t>(id[dst])] = s;
+  }
+  id.pop_back();
+  kind.pop_back();
+  pos.pop_back();
+  sym.pop_back();
+  colorId.pop_back();
+  originalColorId.pop_back();
+  faded.pop_back();
+  moveDelay.pop_back();
+  originalMoveDelay.pop_back();
+  moveTimer.pop_back();
+
+  m_slot[static_cast<size_t>(a)] = NONE;
+  m_free.push_back(a);
 }
 
-char Actor::getSym() const
+void Actors::clear()
 {
-  return sym;
+  for (auto grid : m_grids)
+  {
+    if (grid)
+      grid->clear();
+  }
+  id.clear();
+  kind.clear();
+  pos.clear();
+  sym.clear();
+  colorId.clear();
+  originalColorId.clear();
+  faded.clear();
+  moveDelay.clear();
+  originalMoveDelay.clear();
+  moveTimer.clear();
+  m_slot.clear();
+  m_free.clear();
 }
 
-std::string& Actor::getColor()
+void Actors::track(ActorKind k, SpatialGrid* grid)
 {
-  return color;
+  m_grids[static_cast<int>(k)] = grid;
 }
 
-void Actor::setColor(std::string scolor)
+int Actors::size() const
 {
-  color = scolor;
-  originalColor = scolor;
+  return static_cast<int>(id.size());
 }
 
-bool Actor::canWalk(int cx, int cy, Map& map) const
+int Actors::slot(ActorId a) const
 {
-  if (!alive)
-    return false;
+  if (a < 0 || static_cast<size_t>(a) >= m_slot.size())
+    return NONE;
 
+  return m_slot[static_cast<size_t>(a)];
+}
+
+bool Actors::isAlive(ActorId a) const
+{
+  return slot(a) != NONE;
+}
+
+Point Actors::getPos(ActorId a) const
+{
+  return pos[static_cast<size_t>(slot(a))];
+}
+
+bool Actors::canWalk(int cx, int cy, Map& map) const
+{
   if (map.inBounds(cx, cy) && !map.board[cy][cx].blocking)
     return true;
 
   return false;
 }
 
-bool Actor::move(int dx, int dy, Map& map)
+bool Actors::move(ActorId a, int dx, int dy, Map& map)
 {
-  if (!alive)
+  int s = slot(a);
+  if (s == NONE)
     return false;
 
-  int nx = x + dx;
-  int ny = y + dy;
+  Point p = pos[static_cast<size_t>(s)];
+  int nx = p.x + dx;
+  int ny = p.y + dy;
   if (canWalk(nx, ny, map))
   {
-    x = nx;
-    y = ny;
+    place(s, Point(nx, ny));
     return true;
   }
 
   return false;
 }
 
-void Actor::move(Point pos, Map& map)
+void Actors::move(ActorId a, Point p, Map& map)
 {
-  if (!alive)
+  int s = slot(a);
+  if (s == NONE)
     return;
 
-  if (canWalk(pos.x, pos.y, map))
+  if (canWalk(p.x, p.y, map))
   {
-    x = pos.x;
-    y = pos.y;
+    place(s, Point(p.x, p.y));
   }
 }
 
-void Actor::changeColor(std::string scolor)
+uint8_t Actors::getColor(ActorId a) const
 {
-  if (!alive)
-    return;
+  return colorId[static_cast<size_t>(slot(a))];
+}
+
+uint8_t Actors::color(const char* name)
+{
+  // Colors are resolved once, actors only carry the palette index
+  for (size_t i = 0; i < m_colorNames.size(); i++)
+  {
+    if (m_colorNames[i] == name)
+      return static_cast<uint8_t>(i);
+  }
 
-  color = scolor;
+  m_colorNames.emplace_back(name);
+  m_colors.push_back(color_from_name(name));
+  m_darkerColors.push_back(color_from_name(("darker " + m_colorNames.back()).c_str()));
+  return static_cast<uint8_t>(m_colorNames.size() - 1);
 }
 
-void Actor::revertColor()
+void Actors::setColor(ActorId a, uint8_t c)
 {
-  if (!alive)
-    return;
+  auto s = static_cast<size_t>(slot(a));
+  colorId[s] = c;
+  originalColorId[s] = c;
+  faded[s] = false;
+}
 
-  color = originalColor;
+void Actors::changeColor(ActorId a, uint8_t c)
+{
+  auto s = static_cast<size_t>(slot(a));
+  colorId[s] = c;
+  faded[s] = false;
 }
 
-void Actor::fade()
+void Actors::revertColor(ActorId a)
 {
-  if (!alive)
-    return;
+  auto s = static_cast<size_t>(slot(a));
+  colorId[s] = originalColorId[s];
+  faded[s] = false;
+}
 
-  color = "darker " + color;
+void Actors::fade(ActorId a)
+{
+  faded[static_cast<size_t>(slot(a))] = true;
 }
 
-void Actor::unfade()
+void Actors::unfade(ActorId a)
 {
-  if (!alive)
-    return;
-  color = color.substr(7);
+  faded[static_cast<size_t>(slot(a))] = false;
 }
 
-bool Actor::isAlive() const
+void Actors::stun(ActorId a)
 {
-  return alive;
+  fade(a);
+  moveDelay[static_cast<size_t>(slot(a))] = 2000;
 }
 
-void Actor::kill()
+void Actors::unstun(ActorId a)
 {
-  alive = false;
+  auto s = static_cast<size_t>(slot(a));
+  unfade(a);
+  moveDelay[s] = originalMoveDelay[s];
 }
 
-void Actor::revive()
+bool Actors::isStunned(ActorId a) const
 {
-  alive = true;
+  auto s = static_cast<size_t>(slot(a));
+  return moveDelay[s] != originalMoveDelay[s];
 }
 
-void Actor::render()
+void Actors::rage(ActorId a, uint8_t c, int times)
 {
-  if (!alive)
-    return;
+  auto s = static_cast<size_t>(slot(a));
+  for (int i = 0; i < times; i++)
+  {
+    originalMoveDelay[s] = moveDelay[s] = static_cast<int>(originalMoveDelay[s] * 0.8F);
+  }
+  setColor(a, c);
+}
+
+// The color the actor in slot s is drawn in
+color_t Actors::drawColor(int s) const
+{
+  auto index = static_cast<size_t>(s);
+  auto c = static_cast<size_t>(colorId[index]);
+  return faded[index] ? m_darkerColors[c] : m_colors[c];
+}
+
+void Actors::render(ActorKind k, Frame& frame) const
+{
+  for (size_t s = 0; s < id.size(); s++)
+  {
+    if (kind[s] != k)
+      continue;
+
+    frame.actor(pos[s].x, pos[s].y, drawColor(static_cast<int>(s)), sym[s]);
+  }
+}
+
+void Actors::save(std::vector<ActorRecord>& records, std::vector<ActorId>& freeIds, std::vector<ColorName>& palette) const
+{
+  records.resize(id.size());
+  for (size_t s = 0; s < id.size(); s++)
+  {
+    records[s] = ActorRecord{ id[s], kind[s], sym[s], colorId[s], originalColorId[s], faded[s], pos[s],
+                              moveDelay[s], originalMoveDelay[s], moveTimer[s], 0 };
+
+    // Actors sharing a tile are visited in list order, which restore() has
+    // to rebuild for a restored game to play out the same
+    if (SpatialGrid* grid = gridOf(static_cast<int>(s)))
+    {
+      for (int other = grid->first(pos[s].x, pos[s].y); other != id[s] && other != SpatialGrid::NONE; other = grid->next(other))
+      {
+        records[s].cellDepth++;
+      }
+    }
+  }
+  freeIds = m_free;
+  palette.resize(m_colorNames.size());
+  for (size_t i = 0; i < m_colorNames.size(); i++)
+  {
+    std::snprintf(palette[i].name, sizeof(palette[i].name), "%s", m_colorNames[i].c_str());
+  }
+}
+
+// Puts back the actors of save(), in the same slots. ids is how many ids
+// had been handed out, so new ones continue where the saved game was;
+// shift moves every move timer.
+void Actors::restore(const std::vector<ActorRecord>& records, const std::vector<ActorId>& freeIds, int ids,
+                     const std::vector<ColorName>& palette, long long shift)
+{
+  // The saved palette may have grown in another order than this one
+  std::vector<uint8_t> remap(palette.size());
+  for (size_t i = 0; i < palette.size(); i++)
+  {
+    remap[i] = color(palette[i].name);
+  }
 
-  terminal_color(color_from_name(color.c_str()));
-  terminal_put(x, y, sym);
+  clear();
+  m_slot.assign(static_cast<size_t>(ids), NONE);
+  m_free = freeIds;
+  for (const ActorRecord& r : records)
+  {
+    m_slot[static_cast<size_t>(r.id)] = size();
+    id.push_back(r.id);
+    kind.push_back(r.kind);
+    pos.push_back(r.pos);
+    sym.push_back(r.sym);
+    colorId.push_back(remap[r.colorId]);
+    originalColorId.push_back(remap[r.originalColorId]);
+    faded.push_back(r.faded);
+    moveDelay.push_back(r.moveDelay);
+    originalMoveDelay.push_back(r.originalMoveDelay);
+    moveTimer.push_back(r.moveTimer + shift);
+  }
+
+  // Tiles list their latest arrival first, so the deepest go in first
+  std::vector<size_t> order(records.size());
+  for (size_t i = 0; i < order.size(); i++)
+  {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return records[a].cellDepth > records[b].cellDepth; });
+  for (size_t i : order)
+  {
+    if (SpatialGrid* grid = m_grids[static_cast<int>(records[i].kind)])
+    {
+      grid->insert(records[i].id, records[i].pos);
+    }
+  }
+}
+
+int Actors::ids() const
+{
+  return static_cast<int>(m_slot.size());
+}
+
+SpatialGrid* Actors::gridOf(int s) const
+{
+  return m_grids[static_cast<int>(kind[static_cast<size_t>(s)])];
+}
+
+void Actors::place(int s, Point p)
+{
+  auto index = static_cast<size_t>(s);
+  pos[index] = p;
+  if (SpatialGrid* grid = gridOf(s))
+  {
+    grid->move(id[index], p);
+  }
 }
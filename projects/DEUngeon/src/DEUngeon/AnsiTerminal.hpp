@@ -0,0 +1,508 @@
+#pragma once
+
+#include "Frame.hpp"
+
+// Frames drawn with ANSI/VT escape sequences straight to a POSIX terminal,
+// for playing without a window, over SSH for example. Only the cells that
+// changed since the last frame are sent, and each frame goes out in a
+// single write(). Windows keeps the BearLibTerminal window.
+#ifndef _WIN32
+#include <cerrno>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+#endif
+
+// Output of the frames drawn since the terminal was opened
+struct AnsiStats
+{
+  long long frames{};
+  long long cells{};
+  long long moves{};
+  long long colors{};
+  long long bytes{};
+  long long writes{};
+};
+
+class AnsiTerminal
+{
+public:
+  AnsiTerminal() = default;
+  AnsiTerminal(const AnsiTerminal&) = delete;
+  AnsiTerminal& operator=(const AnsiTerminal&) = delete;
+  ~AnsiTerminal();
+
+  // Standard input and output are both a terminal
+  static bool available();
+
+  // Raw input, alternate screen and a hidden cursor until close()
+  bool open();
+  void close();
+  // Sends what changed since the last frame, returns the bytes written
+  size_t draw(const Frame& frame);
+  // Appends the escape sequences that turn the screen last composed into
+  // frame, without writing them anywhere
+  void compose(const Frame& frame, std::string& out);
+  // Forgets what is on the screen, the next frame is sent whole
+  void invalidate();
+  bool hasInput();
+  // Next key as a TK_ code, 0 if there is none
+  int read();
+  const AnsiStats& stats() const;
+
+private:
+  static constexpr size_t KEY_CAPACITY{ 64 };
+  static constexpr int GAP_REWRITE{ 4 };
+  // How long the rest of an escape sequence may take to arrive, over SSH
+  // a key's bytes can come in separate reads
+  static constexpr int ESCAPE_WAIT_MS{ 100 };
+
+  bool m_open{};
+  int m_width{};
+  int m_height{};
+  // Size of the terminal, cells outside it are not sent
+  int m_columns{ 1 << 16 };
+  int m_rows{ 1 << 16 };
+  std::vector<FrameCell> m_next;
+  std::vector<FrameCell> m_shown;
+  // Colour the terminal writes with, alpha 0 when it is not known
+  color_t m_pen{};
+  std::string m_out;
+  unsigned char m_input[KEY_CAPACITY]{};
+  size_t m_inputSize{};
+  // When the unfinished sequence at the front of m_input arrived
+  std::chrono::steady_clock::time_point m_partialSince;
+  int m_keys[KEY_CAPACITY]{};
+  size_t m_keyHead{};
+  size_t m_keyTail{};
+  AnsiStats m_stats;
+
+  void layout(const Frame& frame);
+  bool same(const FrameCell& a, const FrameCell& b) const;
+  void moveTo(std::string& out, int x, int y);
+  void setPen(std::string& out, color_t color);
+  void put(std::string& out, const FrameCell& cell);
+  void fill();
+  size_t parseKey(const unsigned char* bytes, size_t size, bool final);
+  void pushKey(int key);
+  void writeAll(const std::string& out);
+  static void appendNumber(std::string& out, unsigned int value);
+
+#ifndef _WIN32
+  static termios s_saved;
+  static bool s_raw;
+  static void restore();
+  static void onSignal(int sig);
+#endif
+};
+
+void AnsiTerminal::appendNumber(std::string& out, unsigned int value)
+{
+  char digits[10];
+  int n = 0;
+  do
+  {
+    digits[n++] = static_cast<char>('0' + value % 10);
+    value /= 10;
+  } while (value != 0);
+  while (n > 0)
+  {
+    out += digits[--n];
+  }
+}
+
+#ifndef _WIN32
+termios AnsiTerminal::s_saved{};
+bool AnsiTerminal::s_raw{};
+#endif
+
+AnsiTerminal::~AnsiTerminal()
+{
+  close();
+}
+
+bool AnsiTerminal::available()
+{
+#ifdef _WIN32
+  return false;
+#else
+  return isatty(STDIN_FILENO) && isatty(STDOUT_FILENO);
+#endif
+}
+
+bool AnsiTerminal::open()
+{
+#ifdef _WIN32
+  return false;
+#else
+  if (m_open || !available() || tcgetattr(STDIN_FILENO, &s_saved) != 0)
+    return m_open;
+
+  // Keys arrive one at a time without echo; Ctrl+C still interrupts, and
+  // the terminal is put back before the game goes
+  termios raw = s_saved;
+  raw.c_iflag &= ~static_cast<tcflag_t>(ICRNL | IXON | BRKINT | ISTRIP | INPCK);
+  raw.c_lflag &= ~static_cast<tcflag_t>(ICANON | ECHO | IEXTEN);
+  raw.c_cc[VMIN] = 0;
+  raw.c_cc[VTIME] = 0;
+  if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) != 0)
+    return false;
+
+  s_raw = true;
+  std::signal(SIGINT, onSignal);
+  std::signal(SIGTERM, onSignal);
+  std::signal(SIGHUP, onSignal);
+
+  winsize size{};
+  if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_col > 0 && size.ws_row > 0)
+  {
+    m_columns = size.ws_col;
+    m_rows = size.ws_row;
+  }
+  m_open = true;
+  invalidate();
+  writeAll("\x1b[?1049h\x1b[?25l");
+  return true;
+#endif
+}
+
+void AnsiTerminal::close()
+{
+#ifndef _WIN32
+  if (!m_open)
+    return;
+
+  m_open = false;
+  restore();
+  std::signal(SIGINT, SIG_DFL);
+  std::signal(SIGTERM, SIG_DFL);
+  std::signal(SIGHUP, SIG_DFL);
+#endif
+}
+
+size_t AnsiTerminal::draw(const Frame& frame)
+{
+  m_out.clear();
+  compose(frame, m_out);
+  if (m_out.empty())
+    return 0;
+
+  writeAll(m_out);
+  m_stats.writes++;
+  m_stats.bytes += static_cast<long long>(m_out.size());
+  return m_out.size();
+}
+
+// Changed cells are written row by row. Neighbouring ones need no cursor
+// move, a few unchanged cells between two changes are written again when
+// that is shorter than a move, and the colour is only set when it differs
+// from the one the terminal writes with.
+void AnsiTerminal::compose(const Frame& frame, std::string& out)
+{
+  layout(frame);
+  m_stats.frames++;
+  if (m_shown.size() != m_next.size())
+  {
+    // Cleared screen, every cell is sent
+    out += "\x1b[0m\x1b[2J";
+    m_pen = 0;
+    m_shown.assign(m_next.size(), FrameCell{ 0, 0 });
+  }
+
+  int width = std::min(m_width, m_columns);
+  int height = std::min(m_height, m_rows);
+  int cursorX = -1;
+  int cursorY = -1;
+  for (int y = 0; y < height; y++)
+  {
+    const FrameCell* next = &m_next[static_cast<size_t>(y) * static_cast<size_t>(m_width)];
+    FrameCell* shown = &m_shown[static_cast<size_t>(y) * static_cast<size_t>(m_width)];
+    for (int x = 0; x < width; x++)
+    {
+      if (same(next[x], shown[x]))
+        continue;
+
+      int gap = x - cursorX;
+      bool rewrite = cursorY == y && gap > 0 && gap <= GAP_REWRITE;
+      for (int g = cursorX; rewrite && g < x; g++)
+      {
+        rewrite = next[g].sym == ' ' || next[g].color == m_pen;
+      }
+      if (rewrite)
+      {
+        for (int g = cursorX; g < x; g++)
+        {
+          put(out, next[g]);
+        }
+      }
+      else if (cursorY != y || cursorX != x)
+      {
+        moveTo(out, x, y);
+      }
+
+      put(out, next[x]);
+      shown[x] = next[x];
+      m_stats.cells++;
+      cursorX = x + 1;
+      cursorY = y;
+    }
+  }
+}
+
+void AnsiTerminal::invalidate()
+{
+  m_shown.clear();
+}
+
+bool AnsiTerminal::hasInput()
+{
+  if (m_keyHead == m_keyTail)
+  {
+    fill();
+  }
+  return m_keyHead != m_keyTail;
+}
+
+int AnsiTerminal::read()
+{
+  if (!hasInput())
+    return 0;
+
+  return m_keys[m_keyTail++ % KEY_CAPACITY];
+}
+
+const AnsiStats& AnsiTerminal::stats() const
+{
+  return m_stats;
+}
+
+// The frame as cells: tiles, then the actors and text over them
+void AnsiTerminal::layout(const Frame& frame)
+{
+  m_width = frame.width;
+  m_height = frame.height;
+  m_next.assign(frame.tiles.begin(), frame.tiles.end());
+  auto cell = [&](int x, int y) -> FrameCell* {
+    if (x < 0 || y < 0 || x >= m_width || y >= m_height)
+      return nullptr;
+
+    return &m_next[static_cast<size_t>(y) * static_cast<size_t>(m_width) + static_cast<size_t>(x)];
+  };
+
+  for (const FrameActor& a : frame.actors)
+  {
+    if (FrameCell* c = cell(a.x, a.y))
+    {
+      *c = FrameCell{ a.color, a.sym };
+    }
+  }
+  for (const FrameText& t : frame.text)
+  {
+    for (size_t i = 0; i < t.text.size(); i++)
+    {
+      if (FrameCell* c = cell(t.x + static_cast<int>(i), t.y))
+      {
+        *c = FrameCell{ t.color, t.text[i] };
+      }
+    }
+  }
+}
+
+// Blanks look the same in any colour
+bool AnsiTerminal::same(const FrameCell& a, const FrameCell& b) const
+{
+  return a.sym == b.sym && (a.sym == ' ' || a.color == b.color);
+}
+
+void AnsiTerminal::moveTo(std::string& out, int x, int y)
+{
+  out += "\x1b[";
+  appendNumber(out, static_cast<unsigned int>(y + 1));
+  out += ';';
+  appendNumber(out, static_cast<unsigned int>(x + 1));
+  out += 'H';
+  m_stats.moves++;
+}
+
+// 24-bit colour from BearLibTerminal's 0xAARRGGBB
+void AnsiTerminal::setPen(std::string& out, color_t color)
+{
+  out += "\x1b[38;2;";
+  appendNumber(out, (color >> 16) & 0xFF);
+  out += ';';
+  appendNumber(out, (color >> 8) & 0xFF);
+  out += ';';
+  appendNumber(out, color & 0xFF);
+  out += 'm';
+  m_pen = color;
+  m_stats.colors++;
+}
+
+void AnsiTerminal::put(std::string& out, const FrameCell& cell)
+{
+  char sym = cell.sym >= ' ' && cell.sym <= '~' ? cell.sym : ' ';
+  if (sym != ' ' && (cell.color != m_pen || (m_pen >> 24) == 0))
+  {
+    setPen(out, cell.color);
+  }
+  out += sym;
+}
+
+// Reads whatever is waiting on standard input without blocking
+void AnsiTerminal::fill()
+{
+#ifndef _WIN32
+  if (!m_open)
+    return;
+
+  // Bytes left from before are the start of an escape sequence
+  bool waiting = m_inputSize > 0;
+  pollfd in{ STDIN_FILENO, POLLIN, 0 };
+  while (poll(&in, 1, 0) > 0 && (in.revents & POLLIN) != 0 && m_inputSize < KEY_CAPACITY)
+  {
+    ssize_t n = ::read(STDIN_FILENO, m_input + m_inputSize, KEY_CAPACITY - m_inputSize);
+    if (n <= 0)
+      break;
+
+    m_inputSize += static_cast<size_t>(n);
+  }
+
+  // An unfinished sequence waits for the next read, until it took too long
+  // or fills the buffer
+  auto now = std::chrono::steady_clock::now();
+  bool final = m_inputSize == KEY_CAPACITY
+    || (waiting && now - m_partialSince >= std::chrono::milliseconds(ESCAPE_WAIT_MS));
+  size_t used = 0;
+  while (used < m_inputSize)
+  {
+    size_t taken = parseKey(m_input + used, m_inputSize - used, final);
+    if (taken == 0)
+      break;
+
+    used += taken;
+  }
+  if (used > 0 || !waiting)
+  {
+    std::memmove(m_input, m_input + used, m_inputSize - used);
+    m_inputSize -= used;
+    m_partialSince = now;
+  }
+#endif
+}
+
+// Turns the bytes a key sends into its TK_ code, returns how many it took,
+// 0 while the bytes only start an escape sequence. Once final, the start
+// of one is taken as it is: a lone escape is Escape, the rest is dropped.
+// Terminals report no key for Shift on its own, so Tab dashes.
+size_t AnsiTerminal::parseKey(const unsigned char* bytes, size_t size, bool final)
+{
+  unsigned char c = bytes[0];
+  if (c == 0x1b)
+  {
+    if (size == 1 && !final)
+      return 0;
+    if (size == 1 || (bytes[1] != '[' && bytes[1] != 'O'))
+    {
+      pushKey(TK_ESCAPE);
+      return 1;
+    }
+
+    // CSI or SS3: parameters up to a final byte, "1;2A" is Shift+Up
+    size_t end = 2;
+    unsigned int number = 0;
+    while (end < size && bytes[end] >= 0x20 && bytes[end] < 0x40)
+    {
+      number = bytes[end] >= '0' && bytes[end] <= '9' ? number * 10 + (bytes[end] - '0') : 0;
+      end++;
+    }
+    if (end == size)
+      return final ? size : 0;
+
+    switch (bytes[end])
+    {
+      case 'A': pushKey(TK_UP); break;
+      case 'B': pushKey(TK_DOWN); break;
+      case 'C': pushKey(TK_RIGHT); break;
+      case 'D': pushKey(TK_LEFT); break;
+      case 'P': pushKey(TK_F1); break;
+      case 'Q': pushKey(TK_F2); break;
+      case '~':
+        // F5 and F9 are the ones the game uses
+        if (number == 15)
+          pushKey(TK_F5);
+        else if (number == 20)
+          pushKey(TK_F9);
+        break;
+      default:
+        break;
+    }
+    return end + 1;
+  }
+
+  if (c >= 'a' && c <= 'z')
+    pushKey(TK_A + (c - 'a'));
+  else if (c >= 'A' && c <= 'Z')
+    pushKey(TK_A + (c - 'A'));
+  else if (c >= '1' && c <= '9')
+    pushKey(TK_1 + (c - '1'));
+  else if (c == '0')
+    pushKey(TK_0);
+  else if (c == '\r' || c == '\n')
+    pushKey(TK_ENTER);
+  else if (c == ' ')
+    pushKey(TK_SPACE);
+  else if (c == '\t')
+    pushKey(TK_SHIFT);
+  else if (c == 0x7f || c == 0x08)
+    pushKey(TK_BACKSPACE);
+  return 1;
+}
+
+void AnsiTerminal::pushKey(int key)
+{
+  if (m_keyHead - m_keyTail == KEY_CAPACITY)
+    return;
+
+  m_keys[m_keyHead++ % KEY_CAPACITY] = key;
+}
+
+// write() may take less than it was given, the rest follows at once
+void AnsiTerminal::writeAll(const std::string& out)
+{
+#ifndef _WIN32
+  size_t done = 0;
+  while (done < out.size())
+  {
+    ssize_t n = ::write(STDOUT_FILENO, out.data() + done, out.size() - done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+
+    done += static_cast<size_t>(n);
+  }
+#endif
+}
+
+#ifndef _WIN32
+// Also run from the signal handler, so only async-signal-safe calls
+void AnsiTerminal::restore()
+{
+  if (!s_raw)
+    return;
+
+  s_raw = false;
+  const char leave[] = "\x1b[0m\x1b[?25h\x1b[?1049l";
+  ssize_t written = ::write(STDOUT_FILENO, leave, sizeof(leave) - 1);
+  (void)written;
+  tcsetattr(STDIN_FILENO, TCSAFLUSH, &s_saved);
+}
+
+void AnsiTerminal::onSignal(int sig)
+{
+  restore();
+  std::signal(sig, SIG_DFL);
+  std::raise(sig);
+}
+#endif
@@ -0,0 +1,29 @@
+#pragma once
+
+// Monotonic arena for per-level scratch allocations. Everything handed out
+// is released at once when the next level starts; the backing buffer stays.
+class Arena
+{
+public:
+  Arena(size_t size)
+    : m_buffer(size)
+    , m_resource(m_buffer.data(), m_buffer.size())
+  {
+  }
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+
+  std::pmr::memory_resource* resource()
+  {
+    return &m_resource;
+  }
+
+  void release()
+  {
+    m_resource.release();
+  }
+
+private:
+  std::vector<std::byte> m_buffer;
+  std::pmr::monotonic_buffer_resource m_resource;
+};
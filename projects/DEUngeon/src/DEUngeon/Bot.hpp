@@ -0,0 +1,14 @@
+#pragma once
+
+class Engine;
+
+// Plays in place of the keyboard. The engine asks for one key per frame
+// while the game runs; 0 presses nothing and keeps the last key held.
+class BotPolicy
+{
+public:
+  virtual ~BotPolicy() = default;
+  virtual const char* name() const = 0;
+  virtual void newGame(unsigned int) {}
+  virtual int nextKey(const Engine& engine) = 0;
+};
@@ -0,0 +1,326 @@
+#pragma once
+
+// Cave layout with one bit per tile, set for rock. Every row has a guard
+// word of rock on both sides and the grid a guard row above and below, so
+// the neighbour counts need no edge cases and compilers vectorise them.
+class CaveGrid
+{
+public:
+  CaveGrid(int width, int height, std::pmr::memory_resource* mr = std::pmr::get_default_resource());
+  void fill(std::mt19937& gen, int rockPercent);
+  void smooth();
+  int connect(int minSize);
+  bool rock(int x, int y) const;
+  template <typename F>
+  void forEachFloor(F&& f) const;
+
+private:
+  int m_width;
+  int m_height;
+  size_t m_words;
+  size_t m_stride;
+  std::pmr::vector<uint64_t> m_cells;
+  std::pmr::vector<uint64_t> m_next;
+  std::pmr::vector<uint64_t> m_sum0;
+  std::pmr::vector<uint64_t> m_sum1;
+  std::pmr::memory_resource* m_arena;
+
+  uint64_t* row(int y);
+  const uint64_t* row(int y) const;
+  void seal(std::pmr::vector<uint64_t>& grid);
+  void setRange(int y, int x0, int x1, bool rock);
+  void carve(int ax, int ay, int bx, int by);
+};
+
+CaveGrid::CaveGrid(int width, int height, std::pmr::memory_resource* mr)
+  : m_width(width)
+  , m_height(height)
+  , m_words((static_cast<size_t>(width) + 63) / 64)
+  , m_stride(m_words + 2)
+  , m_cells(m_stride * (static_cast<size_t>(height) + 2), ~uint64_t{ 0 }, mr)
+  , m_next(m_cells.size(), ~uint64_t{ 0 }, mr)
+  , m_sum0(m_cells.size(), 0, mr)
+  , m_sum1(m_cells.size(), 0, mr)
+  , m_arena(mr)
+{
+}
+
+uint64_t* CaveGrid::row(int y)
+{
+  return m_cells.data() + (static_cast<size_t>(y) + 1) * m_stride + 1;
+}
+
+const uint64_t* CaveGrid::row(int y) const
+{
+  return m_cells.data() + (static_cast<size_t>(y) + 1) * m_stride + 1;
+}
+
+// Each tile is rock with rockPercent chance, rounded to 1/64. Every bit of
+// the chance in binary takes one random word, from the lowest up: a set
+// bit ORs it in, a clear one ANDs it, which is 64 coin flips at a time.
+// The words come from splitmix64 seeded by gen, far cheaper per word than
+// a Mersenne twister.
+void CaveGrid::fill(std::mt19937& gen, int rockPercent)
+{
+  uint64_t state = static_cast<uint64_t>(gen()) << 32 | gen();
+  auto bits = [&state]() {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+  };
+  uint64_t chance = static_cast<uint64_t>(std::clamp(rockPercent, 0, 100)) * 64 / 100;
+  for (int y = 0; y < m_height; y++)
+  {
+    uint64_t* cells = row(y);
+    for (size_t i = 0; i < m_words; i++)
+    {
+      uint64_t word = 0;
+      for (int b = 0; b < 6; b++)
+      {
+        word = (chance >> b) & 1 ? word | bits() : word & bits();
+      }
+      cells[i] = chance == 64 ? ~uint64_t{ 0 } : word;
+    }
+  }
+  seal(m_cells);
+}
+
+// One step of the 4-5 rule: a tile turns to rock when five or more of the
+// nine tiles around and including it are rock. Three bits of a row are
+// summed across first, then the three row sums down, all as bit-sliced
+// adders over 64 tiles per word.
+void CaveGrid::smooth()
+{
+  const size_t rows = static_cast<size_t>(m_height) + 2;
+  for (size_t r = 0; r < rows; r++)
+  {
+    const uint64_t* c = m_cells.data() + r * m_stride;
+    uint64_t* s0 = m_sum0.data() + r * m_stride;
+    uint64_t* s1 = m_sum1.data() + r * m_stride;
+    for (size_t i = 1; i <= m_words; i++)
+    {
+      uint64_t left = (c[i] << 1) | (c[i - 1] >> 63);
+      uint64_t right = (c[i] >> 1) | (c[i + 1] << 63);
+      uint64_t half = left ^ c[i];
+      s0[i] = half ^ right;
+      s1[i] = (left & c[i]) | (half & right);
+    }
+  }
+
+  for (size_t r = 1; r + 1 < rows; r++)
+  {
+    const uint64_t* a0 = m_sum0.data() + (r - 1) * m_stride;
+    const uint64_t* a1 = m_sum1.data() + (r - 1) * m_stride;
+    const uint64_t* b0 = m_sum0.data() + r * m_stride;
+    const uint64_t* b1 = m_sum1.data() + r * m_stride;
+    const uint64_t* c0 = m_sum0.data() + (r + 1) * m_stride;
+    const uint64_t* c1 = m_sum1.data() + (r + 1) * m_stride;
+    uint64_t* next = m_next.data() + r * m_stride;
+    for (size_t i = 1; i <= m_words; i++)
+    {
+      // Ones, then twos with the carry of the ones, then fours and eights
+      uint64_t ones = a0[i] ^ b0[i] ^ c0[i];
+      uint64_t carry = (a0[i] & b0[i]) | (c0[i] & (a0[i] ^ b0[i]));
+      uint64_t twosHalf = a1[i] ^ b1[i] ^ c1[i];
+      uint64_t foursHalf = (a1[i] & b1[i]) | (c1[i] & (a1[i] ^ b1[i]));
+      uint64_t twos = twosHalf ^ carry;
+      uint64_t foursCarry = twosHalf & carry;
+      uint64_t fours = foursHalf ^ foursCarry;
+      uint64_t eights = foursHalf & foursCarry;
+      next[i] = eights | (fours & (twos | ones));
+    }
+  }
+  seal(m_next);
+  m_cells.swap(m_next);
+}
+
+// Rock along the map edge and in the bits past the last column
+void CaveGrid::seal(std::pmr::vector<uint64_t>& grid)
+{
+  uint64_t* top = grid.data() + m_stride + 1;
+  uint64_t* bottom = grid.data() + static_cast<size_t>(m_height) * m_stride + 1;
+  std::fill(top, top + m_words, ~uint64_t{ 0 });
+  std::fill(bottom, bottom + m_words, ~uint64_t{ 0 });
+
+  int last = m_width - 1;
+  uint64_t padding = last % 64 == 63 ? 0 : ~uint64_t{ 0 } << (last % 64 + 1);
+  for (int y = 0; y < m_height; y++)
+  {
+    uint64_t* cells = grid.data() + (static_cast<size_t>(y) + 1) * m_stride + 1;
+    cells[0] |= 1;
+    cells[last / 64] |= (uint64_t{ 1 } << (last % 64)) | padding;
+  }
+}
+
+bool CaveGrid::rock(int x, int y) const
+{
+  return (row(y)[x / 64] >> (x % 64)) & 1;
+}
+
+// Columns x0 up to but not including x1 of row y
+void CaveGrid::setRange(int y, int x0, int x1, bool rock)
+{
+  uint64_t* cells = row(y);
+  for (int x = x0; x < x1;)
+  {
+    int bits = std::min(64 - x % 64, x1 - x);
+    uint64_t mask = (bits == 64 ? ~uint64_t{ 0 } : (uint64_t{ 1 } << bits) - 1) << (x % 64);
+    cells[x / 64] = rock ? cells[x / 64] | mask : cells[x / 64] & ~mask;
+    x += bits;
+  }
+}
+
+// Digs along row ay to column bx, then down or up it to by, like the
+// tunnels between rooms
+void CaveGrid::carve(int ax, int ay, int bx, int by)
+{
+  setRange(ay, std::min(ax, bx), std::max(ax, bx) + 1, false);
+  for (int y = std::min(ay, by); y <= std::max(ay, by); y++)
+  {
+    setRange(y, bx, bx + 1, false);
+  }
+}
+
+// Fills caves smaller than minSize tiles and tunnels every other one to the
+// nearest cave already joined, biggest first, so all floor is reachable.
+// Caves are found as runs of floor per row, joined where runs of adjacent
+// rows overlap. Returns how many caves are left before tunnelling.
+int CaveGrid::connect(int minSize)
+{
+  std::pmr::vector<int> edges(m_arena);
+  std::pmr::vector<int> rowStart(m_arena);
+  edges.reserve(static_cast<size_t>(m_height) * m_words * 8);
+  rowStart.reserve(static_cast<size_t>(m_height) + 1);
+  // A run starts and ends where a tile differs from the one left of it.
+  // The edge columns are rock, so the changes of a row pair up and run r
+  // is the columns from edges[2r] up to edges[2r + 1].
+  for (int y = 0; y < m_height; y++)
+  {
+    rowStart.push_back(static_cast<int>(edges.size() / 2));
+    const uint64_t* cells = row(y);
+    for (size_t i = 0; i < m_words; i++)
+    {
+      for (uint64_t change = cells[i] ^ ((cells[i] << 1) | (cells[i - 1] >> 63)); change != 0; change &= change - 1)
+      {
+        edges.push_back(static_cast<int>(i * 64) + std::countr_zero(change));
+      }
+    }
+  }
+  rowStart.push_back(static_cast<int>(edges.size() / 2));
+  auto x0 = [&](int r) { return edges[static_cast<size_t>(r) * 2]; };
+  auto x1 = [&](int r) { return edges[static_cast<size_t>(r) * 2 + 1]; };
+
+  std::pmr::vector<int> parent(edges.size() / 2, 0, m_arena);
+  for (size_t i = 0; i < parent.size(); i++)
+  {
+    parent[i] = static_cast<int>(i);
+  }
+  auto find = [&](int i) {
+    while (parent[static_cast<size_t>(i)] != i)
+    {
+      parent[static_cast<size_t>(i)] = parent[static_cast<size_t>(parent[static_cast<size_t>(i)])];
+      i = parent[static_cast<size_t>(i)];
+    }
+    return i;
+  };
+  // The root is always the first run of a cave, which keeps paths short
+  // since runs are joined in the order they were found
+  auto join = [&](int a, int b) {
+    a = find(a);
+    b = find(b);
+    parent[static_cast<size_t>(std::max(a, b))] = std::min(a, b);
+  };
+  for (int y = 1; y < m_height; y++)
+  {
+    int a = rowStart[static_cast<size_t>(y) - 1];
+    int b = rowStart[static_cast<size_t>(y)];
+    int aEnd = b;
+    int bEnd = rowStart[static_cast<size_t>(y) + 1];
+    while (a < aEnd && b < bEnd)
+    {
+      if (x0(a) < x1(b) && x0(b) < x1(a))
+      {
+        join(a, b);
+      }
+      // Step past whichever run ends first
+      if (x1(a) < x1(b))
+        a++;
+      else
+        b++;
+    }
+  }
+
+  // Parents come before their runs, so one pass in order finds every root
+  std::pmr::vector<int> size(parent.size(), 0, m_arena);
+  std::pmr::vector<int>& root = parent;
+  for (size_t i = 0; i < parent.size(); i++)
+  {
+    root[i] = root[static_cast<size_t>(parent[i])];
+    size[static_cast<size_t>(root[i])] += x1(static_cast<int>(i)) - x0(static_cast<int>(i));
+  }
+
+  // A cave is reached through the middle of its first run
+  struct Cave
+  {
+    int size;
+    int x;
+    int y;
+  };
+  std::pmr::vector<Cave> caves(m_arena);
+  for (int y = 0; y < m_height; y++)
+  {
+    for (int r = rowStart[static_cast<size_t>(y)]; r < rowStart[static_cast<size_t>(y) + 1]; r++)
+    {
+      auto i = static_cast<size_t>(r);
+      if (size[static_cast<size_t>(root[i])] < minSize)
+      {
+        setRange(y, x0(r), x1(r), true);
+      }
+      else if (root[i] == r)
+      {
+        caves.push_back({ size[i], (x0(r) + x1(r) - 1) / 2, y });
+      }
+    }
+  }
+
+  std::stable_sort(caves.begin(), caves.end(), [](const Cave& a, const Cave& b) { return a.size > b.size; });
+  for (size_t i = 1; i < caves.size(); i++)
+  {
+    const Cave& from = caves[i];
+    size_t nearest = 0;
+    int best = std::numeric_limits<int>::max();
+    for (size_t j = 0; j < i; j++)
+    {
+      int d = std::abs(caves[j].x - from.x) + std::abs(caves[j].y - from.y);
+      if (d < best)
+      {
+        best = d;
+        nearest = j;
+      }
+    }
+    carve(from.x, from.y, caves[nearest].x, caves[nearest].y);
+  }
+  return static_cast<int>(caves.size());
+}
+
+// Calls f(x, y) for every floor tile, skipping rock a word at a time
+template <typename F>
+void CaveGrid::forEachFloor(F&& f) const
+{
+  for (int y = 0; y < m_height; y++)
+  {
+    const uint64_t* cells = row(y);
+    for (size_t i = 0; i < m_words; i++)
+    {
+      for (uint64_t floor = ~cells[i]; floor != 0; floor &= floor - 1)
+      {
+        int x = static_cast<int>(i * 64) + std::countr_zero(floor);
+        if (x < m_width)
+        {
+          f(x, y);
+        }
+      }
+    }
+  }
+}
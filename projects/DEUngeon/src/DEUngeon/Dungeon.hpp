@@ -0,0 +1,365 @@
+#pragma once
+
+#include "FlowField.hpp"
+#include "Snapshot.hpp"
+
+// A floor while nobody plays it: the game on it without any players, and
+// the flow field from the stairs players come in by
+struct Floor
+{
+  Snapshot snapshot;
+  FlowField flow;
+};
+
+struct DungeonStats
+{
+  long long prepared{};
+  long long packed{};
+  long long spilled{};
+  long long waits{};
+  long long waitUs{};
+  size_t packedBytes{};
+  int spilledFloors{};
+};
+
+// Every floor of a game but the one being played. A thread keeps the
+// floors next to it ready to enter, generating the ones nobody visited yet
+// and unpacking the others, so taking the stairs only restores a snapshot.
+// Floors further away are packed into the save format; past `resident`
+// packed floors, the ones furthest away are spilled to the temp directory.
+class Dungeon
+{
+public:
+  // Fills floor for players coming from the floor above or below. An empty
+  // snapshot means nobody visited the floor yet.
+  using Prepare = std::function<void(int index, bool fromAbove, Floor& floor)>;
+
+  Dungeon(int floors, int resident, Prepare prepare);
+  Dungeon(const Dungeon&) = delete;
+  Dungeon& operator=(const Dungeon&) = delete;
+  ~Dungeon();
+
+  int floors() const;
+  void take(int index, bool fromAbove, Floor& floor);
+  void enter(int index);
+  void leave(int index, Floor&& floor);
+  DungeonStats stats();
+
+private:
+  enum class Tier : uint8_t
+  {
+    NEW,
+    LIVE,
+    READY,
+    PACKED,
+    SPILLED
+  };
+
+  enum class Work : uint8_t
+  {
+    NONE,
+    PREPARE,
+    PACK,
+    SPILL
+  };
+
+  struct Slot
+  {
+    Tier tier{ Tier::NEW };
+    bool busy{};
+    // 1 when prepared for players from above, -1 from below, 0 not yet
+    int preparedFrom{};
+    Floor floor;
+    std::string packed;
+  };
+
+  std::mutex m_mutex;
+  std::condition_variable m_wake;
+  std::condition_variable m_done;
+  std::vector<Slot> m_slots;
+  int m_live{};
+  int m_wanted{ -1 };
+  int m_wantedFrom{};
+  int m_resident;
+  bool m_spillFailed{};
+  std::string m_spillPrefix;
+  Prepare m_prepare;
+  DungeonStats m_stats;
+  bool m_stop{};
+  std::thread m_thread;
+
+  void loop();
+  Work pick(int& index, int& from) const;
+  std::filesystem::path spillPath(int index) const;
+};
+
+// Players start on floor 0
+Dungeon::Dungeon(int floors, int resident, Prepare prepare)
+  : m_slots(static_cast<size_t>(std::max(floors, 1)))
+  , m_resident(std::max(resident, 0))
+  , m_prepare(std::move(prepare))
+{
+  m_slots[0].tier = Tier::LIVE;
+
+  // Games of other processes spill to the same directory
+  std::error_code error;
+  std::filesystem::path dir = std::filesystem::temp_directory_path(error);
+  m_spillFailed = static_cast<bool>(error);
+  std::ostringstream prefix;
+  prefix << "deungeon-" << std::hex << std::random_device()() << "-floor-";
+  m_spillPrefix = (dir / prefix.str()).string();
+
+  m_thread = std::thread([this]() { loop(); });
+}
+
+Dungeon::~Dungeon()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_wake.notify_one();
+  m_thread.join();
+
+  for (size_t i = 0; i < m_slots.size(); i++)
+  {
+    if (m_slots[i].tier == Tier::SPILLED)
+    {
+      std::error_code error;
+      std::filesystem::remove(spillPath(static_cast<int>(i)), error);
+    }
+  }
+}
+
+int Dungeon::floors() const
+{
+  return static_cast<int>(m_slots.size());
+}
+
+// Hands over floor index to be played, prepared for players coming from
+// above or below. Only waits when the thread has not got to it yet.
+void Dungeon::take(int index, bool fromAbove, Floor& floor)
+{
+  int from = fromAbove ? 1 : -1;
+  std::unique_lock<std::mutex> lock(m_mutex);
+  Slot& slot = m_slots[static_cast<size_t>(index)];
+  auto ready = [&]() { return !slot.busy && slot.tier == Tier::READY && slot.preparedFrom == from; };
+  if (!ready())
+  {
+    auto start = std::chrono::steady_clock::now();
+    m_wanted = index;
+    m_wantedFrom = from;
+    m_wake.notify_one();
+    m_done.wait(lock, ready);
+    m_wanted = -1;
+    m_stats.waits++;
+    m_stats.waitUs += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  floor = std::move(slot.floor);
+  slot.floor = Floor();
+  slot.tier = Tier::LIVE;
+  slot.preparedFrom = 0;
+  m_live = index;
+  lock.unlock();
+  m_wake.notify_one();
+}
+
+// Plays floor index from a snapshot of it, whatever the dungeon held for it
+// is dropped
+void Dungeon::enter(int index)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  Slot& slot = m_slots[static_cast<size_t>(index)];
+  m_done.wait(lock, [&]() { return !slot.busy; });
+  if (slot.tier == Tier::SPILLED)
+  {
+    std::error_code error;
+    std::filesystem::remove(spillPath(index), error);
+  }
+  slot.floor = Floor();
+  std::string().swap(slot.packed);
+  slot.tier = Tier::LIVE;
+  slot.preparedFrom = 0;
+  m_live = index;
+  lock.unlock();
+  m_wake.notify_one();
+}
+
+// Takes back the floor players just left
+void Dungeon::leave(int index, Floor&& floor)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Slot& slot = m_slots[static_cast<size_t>(index)];
+    slot.floor = std::move(floor);
+    slot.tier = Tier::READY;
+    slot.preparedFrom = 0;
+  }
+  m_wake.notify_one();
+}
+
+DungeonStats Dungeon::stats()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  DungeonStats stats = m_stats;
+  for (const Slot& slot : m_slots)
+  {
+    stats.packedBytes += slot.packed.size();
+    stats.spilledFloors += slot.tier == Tier::SPILLED ? 1 : 0;
+  }
+  return stats;
+}
+
+// The most urgent work, first the floor being waited for, then the floors
+// next to the live one, then packing and spilling the rest. Busy slots are
+// the thread's own and never picked again.
+Dungeon::Work Dungeon::pick(int& index, int& from) const
+{
+  auto needs = [this](int i, int f) {
+    const Slot& slot = m_slots[static_cast<size_t>(i)];
+    return !slot.busy && slot.tier != Tier::LIVE && !(slot.tier == Tier::READY && slot.preparedFrom == f);
+  };
+  if (m_wanted >= 0 && needs(m_wanted, m_wantedFrom))
+  {
+    index = m_wanted;
+    from = m_wantedFrom;
+    return Work::PREPARE;
+  }
+  for (int i : { m_live + 1, m_live - 1 })
+  {
+    if (i >= 0 && i < floors() && needs(i, i > m_live ? 1 : -1))
+    {
+      index = i;
+      from = i > m_live ? 1 : -1;
+      return Work::PREPARE;
+    }
+  }
+
+  int packed = 0;
+  int farthest = -1;
+  for (int i = 0; i < floors(); i++)
+  {
+    const Slot& slot = m_slots[static_cast<size_t>(i)];
+    if (slot.busy)
+      continue;
+
+    if (slot.tier == Tier::READY && std::abs(i - m_live) > 1 && i != m_wanted)
+    {
+      index = i;
+      return Work::PACK;
+    }
+    if (slot.tier == Tier::PACKED)
+    {
+      packed++;
+      if (farthest < 0 || std::abs(i - m_live) > std::abs(farthest - m_live))
+      {
+        farthest = i;
+      }
+    }
+  }
+  if (packed > m_resident && !m_spillFailed)
+  {
+    index = farthest;
+    return Work::SPILL;
+  }
+  return Work::NONE;
+}
+
+void Dungeon::loop()
+{
+  while (true)
+  {
+    int index{};
+    int from{};
+    Work work{};
+    Tier tier{};
+    Floor floor;
+    std::string packed;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_wake.wait(lock, [&]() { return m_stop || (work = pick(index, from)) != Work::NONE; });
+      if (m_stop)
+        return;
+
+      Slot& slot = m_slots[static_cast<size_t>(index)];
+      slot.busy = true;
+      tier = slot.tier;
+      floor = std::move(slot.floor);
+      packed = std::move(slot.packed);
+    }
+
+    // The slot is ours until it is marked idle again
+    bool spillFailed = false;
+    if (work == Work::PREPARE)
+    {
+      TraceScope trace("prepareFloor");
+      if (tier == Tier::SPILLED)
+      {
+        std::ifstream in(spillPath(index), std::ios::binary);
+        packed.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        in.close();
+        std::error_code error;
+        std::filesystem::remove(spillPath(index), error);
+      }
+      if (tier == Tier::PACKED || tier == Tier::SPILLED)
+      {
+        // A floor that does not read back is generated anew
+        std::istringstream in(packed);
+        if (!floor.snapshot.load(in))
+        {
+          floor.snapshot = Snapshot();
+        }
+        std::string().swap(packed);
+      }
+      m_prepare(index, from > 0, floor);
+      tier = Tier::READY;
+    }
+    else if (work == Work::PACK)
+    {
+      TraceScope trace("packFloor");
+      std::ostringstream out;
+      floor.snapshot.save(out);
+      packed = out.str();
+      floor = Floor();
+      tier = Tier::PACKED;
+    }
+    else if (work == Work::SPILL)
+    {
+      TraceScope trace("spillFloor");
+      std::ofstream out(spillPath(index), std::ios::binary | std::ios::trunc);
+      out.write(packed.data(), static_cast<std::streamsize>(packed.size()));
+      out.close();
+      if (out)
+      {
+        std::string().swap(packed);
+        tier = Tier::SPILLED;
+      }
+      else
+      {
+        // Keep the floor in memory and stop trying
+        spillFailed = true;
+      }
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      Slot& slot = m_slots[static_cast<size_t>(index)];
+      slot.floor = std::move(floor);
+      slot.packed = std::move(packed);
+      slot.tier = tier;
+      slot.preparedFrom = work == Work::PREPARE ? from : 0;
+      slot.busy = false;
+      m_spillFailed = m_spillFailed || spillFailed;
+      m_stats.prepared += work == Work::PREPARE ? 1 : 0;
+      m_stats.packed += work == Work::PACK ? 1 : 0;
+      m_stats.spilled += work == Work::SPILL && !spillFailed ? 1 : 0;
+    }
+    m_done.notify_all();
+  }
+}
+
+std::filesystem::path Dungeon::spillPath(int index) const
+{
+  return std::filesystem::path(m_spillPrefix + std::to_string(index) + ".bin");
+}
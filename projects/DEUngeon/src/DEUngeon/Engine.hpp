@@ -1,13 +1,27 @@
 #pragma once
 
 #include "Actor.hpp"
+#include "Arena.hpp"
+#include "Bot.hpp"
+#include "Dungeon.hpp"
+#include "FlowField.hpp"
+#include "Fov.hpp"
+#include "InfluenceMap.hpp"
+#include "Jobs.hpp"
 #include "Map.hpp"
 #include "PathFinding.hpp"
+#include "PathService.hpp"
+#include "Player.hpp"
+#include "Profiler.hpp"
+#include "Renderer.hpp"
+#include "Replay.hpp"
+#include "Scheduler.hpp"
+#include "Snapshot.hpp"
 
 static long long getCurrentTimeInMilliseconds()
 {
   return std::chrono::duration_cast<std::chrono::milliseconds>(
-    std::chrono::high_resolution_clock::now().time_since_epoch()
+    std::chrono::steady_clock::now().time_since_epoch()
   ).count();
 }
 
@@ -18,520 +32,1905 @@ enum class GameState : uint8_t
   STOPPED
 };
 
-struct Enemy
+// How much thought an enemy gets this tick, cheapest last
+enum class EnemyAi : uint8_t
 {
-  Actor actor;
-  int moveDelay;
-  long long moveTimer;
-  Enemy(Actor a, int md, long long mt)
-    : actor(a)
-    , moveDelay(md)
-    , moveTimer(mt)
+  SEARCH,
+  FLOW,
+  WANDER,
+  SLEEP
+};
+
+// Horde mode replaces the five classic enemies with `enemies` of them and
+// spends precise searches only on the ones close to the player. Distances
+// are in steps.
+struct HordeConfig
+{
+  int enemies{};
+  int nearDistance{ 10 };
+  int flowDistance{ 40 };
+  int sleepDistance{ 60 };
+  int wakeDistance{ 30 };
+  int searchesPerTick{ 16 };
+  int updatesPerTick{ 1024 };
+};
+
+// Balance knobs of a level. Enemy delays are in ms per step, in the order
+// the classic five spawn; horde enemies cycle through them.
+struct GameRules
+{
+  int enemyDelays[5]{ 350, 300, 250, 200, 150 };
+  int dashPowerUps{ 5 };
+  int destroyPowerUps{ 5 };
+  int gameTime{ 30 };
+  int playerDelay{ 75 };
+
+  bool operator==(const GameRules&) const = default;
+};
+
+// Path an enemy is following in async mode, plus the search in flight
+struct EnemyRoute
+{
+  std::vector<Point> path;
+  Point goal;
+  unsigned int revision{};
+  unsigned int pendingRevision{};
+  bool pending{};
+};
+
+class Engine
+{
+public:
+  static constexpr int FOV_RADIUS{ 12 };
+  // Random tiles tried per horde enemy before it takes the farthest one seen
+  static constexpr int SPAWN_ATTEMPTS{ 64 };
+  // Player slots take these in turn, the first is the local player
+  static constexpr const char* PLAYER_COLORS[]{ "cyan", "lime", "amber", "violet", "pink", "sky", "crimson", "azure" };
+private:
+  int m_maxX;
+  int m_maxY;
+  int m_numRooms;
+  Arena m_arena;
+  Map m_map;
+  SpatialGrid m_enemyGrid;
+  SpatialGrid m_powerUpGrid;
+  Actors m_actors;
+  std::vector<Player> m_players;
+  GameState m_state;
+  std::vector<ActorId> m_killed;
+  std::vector<std::unique_ptr<AStar>> m_pathfinders;
+  std::vector<PathStats> m_enemyPathStats;
+  PathStats m_levelPathStats;
+  std::vector<ActorId> m_dueEnemies;
+  std::vector<Point> m_dueTargets;
+  std::vector<std::vector<Point>> m_duePaths;
+  std::vector<PathStats> m_dueStats;
+  std::vector<EnemyAi> m_dueAi;
+  HordeConfig m_horde;
+  GameRules m_rules;
+  FlowField m_flow;
+  std::mt19937 m_hordeGen;
+  std::vector<bool> m_asleep;
+  bool m_fovEnabled;
+  FieldOfView m_fov;
+  VisibilityMap m_explored;
+  bool m_influenceEnabled;
+  bool m_influenceStale;
+  InfluenceMap m_influence;
+  JobSystem m_jobs;
+  JobGraph m_enemyJobs;
+  std::unique_ptr<PathService> m_pathService;
+  std::shared_ptr<const Map> m_mapSnapshot;
+  std::vector<EnemyRoute> m_routes;
+  Scheduler m_scheduler;
+  long long gameTimer;
+  int gameTime;
+  unsigned int m_seed;
+  long long m_now;
+  long long m_frames;
+  long long m_startTime;
+  bool m_headless;
+  Recorder* m_recorder;
+  Replay* m_replay;
+  Renderer* m_renderer;
+  BotPolicy* m_bot;
+  int m_botFrameMs;
+  Frame m_frame;
+  Profiler m_profiler;
+  mutable std::vector<std::shared_ptr<const TileRow>> m_rows;
+  mutable unsigned int m_rowsRevision;
+  Snapshot m_quickSave;
+  bool m_hasQuickSave;
+  bool m_caves;
+  bool m_routedTunnels;
+  int m_floorCount;
+  int m_residentFloors;
+  int m_floor;
+  int m_floorChange;
+  std::unique_ptr<Dungeon> m_dungeon;
+public:
+  Engine(int wx, int wy, int numRooms, unsigned int seed, bool headless = false, unsigned int threads = 0);
+  void reset(unsigned int seed);
+  void record(Recorder* recorder);
+  void replay(Replay* replay);
+  void display(Renderer* renderer);
+  void autoplay(BotPolicy* bot, int frameMs);
+  bool gameLoop();
+  bool step(int key, int dtMs);
+  void capture(Snapshot& snapshot) const;
+  bool restore(const Snapshot& snapshot);
+  int join();
+  void leave(int player);
+  void press(int player, int key);
+  void render();
+  int getGameTime() const;
+  GameState getState() const;
+  long long getFrames() const;
+  unsigned int getSeed() const;
+  bool won() const;
+  long long getPlayTime() const;
+  long long getNow() const;
+  const Map& getMap() const;
+  const Actors& getActors() const;
+  const Player& getPlayer() const;
+  const std::vector<Player>& getPlayers() const;
+  const SpatialGrid& getEnemyGrid() const;
+  Profiler& getProfiler();
+  void collectPathStats(bool enabled);
+  void asyncPaths(bool enabled);
+  void horde(const HordeConfig& config);
+  void rules(const GameRules& rules);
+  void fieldOfView(bool enabled);
+  void influence(bool enabled);
+  void caves(bool enabled);
+  void routedTunnels(bool enabled);
+  void floors(int count, int resident = 2);
+  void settingsFrom(const Engine& other);
+  bool takeStairs(int direction);
+  int getFloor() const;
+  DungeonStats getDungeonStats() const;
+  const PathStats& getLevelPathStats() const;
+  const std::vector<PathStats>& getEnemyPathStats() const;
+private:
+  bool nextFrame(int& key);
+  void update(int input);
+  void makeFloor(unsigned int seed);
+  void placeStairs();
+  void storeFloor();
+  void apply(const Snapshot& snapshot);
+  Dungeon::Prepare floorBuilder() const;
+  void prepareFloor(int index, bool fromAbove, Floor& floor);
+  unsigned int floorSeed(int index) const;
+  void controlPlayer(Player& player);
+  const Player* leadPlayer() const;
+  Point nearestPlayer(Point from) const;
+  void shareRows() const;
+  void enemyMove();
+  void enemyMoveAsync();
+  void takePathResults();
+  void scheduleEnemy(ActorId id);
+  void applyEnemyMoves();
+  void classifyEnemies(Point target);
+  void wakeEnemies();
+  void spawnHorde();
+  bool isAsleep(ActorId id) const;
+  void applyFog(Frame& frame);
+  void rebuildInfluence();
+  bool actorDied();
+  void collectPowerUp();
+  void printGameTime(Frame& frame);
+  void printFloor(Frame& frame);
+  void printGameOver(Frame& frame) const;
+  void printDashes(Frame& frame);
+  void printDestroys(Frame& frame);
+  void printGameState(Frame& frame);
+  void printProfile(Frame& frame);
+};
+
+// threads == 0 uses one worker per hardware thread
+Engine::Engine(int wx, int wy, int numRooms, unsigned int seed, bool headless, unsigned int threads)
+  : m_maxX(wx)
+  , m_maxY(wy)
+  , m_numRooms(numRooms)
+  , m_arena(64 * 1024)
+  , m_map(Map(m_maxX, m_maxY, m_arena.resource()))
+  , m_enemyGrid(SpatialGrid(m_maxX, m_maxY))
+  , m_powerUpGrid(SpatialGrid(m_maxX, m_maxY))
+  , m_actors()
+  , m_players(1)
+  , m_state(GameState::PAUSED)
+  , m_fovEnabled(false)
+  , m_influenceEnabled(false)
+  , m_influenceStale(true)
+  , m_jobs(threads != 0 ? threads : std::thread::hardware_concurrency())
+  , gameTimer(getCurrentTimeInMilliseconds())
+  , gameTime(30)
+  , m_seed(seed)
+  , m_now(getCurrentTimeInMilliseconds())
+  , m_frames(0)
+  , m_startTime(0)
+  , m_headless(headless)
+  , m_recorder(nullptr)
+  , m_replay(nullptr)
+  , m_renderer(nullptr)
+  , m_bot(nullptr)
+  , m_botFrameMs(0)
+  , m_rowsRevision(0)
+  , m_hasQuickSave(false)
+  , m_caves(false)
+  , m_routedTunnels(true)
+  , m_floorCount(1)
+  , m_residentFloors(2)
+  , m_floor(0)
+  , m_floorChange(0)
+{
+  m_frame.resize(m_maxX, m_maxY);
+  m_actors.track(ActorKind::ENEMY, &m_enemyGrid);
+  m_actors.track(ActorKind::DASH, &m_powerUpGrid);
+  m_actors.track(ActorKind::DESTROY, &m_powerUpGrid);
+
+  // Searches keep scratch grids, every worker gets its own
+  for (int i = 0; i < m_jobs.workers(); i++)
   {
-    originalMoveDelay = moveDelay;
+    m_pathfinders.push_back(std::make_unique<AStar>(m_map));
   }
-  void stun()
+
+  reset(seed);
+}
+
+// Starts a new game on the top floor. Floors of the last game are dropped,
+// the new ones below are made as players get near them.
+void Engine::reset(unsigned int seed)
+{
+  m_enemyPathStats.clear();
+  m_levelPathStats = PathStats();
+  m_seed = seed;
+  if (m_recorder)
   {
-    actor.fade();
-    moveDelay = 2000;
+    m_recorder->beginGame(seed);
   }
-  void unstun()
+  if (m_bot)
   {
-    actor.unfade();
-    moveDelay = originalMoveDelay;
+    m_bot->newGame(seed);
   }
-  bool isStunned() const
+
+  // All timers of a level are relative to this, replays only advance it
+  m_now = getCurrentTimeInMilliseconds();
+  m_frames = 0;
+  m_startTime = m_now;
+  m_state = GameState::PAUSED;
+  m_hasQuickSave = false;
+  gameTimer = m_now;
+  gameTime = m_rules.gameTime;
+
+  m_dungeon.reset();
+  m_floor = 0;
+  m_floorChange = 0;
+  makeFloor(seed);
+  if (m_floorCount > 1)
   {
-    return moveDelay != originalMoveDelay;
+    m_dungeon = std::make_unique<Dungeon>(m_floorCount, m_residentFloors, floorBuilder());
   }
-  void rage(std::string color)
+
+  // Render start screen
+  render();
+}
+
+// Generates floor m_floor in the buffers of the previous one, with every
+// player slot on its start tile
+void Engine::makeFloor(unsigned int seed)
+{
+  // Drop everything the last floor allocated
+  m_arena.release();
+  m_actors.clear();
+  m_scheduler.clear();
+  m_routes.clear();
+  m_asleep.clear();
+  m_explored.resize(m_maxX, m_maxY);
+  m_influenceStale = true;
+  m_hordeGen.seed(seed);
+
+  // Prepare map
+  m_map.reset(seed);
+  m_map.routedTunnels = m_routedTunnels;
+  if (m_caves)
   {
-    originalMoveDelay = moveDelay = static_cast<int>(originalMoveDelay * 0.8F);
-    actor.setColor(color);
+    m_map.makeCaves();
   }
-private:
-  int originalMoveDelay;
-};
+  else
+  {
+    m_map.makeRooms(m_numRooms);
+  }
+  if (m_floorCount > 1)
+  {
+    placeStairs();
+  }
+
+  // Place players, every slot of the last level plays this one too
+  Point pStartCoords = m_map.getStartCoords(true);
+  for (size_t i = 0; i < m_players.size(); i++)
+  {
+    Player& player = m_players[i];
+    player = Player(m_actors.create(ActorKind::PLAYER, '@', PLAYER_COLORS[i % std::size(PLAYER_COLORS)]), m_rules.playerDelay, m_now);
+    m_actors.move(player.actor, pStartCoords, m_map);
+  }
+
+  // Create power-ups
+  for (int i = 0; i < m_rules.dashPowerUps; i++)
+  {
+    Point puCoords = m_map.getRandomCoords();
+    ActorId powerUp = m_actors.create(ActorKind::DASH, '>', "dark cyan");
+    m_actors.move(powerUp, puCoords, m_map);
+  }
+  for (int i = 0; i < m_rules.destroyPowerUps; i++)
+  {
+    Point puCoords = m_map.getRandomCoords();
+    ActorId powerUp = m_actors.create(ActorKind::DESTROY, 'x', "dark cyan");
+    m_actors.move(powerUp, puCoords, m_map);
+  }
+
+
+  if (m_horde.enemies > 0)
+  {
+    spawnHorde();
+    return;
+  }
+
+  // Create enemies
+  auto currentTime = m_now;
+  ActorId enemies[] = {
+    m_actors.create(ActorKind::ENEMY, '?', "blue", m_rules.enemyDelays[0], currentTime),
+    m_actors.create(ActorKind::ENEMY, '$', "green", m_rules.enemyDelays[1], currentTime),
+    m_actors.create(ActorKind::ENEMY, '&', "yellow", m_rules.enemyDelays[2], currentTime),
+    m_actors.create(ActorKind::ENEMY, '%', "orange", m_rules.enemyDelays[3], currentTime),
+    m_actors.create(ActorKind::ENEMY, '#', "red", m_rules.enemyDelays[4], currentTime),
+  };
+
+  // Place enemies and schedule their first moves side by side, going on in
+  // the rows above where a cave runs out of floor
+  Point eStartCoords = m_map.getStartCoords(false);
+  for (ActorId enemy : enemies)
+  {
+    while (m_map.board[eStartCoords.y][eStartCoords.x].blocking)
+    {
+      if (--eStartCoords.x < 1)
+      {
+        eStartCoords.x = m_maxX - 2;
+        eStartCoords.y--;
+      }
+    }
+    m_actors.move(enemy, Point(eStartCoords.x--, eStartCoords.y), m_map);
+    scheduleEnemy(enemy);
+  }
+}
+
+// Stairs up on the start tile, where players from above come in, and stairs
+// down on a random tile well away from it. The top and bottom floors only
+// get one of them.
+void Engine::placeStairs()
+{
+  Point start = m_map.getStartCoords(true);
+  if (m_floor > 0)
+  {
+    m_map.board[start.y][start.x].terrain = TERRAIN::STAIRS_UP;
+  }
+  if (m_floor + 1 < m_floorCount)
+  {
+    // Small maps may not have a tile that far, take the last try then
+    int minDistance = (m_maxX + m_maxY) / 4;
+    Point down = m_map.getRandomCoords();
+    for (int tries = 0; tries < 100 && (down == start || std::abs(down.x - start.x) + std::abs(down.y - start.y) < minDistance); tries++)
+    {
+      down = m_map.getRandomCoords();
+    }
+    m_map.board[down.y][down.x].terrain = TERRAIN::STAIRS_DOWN;
+  }
+}
+
+bool Engine::gameLoop()
+{
+  while (m_state != GameState::STOPPED)
+  {
+    int input{};
+    if (!nextFrame(input))
+    {
+      // Replay ran out of input
+      m_state = GameState::STOPPED;
+      break;
+    }
+    update(input);
+  }
+
+  if (m_recorder)
+  {
+    m_recorder->flush();
+  }
+
+  return true;
+}
+
+// Advances the game by one frame of dtMs with key pressed, for callers that
+// drive the engine themselves, like a lookahead from a snapshot. Returns
+// whether the game goes on.
+bool Engine::step(int key, int dtMs)
+{
+  m_now += dtMs;
+  m_frames++;
+  update(key);
+  return m_state != GameState::STOPPED;
+}
+
+// One frame of the game with the input read for it
+void Engine::update(int input)
+{
+  TraceScope frameTrace("frame");
+  ProfileScope frameScope(m_profiler, ProfileZone::FRAME);
+  ProfileScope inputScope(m_profiler, ProfileZone::INPUT);
+  if (input != 0)
+  {
+    m_players[0].keypress = static_cast<char>(input);
+
+    if (m_players[0].keypress == TK_ENTER)
+    {
+      m_state = m_state == GameState::PAUSED ? GameState::RUNNING : GameState::PAUSED;
+    }
+    else if (m_players[0].keypress == TK_ESCAPE)
+    {
+      m_state = GameState::STOPPED;
+    }
+    else if (m_players[0].keypress == TK_F1)
+    {
+      m_profiler.enabled = !m_profiler.enabled;
+    }
+    else if (m_players[0].keypress == TK_F2)
+    {
+      m_profiler.dump("profile.txt");
+    }
+    else if (m_players[0].keypress == TK_F5)
+    {
+      // The file is for --load; F9 only restores from memory, which a
+      // replay of this game can reproduce
+      capture(m_quickSave);
+      m_hasQuickSave = true;
+      if (!m_replay)
+      {
+        m_quickSave.save("quicksave.bin");
+      }
+    }
+    else if (m_players[0].keypress == TK_F9 && m_hasQuickSave)
+    {
+      restore(m_quickSave);
+      return;
+    }
+  }
+
+  if (m_state != GameState::RUNNING)
+  {
+    inputScope.stop();
+    render();
+    return;
+  }
+
+  for (Player& player : m_players)
+  {
+    if (player.inPlay())
+    {
+      controlPlayer(player);
+    }
+  }
+  if (m_floorChange != 0)
+  {
+    takeStairs(m_floorChange);
+    m_floorChange = 0;
+  }
+  inputScope.stop();
+
+  enemyMove();
+
+  if (!actorDied())
+  {
+    collectPowerUp();
+
+    if (m_now >= gameTimer + 1000)
+    {
+      gameTime--;
+      gameTimer = m_now;
+    }
+    if (gameTime == 0)
+    {
+      m_state = GameState::STOPPED;
+    }
+  }
+
+  render();
+}
+
+// Moves one player by the key it holds. Holding the direction of the last
+// step waits out the move delay, any other key acts at once. Stepping onto
+// stairs takes every player along at the end of the input phase.
+void Engine::controlPlayer(Player& player)
+{
+  auto currentTime = m_now;
+  Point from = m_actors.getPos(player.actor);
+  if (currentTime >= player.moveTimer + player.moveDelay
+      || player.keypress != player.lastDir
+      || player.isDashing())
+  {
+    if (player.isDashing())
+    {
+      switch (player.lastDir)
+      {
+        case TK_UP:
+        case TK_W:
+          if (!m_actors.move(player.actor, 0, -1, m_map))
+          {
+            player.stopDash(m_actors);
+          }
+          break;
+        case TK_DOWN:
+        case TK_S:
+          if (!m_actors.move(player.actor, 0, 1, m_map))
+          {
+            player.stopDash(m_actors);
+          }
+          break;
+        case TK_LEFT:
+        case TK_A:
+          if (!m_actors.move(player.actor, -1, 0, m_map))
+          {
+            player.stopDash(m_actors);
+          }
+          break;
+        case TK_RIGHT:
+        case TK_D:
+          if (!m_actors.move(player.actor, 1, 0, m_map))
+          {
+            player.stopDash(m_actors);
+          }
+          break;
+      }
+    }
+    else
+    {
+      switch (player.keypress)
+      {
+        case TK_UP:
+        case TK_W:
+          m_actors.move(player.actor, 0, -1, m_map);
+          player.lastDir = player.keypress;
+          break;
+        case TK_DOWN:
+        case TK_S:
+          m_actors.move(player.actor, 0, 1, m_map);
+          player.lastDir = player.keypress;
+          break;
+        case TK_LEFT:
+        case TK_A:
+          m_actors.move(player.actor, -1, 0, m_map);
+          player.lastDir = player.keypress;
+          break;
+        case TK_RIGHT:
+        case TK_D:
+          m_actors.move(player.actor, 1, 0, m_map);
+          player.lastDir = player.keypress;
+          break;
+        case TK_SHIFT:
+          player.dash(m_actors);
+          break;
+        case TK_SPACE:
+          if (player.destroy(m_map, m_actors, m_enemyGrid, m_killed))
+          {
+            // Killed enemies leave the queue, raged ones move sooner
+            for (ActorId enemy : m_killed)
+            {
+              m_scheduler.cancel(enemy);
+            }
+            m_killed.clear();
+            m_influenceStale = true;
+            for (int s = 0; s < m_actors.size(); s++)
+            {
+              if (m_actors.kind[static_cast<size_t>(s)] == ActorKind::ENEMY)
+              {
+                scheduleEnemy(m_actors.id[static_cast<size_t>(s)]);
+              }
+            }
+          }
+          break;
+        case TK_ESCAPE:
+          m_state = GameState::STOPPED;
+          break;
+        default:
+          break;
+      }
+    }
+    player.keypress = 0;
+    player.moveTimer = currentTime;
+  }
+
+  Point to = m_actors.getPos(player.actor);
+  if (m_dungeon && !(to == from))
+  {
+    TERRAIN terrain = m_map.board[to.y][to.x].terrain;
+    if (terrain == TERRAIN::STAIRS_DOWN)
+    {
+      m_floorChange = 1;
+    }
+    else if (terrain == TERRAIN::STAIRS_UP)
+    {
+      m_floorChange = -1;
+    }
+  }
+}
+
+// Copies the running game into snapshot. Map rows are shared with the
+// snapshot taken or restored last unless the board changed them since.
+void Engine::capture(Snapshot& snapshot) const
+{
+  shareRows();
+  snapshot.rows = m_rows;
+
+  SnapshotHeader& h = snapshot.header;
+  h.width = m_maxX;
+  h.height = m_maxY;
+  h.seed = m_seed;
+  h.state = static_cast<uint8_t>(m_state);
+  h.now = m_now;
+  h.startTime = m_startTime;
+  h.frames = m_frames;
+  h.gameTimer = gameTimer;
+  h.gameTime = gameTime;
+  h.actorIds = m_actors.ids();
+  h.horde = m_horde.enemies;
+  h.floor = m_floor;
+  h.modes = (m_fovEnabled ? REPLAY_FOV : 0) | (m_influenceEnabled ? REPLAY_INFLUENCE : 0);
+
+  snapshot.players = m_players;
+  m_actors.save(snapshot.actors, snapshot.freeIds, snapshot.palette);
+  m_scheduler.save(snapshot.schedule, snapshot.generations, snapshot.scheduled);
+  snapshot.asleep.assign(m_asleep.begin(), m_asleep.end());
+  snapshot.explored = m_explored.words();
+  snapshot.hordeGen = m_hordeGen;
+}
+
+// Continues from snapshot with the clock where it is now, every timer of
+// the snapshot moves along. Fails for snapshots of another map size or of a
+// floor the dungeon does not have. A snapshot of another floor replaces that
+// floor, the one being played is put away as it is.
+bool Engine::restore(const Snapshot& snapshot)
+{
+  const SnapshotHeader& h = snapshot.header;
+  if (h.width != m_maxX || h.height != m_maxY || h.floor >= m_floorCount || snapshot.rows.size() != static_cast<size_t>(m_maxY))
+    return false;
+
+  for (const std::shared_ptr<const TileRow>& row : snapshot.rows)
+  {
+    if (row->size() != static_cast<size_t>(m_maxX))
+      return false;
+  }
+
+  if (h.floor != m_floor)
+  {
+    storeFloor();
+    m_dungeon->enter(h.floor);
+    m_floor = h.floor;
+  }
+  apply(snapshot);
+  render();
+  return true;
+}
+
+// Hands the floor being played over to the dungeon without its players,
+// they are only ever on one floor
+void Engine::storeFloor()
+{
+  for (Player& player : m_players)
+  {
+    if (player.actor != Actors::NONE)
+    {
+      m_actors.destroy(player.actor);
+    }
+  }
+  m_players.assign(m_players.size(), Player());
+  Floor left;
+  capture(left.snapshot);
+  m_dungeon->leave(m_floor, std::move(left));
+}
+
+// Takes over the game of snapshot, which must be of this map size
+void Engine::apply(const Snapshot& snapshot)
+{
+  const SnapshotHeader& h = snapshot.header;
+
+  // Rows the board still shares with the snapshot need no copy
+  shareRows();
+  for (size_t y = 0; y < snapshot.rows.size(); y++)
+  {
+    const std::shared_ptr<const TileRow>& row = snapshot.rows[y];
+    if (m_rows[y] != row)
+    {
+      std::copy(row->begin(), row->end(), m_map.board[y].begin());
+      m_rows[y] = row;
+    }
+  }
+  // Caches keyed on the revision must not mistake this board for another
+  m_map.revision++;
+  m_rowsRevision = m_map.revision;
+
+  long long shift = m_now - h.now;
+  m_actors.restore(snapshot.actors, snapshot.freeIds, h.actorIds, snapshot.palette, shift);
+  m_scheduler.restore(snapshot.schedule, snapshot.generations, snapshot.scheduled, shift);
+  m_players = snapshot.players;
+  for (Player& player : m_players)
+  {
+    player.moveTimer += shift;
+  }
+  m_state = static_cast<GameState>(h.state);
+  m_seed = h.seed;
+  m_startTime = h.startTime + shift;
+  m_frames = h.frames;
+  gameTimer = h.gameTimer + shift;
+  gameTime = h.gameTime;
+  m_horde.enemies = h.horde;
+  m_fovEnabled = (h.modes & REPLAY_FOV) != 0;
+  m_influenceEnabled = (h.modes & REPLAY_INFLUENCE) != 0;
+  m_asleep.assign(snapshot.asleep.begin(), snapshot.asleep.end());
+  m_explored.assign(snapshot.explored);
+  m_hordeGen = snapshot.hordeGen;
+
+  // Derived state is rebuilt from the restored game
+  m_influenceStale = true;
+  m_routes.clear();
+  m_mapSnapshot.reset();
+}
+
+// Brings m_rows up to date with the board, keeping every row that did not
+// change since the last capture or restore
+void Engine::shareRows() const
+{
+  if (m_rows.size() == static_cast<size_t>(m_maxY) && m_rowsRevision == m_map.revision)
+    return;
+
+  m_rows.resize(static_cast<size_t>(m_maxY));
+  auto sameTile = [](const Point& a, const Point& b) { return a.blocking == b.blocking && a.terrain == b.terrain; };
+  for (size_t y = 0; y < m_rows.size(); y++)
+  {
+    const std::vector<Point>& row = m_map.board[y];
+    if (!m_rows[y] || !std::equal(row.begin(), row.end(), m_rows[y]->begin(), m_rows[y]->end(), sameTile))
+    {
+      m_rows[y] = std::make_shared<const TileRow>(row);
+    }
+  }
+  m_rowsRevision = m_map.revision;
+}
+
+// Advances the clock by one loop iteration and reads its input, either
+// live from the terminal or from a replay
+bool Engine::nextFrame(int& key)
+{
+  long long dt{};
+  key = 0;
+  if (m_replay)
+  {
+    if (!m_replay->nextFrame(dt, key))
+      return false;
+
+    m_now += dt;
+  }
+  else if (m_bot)
+  {
+    // Bots run on a fixed step, so a game only depends on its seed
+    dt = m_botFrameMs;
+    m_now += dt;
+    key = m_state == GameState::PAUSED ? TK_ENTER : m_bot->nextKey(*this);
+    if (m_recorder)
+    {
+      m_recorder->frame(dt, key);
+    }
+  }
+  else
+  {
+    if (m_renderer)
+    {
+      key = m_renderer->readKey();
+      // Timed on the render thread, recorded whether the overlay is on or not
+      long long latencyUs{};
+      while (m_renderer->readLatency(latencyUs))
+      {
+        m_profiler.record(ProfileZone::LATENCY, latencyUs * 1000);
+      }
+    }
+    else if (terminal_has_input())
+    {
+      key = terminal_read();
+    }
+    long long now = getCurrentTimeInMilliseconds();
+    dt = now - m_now;
+    m_now = now;
+    if (m_recorder)
+    {
+      m_recorder->frame(dt, key);
+    }
+  }
+
+  m_frames++;
+  return true;
+}
+
+void Engine::record(Recorder* recorder)
+{
+  m_recorder = recorder;
+  m_recorder->beginGame(m_seed);
+}
+
+void Engine::replay(Replay* replay)
+{
+  m_replay = replay;
+}
+
+// Hands frames and input over to a render thread from now on
+void Engine::display(Renderer* renderer)
+{
+  m_renderer = renderer;
+  m_headless = false;
+  render();
+}
+
+// Lets a bot play instead of the keyboard, with the clock advancing frameMs
+// per frame instead of following the wall clock. A null bot hands control
+// back.
+void Engine::autoplay(BotPolicy* bot, int frameMs)
+{
+  m_bot = bot;
+  m_botFrameMs = std::max(frameMs, 1);
+  if (m_bot)
+  {
+    m_bot->newGame(m_seed);
+  }
+}
+
+// Puts another player on the start tile of the level and returns its slot,
+// the lowest free one. The slot plays every later level too, until it
+// leaves.
+int Engine::join()
+{
+  size_t index = 0;
+  while (index < m_players.size() && m_players[index].actor != Actors::NONE)
+  {
+    index++;
+  }
+  if (index == m_players.size())
+  {
+    m_players.emplace_back();
+  }
+  Player& player = m_players[index];
+  player = Player(m_actors.create(ActorKind::PLAYER, '@', PLAYER_COLORS[index % std::size(PLAYER_COLORS)]), m_rules.playerDelay, m_now);
+  m_actors.move(player.actor, m_map.getStartCoords(true), m_map);
+  return static_cast<int>(index);
+}
+
+// Takes a player off the map and frees its slot. Trailing free slots are
+// dropped so the next level does not bring them back.
+void Engine::leave(int player)
+{
+  m_actors.destroy(m_players[static_cast<size_t>(player)].actor);
+  m_players[static_cast<size_t>(player)] = Player();
+  while (m_players.size() > 1 && m_players.back().actor == Actors::NONE)
+  {
+    m_players.pop_back();
+  }
+}
+
+// Holds key for a player the next frame moves. Only keys that move, dash
+// or bomb are taken, the game itself is not up to any single player.
+void Engine::press(int player, int key)
+{
+  switch (key)
+  {
+    case TK_UP:
+    case TK_W:
+    case TK_DOWN:
+    case TK_S:
+    case TK_LEFT:
+    case TK_A:
+    case TK_RIGHT:
+    case TK_D:
+    case TK_SHIFT:
+    case TK_SPACE:
+      m_players[static_cast<size_t>(player)].keypress = static_cast<char>(key);
+      break;
+    default:
+      break;
+  }
+}
+
+int Engine::getGameTime() const
+{
+  return gameTime;
+}
+
+GameState Engine::getState() const
+{
+  return m_state;
+}
+
+long long Engine::getFrames() const
+{
+  return m_frames;
+}
+
+unsigned int Engine::getSeed() const
+{
+  return m_seed;
+}
+
+// The clock ran out before an enemy caught the player
+bool Engine::won() const
+{
+  return gameTime == 0;
+}
+
+// Game time since the level started, in ms
+long long Engine::getPlayTime() const
+{
+  return m_now - m_startTime;
+}
+
+long long Engine::getNow() const
+{
+  return m_now;
+}
+
+const Map& Engine::getMap() const
+{
+  return m_map;
+}
+
+const Actors& Engine::getActors() const
+{
+  return m_actors;
+}
+
+const Player& Engine::getPlayer() const
+{
+  return m_players[0];
+}
+
+// Indexed by slot, free slots have no actor
+const std::vector<Player>& Engine::getPlayers() const
+{
+  return m_players;
+}
+
+const SpatialGrid& Engine::getEnemyGrid() const
+{
+  return m_enemyGrid;
+}
+
+Profiler& Engine::getProfiler()
+{
+  return m_profiler;
+}
+
+// Off by default; when on, every enemy search is timed and summed per enemy
+// and for the whole level
+void Engine::collectPathStats(bool enabled)
+{
+  for (auto& astar : m_pathfinders)
+  {
+    astar->collectStats = enabled;
+  }
+  if (m_pathService)
+  {
+    m_pathService->collectStats = enabled;
+  }
+}
+
+// Restarts the current level with the new roster
+void Engine::horde(const HordeConfig& config)
+{
+  m_horde = config;
+  reset(m_seed);
+}
+
+// With a field of view the player only sees what is in line of sight and
+// enemies only chase a player they can see
+void Engine::fieldOfView(bool enabled)
+{
+  m_fovEnabled = enabled;
+  m_explored.clear();
+  render();
+}
+
+// Restarts the current level with the new balance
+void Engine::rules(const GameRules& rules)
+{
+  m_rules = rules;
+  reset(m_seed);
+}
+
+// Enemies sample the influence map to spread over equally short routes
+// instead of all taking the same one
+void Engine::influence(bool enabled)
+{
+  m_influenceEnabled = enabled;
+  m_influenceStale = true;
+}
+
+// Moves enemies without waiting for their searches. Results then depend on
+// thread timing, so a game played this way cannot be recorded or replayed.
+// Every due enemy searches: the horde's sleep, flow and budget and the FOV
+// and influence rules are not applied.
+void Engine::asyncPaths(bool enabled)
+{
+  if (!enabled)
+  {
+    m_pathService.reset();
+    m_routes.clear();
+    return;
+  }
+  if (!m_pathService)
+  {
+    m_pathService = std::make_unique<PathService>();
+    m_pathService->collectStats = m_pathfinders[0]->collectStats;
+  }
+}
+
+// Restarts the current level in caves grown by a cellular automaton, or
+// back in rooms
+void Engine::caves(bool enabled)
+{
+  m_caves = enabled;
+  reset(m_seed);
+}
+
+// Restarts the current level with tunnels routed around rooms, or dug
+// straight between room centres as before
+void Engine::routedTunnels(bool enabled)
+{
+  m_routedTunnels = enabled;
+  reset(m_seed);
+}
+
+// Links count floors by stairs and restarts the current level. At most
+// resident floors nobody is near are kept in memory, packed; the others are
+// spilled to files.
+void Engine::floors(int count, int resident)
+{
+  m_floorCount = std::max(count, 1);
+  m_residentFloors = std::max(resident, 0);
+  reset(m_seed);
+}
 
+// Takes the level settings of other and restarts, so other's snapshots
+// restore here and play on the same way
+void Engine::settingsFrom(const Engine& other)
+{
+  m_numRooms = other.m_numRooms;
+  m_horde = other.m_horde;
+  m_rules = other.m_rules;
+  m_caves = other.m_caves;
+  m_routedTunnels = other.m_routedTunnels;
+  m_floorCount = other.m_floorCount;
+  m_residentFloors = other.m_residentFloors;
+  reset(other.m_seed);
+}
 
-struct Player
+// Takes every player one floor down (1) or up (-1), onto the stairs that
+// lead back. The floor entered was made ready on the dungeon's thread, so
+// this only swaps snapshots. Fails when there is no such floor.
+bool Engine::takeStairs(int direction)
 {
-  Actor actor;
-  int moveDelay;
-  long long moveTimer;
-  int dashes;
-  int destroys;
-  Player(Actor actor, int moveDelay, long long moveTimer)
-    : actor(actor)
-    , moveDelay(moveDelay)
-    , moveTimer(moveTimer)
+  int to = m_floor + direction;
+  if (!m_dungeon || direction == 0 || to < 0 || to >= m_floorCount)
+    return false;
+
+  TraceScope trace("takeStairs");
+  bool fromAbove = to > m_floor;
+  Floor next;
+  m_dungeon->take(to, fromAbove, next);
+
+  // Players go along as they are, only a dash ends on the stairs
+  for (Player& player : m_players)
   {
-    dashes = 0;
-    destroys = 0;
-    dashing = false;
+    if (player.isDashing())
+    {
+      player.stopDash(m_actors);
+    }
   }
-  bool isDashing() const
+  std::vector<Player> players = m_players;
+  storeFloor();
+
+  // The clock and the modes belong to the game, not to a floor
+  GameState state = m_state;
+  unsigned int seed = m_seed;
+  long long startTime = m_startTime;
+  long long frames = m_frames;
+  long long timer = gameTimer;
+  int time = gameTime;
+  bool fov = m_fovEnabled;
+  bool influence = m_influenceEnabled;
+  apply(next.snapshot);
+  m_state = state;
+  m_seed = seed;
+  m_startTime = startTime;
+  m_frames = frames;
+  gameTimer = timer;
+  gameTime = time;
+  m_fovEnabled = fov;
+  m_influenceEnabled = influence;
+  m_floor = to;
+
+  Point arrival = m_map.find(fromAbove ? TERRAIN::STAIRS_UP : TERRAIN::STAIRS_DOWN);
+  m_players = std::move(players);
+  for (size_t i = 0; i < m_players.size(); i++)
   {
-    return dashing;
+    Player& player = m_players[i];
+    if (player.actor == Actors::NONE)
+      continue;
+
+    player.actor = m_actors.create(ActorKind::PLAYER, '@', PLAYER_COLORS[i % std::size(PLAYER_COLORS)]);
+    m_actors.move(player.actor, arrival, m_map);
+    player.lastWakeScan = Point(-1, -1);
+    if (player.caught)
+    {
+      m_actors.fade(player.actor);
+    }
   }
-  void dash()
+
+  // A horde finds the field to the stairs already built
+  m_flow = std::move(next.flow);
+  m_flow.adopt(m_map);
+  return true;
+}
+
+// 0 is the top floor
+int Engine::getFloor() const
+{
+  return m_floor;
+}
+
+DungeonStats Engine::getDungeonStats() const
+{
+  return m_dungeon ? m_dungeon->stats() : DungeonStats();
+}
+
+// What the dungeon's thread runs to fill a floor. It works on an engine of
+// its own, set up like this one and made on first use, which nothing else
+// touches.
+Dungeon::Prepare Engine::floorBuilder() const
+{
+  int width = m_maxX;
+  int height = m_maxY;
+  int rooms = m_numRooms;
+  unsigned int seed = m_seed;
+  int floors = m_floorCount;
+  HordeConfig horde = m_horde;
+  GameRules rules = m_rules;
+  bool caves = m_caves;
+  bool routed = m_routedTunnels;
+  bool fov = m_fovEnabled;
+  bool influence = m_influenceEnabled;
+  std::shared_ptr<Engine> builder;
+  return [=](int index, bool fromAbove, Floor& floor) mutable {
+    if (!builder)
+    {
+      builder = std::make_shared<Engine>(width, height, rooms, seed, true, 1);
+      builder->m_horde = horde;
+      builder->m_rules = rules;
+      builder->m_caves = caves;
+      builder->m_routedTunnels = routed;
+      builder->m_floorCount = floors;
+      builder->m_fovEnabled = fov;
+      builder->m_influenceEnabled = influence;
+    }
+    builder->prepareFloor(index, fromAbove, floor);
+  };
+}
+
+// Generates a floor nobody visited yet, then builds the horde's flow field
+// from the stairs players come in by
+void Engine::prepareFloor(int index, bool fromAbove, Floor& floor)
+{
+  if (floor.snapshot.rows.empty())
   {
-    if (dashes > 0)
+    m_floor = index;
+    makeFloor(floorSeed(index));
+    // Players only kept the horde off the stairs, visitors bring their own
+    for (Player& player : m_players)
     {
-      actor.changeColor("white");
-      dashing = true;
-      dashes--;
+      m_actors.destroy(player.actor);
     }
+    m_players.assign(m_players.size(), Player());
+    capture(floor.snapshot);
   }
-  void destroy(Map& map, std::vector<Enemy>& enemies)
+  else if (m_horde.enemies > 0)
   {
-    if (destroys > 0)
+    for (size_t y = 0; y < floor.snapshot.rows.size(); y++)
     {
-      actor.changeColor("red");
-      Point pos = actor.getPos();
-      for (int dx = -5; dx <= 5; dx++)
-      {
-        for (int dy = -5; dy <= 5; dy++)
-        {
-          if (dx == 0 && dy == 0) continue;
-
-          int newX = pos.x + dx;
-          int newY = pos.y + dy;
-
-          if (map.inBounds(newX, newY))
-          {
-            map.board[newY][newX].terrain = TERRAIN::BOMBED;
-            map.board[newY][newX].blocking = false;
-          }
-
-          for (auto& enemy : enemies)
-          {
-            if (enemy.actor.getPos() == Point(newX, newY))
-            {
-              enemy.actor.kill();
-              // Other enemies get speed boost
-              for (auto& otherEnemy : enemies)
-              {
-                if (&otherEnemy != &enemy)
-                {
-                  otherEnemy.rage(enemy.actor.getColor());
-                }
-              }
-            }
-          }
-        }
-      }
-      actor.revertColor();
-      destroys--;
+      std::copy(floor.snapshot.rows[y]->begin(), floor.snapshot.rows[y]->end(), m_map.board[y].begin());
     }
+    m_map.revision++;
   }
-  void stopDash()
+
+  if (m_horde.enemies > 0)
   {
-    actor.revertColor();
-    dashing = false;
+    Point arrival = m_map.find(fromAbove ? TERRAIN::STAIRS_UP : TERRAIN::STAIRS_DOWN);
+    floor.flow.build(m_map, arrival, m_horde.flowDistance);
   }
-private:
-  bool dashing;
-};
+}
 
-class Engine
+// The top floor plays the game's seed, so single floor games stay as they
+// were
+unsigned int Engine::floorSeed(int index) const
 {
-private:
-  int m_maxX;
-  int m_maxY;
-  Map m_map;
-  Player m_player;
-  std::vector<Enemy> m_enemies;
-  std::vector<Actor> m_powerUps;
-  GameState m_state;
-  AStar m_astar;
-  long long gameTimer;
-  int gameTime;
-public:
-  Engine(int wx, int wy, int numRooms);
-  bool gameLoop();
-  void render();
-private:
-  void enemyMove();
-  bool actorDied();
-  void collectPowerUp();
-  void printGameTime();
-  void printGameOver() const;
-  void printDashes();
-  void printDestroys();
-  void printGameState();
-};
+  return m_seed + static_cast<unsigned int>(index) * 0x9E3779B9u;
+}
 
-Engine::Engine(int wx, int wy, int numRooms)
-  : m_maxX(wx)
-  , m_maxY(wy)
-  , m_map(Map(m_maxX, m_maxY))
-  , m_player(Player(Actor('@', "cyan"), 75, getCurrentTimeInMilliseconds()))
-  , m_powerUps()
-  , m_enemies()
-  , m_state(GameState::PAUSED)
-  , m_astar(AStar(m_map))
-  , gameTimer(getCurrentTimeInMilliseconds())
-  , gameTime(30)
+const PathStats& Engine::getLevelPathStats() const
 {
-  // Prepare map
-  m_map.makeRooms(numRooms);
+  return m_levelPathStats;
+}
 
-  // Place player
-  Point pStartCoords = m_map.getStartCoords(true);
-  m_player.actor.move(pStartCoords.x, pStartCoords.y, m_map);
+// Indexed by ActorId, entries of other actors stay empty
+const std::vector<PathStats>& Engine::getEnemyPathStats() const
+{
+  return m_enemyPathStats;
+}
 
-  // Create power-ups
-  for (int i = 0; i < 5; i++)
+void Engine::enemyMove()
+{
+  ProfileScope scope(m_profiler, ProfileZone::ENEMIES);
+  const Player* lead = leadPlayer();
+  if (!lead)
+    return;
+
+  if (m_pathService)
   {
-    Point puCoords = m_map.getRandomCoords();
-    m_powerUps.emplace_back('>', "dark cyan");
-    m_powerUps.back().move(puCoords.x, puCoords.y, m_map);
+    enemyMoveAsync();
+    return;
   }
-  for (int i = 0; i < 5; i++)
+
+  if (m_horde.enemies > 0)
   {
-    Point puCoords = m_map.getRandomCoords();
-    m_powerUps.emplace_back('x', "dark cyan");
-    m_powerUps.back().move(puCoords.x, puCoords.y, m_map);
+    wakeEnemies();
   }
 
+  // A horde spreads a crowd of due enemies over the next ticks instead of
+  // stalling this one, the rest stay due in the scheduler
+  size_t budget = m_horde.enemies > 0 ? static_cast<size_t>(m_horde.updatesPerTick) : SIZE_MAX;
+  ActorId id{};
+  m_dueEnemies.clear();
+  while (m_dueEnemies.size() < budget && m_scheduler.popDue(m_now, id))
+  {
+    m_dueEnemies.push_back(id);
+  }
+  if (m_dueEnemies.empty())
+    return;
 
-  // Create enemies
-  auto currentTime = getCurrentTimeInMilliseconds();
-  m_enemies.emplace_back(Actor('?', "blue"), 350, currentTime);
-  m_enemies.emplace_back(Actor('$', "green"), 300, currentTime);
-  m_enemies.emplace_back(Actor('&', "yellow"), 250, currentTime);
-  m_enemies.emplace_back(Actor('%', "orange"), 200, currentTime);
-  m_enemies.emplace_back(Actor('#', "red"), 150, currentTime);
-
-  // Place enemies
-  Point eStartCoords = m_map.getStartCoords(false);
-  for (auto& enemy : m_enemies)
+  // Searches only read the map and positions, so each enemy gets its own
+  // job. Moves are applied afterwards in scheduler order, which keeps the
+  // result independent of how the searches were spread over threads.
+  size_t count = m_dueEnemies.size();
+  m_duePaths.resize(count);
+  m_dueStats.resize(count);
+  m_dueTargets.resize(count);
+  for (size_t i = 0; i < count; i++)
+  {
+    m_dueTargets[i] = nearestPlayer(m_actors.getPos(m_dueEnemies[i]));
+  }
+  Point leadPos = m_actors.getPos(lead->actor);
+  if (m_influenceEnabled)
   {
-    enemy.actor.move(eStartCoords.x--, eStartCoords.y, m_map);
+    if (m_influenceStale)
+    {
+      rebuildInfluence();
+    }
+    m_influence.updatePlayer(m_map, leadPos, lead->destroys > 0);
+    m_influence.blur();
   }
+  classifyEnemies(leadPos);
+  m_enemyJobs.clear();
+  JobId apply = m_enemyJobs.add([this](int) { applyEnemyMoves(); });
+  for (size_t i = 0; i < count; i++)
+  {
+    if (m_dueAi[i] != EnemyAi::SEARCH)
+      continue;
 
-  // Render start screen
-  render();
+    JobId search = m_enemyJobs.add([this, i](int worker) {
+      AStar& astar = *m_pathfinders[static_cast<size_t>(worker)];
+      m_duePaths[i] = astar.findPath(m_actors.getPos(m_dueEnemies[i]), m_dueTargets[i]);
+      m_dueStats[i] = astar.lastStats();
+    });
+    m_enemyJobs.depend(apply, search);
+  }
+  m_jobs.run(m_enemyJobs);
 }
 
-bool Engine::gameLoop()
+void Engine::applyEnemyMoves()
 {
-  char keypress{};
-  char lastDir{};
-  while (m_state != GameState::STOPPED)
+  bool collectStats = m_pathfinders[0]->collectStats;
+  for (size_t i = 0; i < m_dueEnemies.size(); i++)
   {
-    if (terminal_has_input())
+    ActorId id = m_dueEnemies[i];
+    if (m_actors.isStunned(id))
     {
-      keypress = terminal_read();
-
-      if (keypress == TK_ENTER)
+      m_actors.unstun(id);
+    }
+    EnemyAi ai = m_dueAi[i];
+    if (ai == EnemyAi::SLEEP)
+    {
+      // Left out of the schedule until the player comes near
+      auto index = static_cast<size_t>(id);
+      if (index >= m_asleep.size())
+      {
+        m_asleep.resize(index + 1, false);
+      }
+      m_asleep[index] = true;
+      continue;
+    }
+    Point before = m_actors.getPos(id);
+    if (ai == EnemyAi::FLOW)
+    {
+      Point next;
+      if (m_flow.step(before, next))
       {
-        m_state = m_state == GameState::PAUSED ? GameState::RUNNING : GameState::PAUSED;
+        m_actors.move(id, m_influenceEnabled ? m_influence.steer(m_map, before, next) : next, m_map);
       }
-      else if (keypress == TK_ESCAPE)
+    }
+    else if (ai == EnemyAi::WANDER)
+    {
+      const int dx[] = { 0, 0, -1, 1 };
+      const int dy[] = { -1, 1, 0, 0 };
+      int dir = std::uniform_int_distribution<int>(0, 3)(m_hordeGen);
+      m_actors.move(id, dx[dir], dy[dir], m_map);
+    }
+    const std::vector<Point>& path = m_duePaths[i];
+    if (ai == EnemyAi::SEARCH && path.size() != 0)
+    {
+      m_actors.move(
+        id, m_influenceEnabled ? m_influence.steer(m_map, before, path[0]) : path[0], m_map
+      );
+    }
+    if (m_influenceEnabled)
+    {
+      m_influence.moveEnemy(before, m_actors.getPos(id));
+    }
+    if (ai == EnemyAi::SEARCH && collectStats)
+    {
+      auto index = static_cast<size_t>(id);
+      if (index >= m_enemyPathStats.size())
       {
-        m_state = GameState::STOPPED;
+        m_enemyPathStats.resize(index + 1);
       }
+      m_enemyPathStats[index].add(m_dueStats[i]);
+      m_levelPathStats.add(m_dueStats[i]);
     }
+    m_actors.moveTimer[static_cast<size_t>(m_actors.slot(id))] = m_now;
+    scheduleEnemy(id);
+  }
+}
 
-    if (m_state != GameState::RUNNING)
+// Outside horde mode every enemy searches. In a horde only the nearest get
+// a search, up to the per tick budget; the others follow the flow field,
+// wander about, or fall asleep when far enough away. A field of view makes
+// enemies that cannot see the player wander instead. Each enemy goes for
+// its nearest player; the flow field only leads to the lead player, so the
+// ones after another player measure straight distance and never flow.
+void Engine::classifyEnemies(Point lead)
+{
+  m_dueAi.assign(m_dueEnemies.size(), EnemyAi::SEARCH);
+  if (m_horde.enemies == 0 && !m_fovEnabled)
+    return;
+
+  if (m_horde.enemies > 0 && !m_flow.isCurrent(m_map, lead))
+  {
+    m_flow.build(m_map, lead, m_horde.flowDistance);
+  }
+  int searches = m_horde.searchesPerTick;
+  for (size_t i = 0; i < m_dueEnemies.size(); i++)
+  {
+    Point pos = m_actors.getPos(m_dueEnemies[i]);
+    Point target = m_dueTargets[i];
+    // Enemies that cannot see the player wander until they do
+    bool sees = !m_fovEnabled || m_fov.canSee(m_map, pos, target, FOV_RADIUS);
+    if (m_horde.enemies == 0)
     {
-      render();
+      if (!sees)
+      {
+        m_dueAi[i] = EnemyAi::WANDER;
+      }
       continue;
     }
 
-    auto currentTime = getCurrentTimeInMilliseconds();
-    if (currentTime >= m_player.moveTimer + m_player.moveDelay
-        || keypress != lastDir
-        || m_player.isDashing())
+    bool flows = target == lead;
+    int distance = flows ? m_flow.distance(pos) : std::abs(pos.x - target.x) + std::abs(pos.y - target.y);
+    if (sees && distance <= m_horde.nearDistance && searches > 0)
+    {
+      searches--;
+    }
+    else if (sees && flows && distance <= m_horde.flowDistance)
+    {
+      m_dueAi[i] = EnemyAi::FLOW;
+    }
+    else if (std::abs(pos.x - target.x) + std::abs(pos.y - target.y) <= m_horde.sleepDistance)
+    {
+      m_dueAi[i] = EnemyAi::WANDER;
+    }
+    else
+    {
+      m_dueAi[i] = EnemyAi::SLEEP;
+    }
+  }
+}
+
+// Sleeping enemies around the players rejoin the schedule. Only checked
+// around players that have moved, nothing else brings them closer.
+void Engine::wakeEnemies()
+{
+  for (Player& player : m_players)
+  {
+    if (!player.inPlay())
+      continue;
+
+    Point pos = m_actors.getPos(player.actor);
+    if (pos == player.lastWakeScan)
+      continue;
+
+    player.lastWakeScan = pos;
+    int r = m_horde.wakeDistance;
+    for (int y = std::max(0, pos.y - r); y <= std::min(m_maxY - 1, pos.y + r); y++)
     {
-      if (m_player.isDashing())
+      for (int x = std::max(0, pos.x - r); x <= std::min(m_maxX - 1, pos.x + r); x++)
       {
-        switch (lastDir)
+        for (ActorId id = m_enemyGrid.first(x, y); id != SpatialGrid::NONE; id = m_enemyGrid.next(id))
         {
-          case TK_UP:
-          case TK_W:
-            if (!m_player.actor.move(0, -1, m_map))
-            {
-              m_player.stopDash();
-            }
-            break;
-          case TK_DOWN:
-          case TK_S:
-            if (!m_player.actor.move(0, 1, m_map))
-            {
-              m_player.stopDash();
-            }
-            break;
-          case TK_LEFT:
-          case TK_A:
-            if (!m_player.actor.move(-1, 0, m_map))
-            {
-              m_player.stopDash();
-            }
-            break;
-          case TK_RIGHT:
-          case TK_D:
-            if (!m_player.actor.move(1, 0, m_map))
-            {
-              m_player.stopDash();
-            }
-            break;
+          if (isAsleep(id))
+          {
+            m_asleep[static_cast<size_t>(id)] = false;
+            m_actors.moveTimer[static_cast<size_t>(m_actors.slot(id))] = m_now;
+            scheduleEnemy(id);
+          }
         }
       }
-      else
+    }
+  }
+}
+
+// The five classic kinds in turn, scattered over the level but out of
+// reach of the first searches
+void Engine::spawnHorde()
+{
+  struct Kind
+  {
+    char sym;
+    const char* color;
+  };
+  const Kind kinds[] = { { '?', "blue" }, { '$', "green" }, { '&', "yellow" }, { '%', "orange" }, { '#', "red" } };
+
+  Point player = m_actors.getPos(m_players[0].actor);
+  for (int i = 0; i < m_horde.enemies; i++)
+  {
+    const Kind& kind = kinds[i % 5];
+    ActorId enemy = m_actors.create(ActorKind::ENEMY, kind.sym, kind.color, m_rules.enemyDelays[i % 5], m_now);
+    // A small map or a large nearDistance may have no tile far enough
+    Point p = m_map.getRandomCoords();
+    int dist = std::abs(p.x - player.x) + std::abs(p.y - player.y);
+    for (int attempt = 1; attempt < SPAWN_ATTEMPTS && dist <= m_horde.nearDistance; attempt++)
+    {
+      Point q = m_map.getRandomCoords();
+      int d = std::abs(q.x - player.x) + std::abs(q.y - player.y);
+      if (d > dist)
       {
-        switch (keypress)
-        {
-          case TK_UP:
-          case TK_W:
-            m_player.actor.move(0, -1, m_map);
-            lastDir = keypress;
-            break;
-          case TK_DOWN:
-          case TK_S:
-            m_player.actor.move(0, 1, m_map);
-            lastDir = keypress;
-            break;
-          case TK_LEFT:
-          case TK_A:
-            m_player.actor.move(-1, 0, m_map);
-            lastDir = keypress;
-            break;
-          case TK_RIGHT:
-          case TK_D:
-            m_player.actor.move(1, 0, m_map);
-            lastDir = keypress;
-            break;
-          case TK_SHIFT:
-            m_player.dash();
-            break;
-          case TK_SPACE:
-            m_player.destroy(m_map, m_enemies);
-            break;
-          case TK_ESCAPE:
-            m_state = GameState::STOPPED;
-            break;
-          default:
-            break;
-        }
+        p = q;
+        dist = d;
       }
-      keypress = 0;
-      m_player.moveTimer = currentTime;
     }
+    m_actors.move(enemy, p, m_map);
+    scheduleEnemy(enemy);
+  }
+}
+
+bool Engine::isAsleep(ActorId id) const
+{
+  auto index = static_cast<size_t>(id);
+  return index < m_asleep.size() && m_asleep[index];
+}
 
-    enemyMove();
+// Every due enemy takes the next step of the last path it was given, even
+// if the player has moved on since, and asks for a new path when its own is
+// aimed elsewhere or was computed for older terrain
+void Engine::enemyMoveAsync()
+{
+  takePathResults();
 
-    if (!actorDied())
+  ActorId id{};
+  while (m_scheduler.popDue(m_now, id))
+  {
+    Point target = nearestPlayer(m_actors.getPos(id));
+    if (m_actors.isStunned(id))
     {
-      collectPowerUp();
+      m_actors.unstun(id);
+    }
 
-      if (getCurrentTimeInMilliseconds() >= gameTimer + 1000)
+    auto index = static_cast<size_t>(id);
+    if (index >= m_routes.size())
+    {
+      m_routes.resize(index + 1);
+    }
+    EnemyRoute& route = m_routes[index];
+    bool onRoute = false;
+    if (route.revision == m_map.revision)
+    {
+      auto it = std::find(route.path.begin(), route.path.end(), m_actors.getPos(id));
+      onRoute = it != route.path.end();
+      if (onRoute && it + 1 != route.path.end())
       {
-        gameTime--;
-        gameTimer = getCurrentTimeInMilliseconds();
+        m_actors.move(id, *(it + 1), m_map);
       }
-      if (gameTime == 0)
+    }
+
+    bool waiting = route.pending && route.pendingRevision == m_map.revision;
+    bool current = onRoute && route.goal == target;
+    if (!waiting && !current)
+    {
+      // Searches read a copy, edits on the live map never race with them
+      if (!m_mapSnapshot || m_mapSnapshot->revision != m_map.revision)
       {
-        m_state = GameState::STOPPED;
+        m_mapSnapshot = std::make_shared<const Map>(m_map);
       }
+      m_pathService->submit(PathRequest{ id, m_actors.getPos(id), target, m_map.revision, m_mapSnapshot });
+      route.pending = true;
+      route.pendingRevision = m_map.revision;
     }
 
-    render();
+    m_actors.moveTimer[static_cast<size_t>(m_actors.slot(id))] = m_now;
+    scheduleEnemy(id);
   }
-
-  return true;
 }
 
-void Engine::enemyMove()
+void Engine::takePathResults()
 {
-  auto currentTime = getCurrentTimeInMilliseconds();
-  for (auto& enemy : m_enemies)
+  PathResult result;
+  while (m_pathService->poll(result))
   {
-    if (currentTime >= enemy.moveTimer + enemy.moveDelay)
+    // Drop results of earlier levels, superseded requests and old terrain
+    auto index = static_cast<size_t>(result.id);
+    if (index >= m_routes.size())
+      continue;
+
+    EnemyRoute& route = m_routes[index];
+    if (!route.pending || route.pendingRevision != result.revision)
+      continue;
+
+    route.pending = false;
+    if (result.revision != m_map.revision)
+      continue;
+
+    // Keep the start so the enemy finds itself on the path
+    route.path.assign(1, result.start);
+    route.path.insert(route.path.end(), result.path.begin(), result.path.end());
+    route.goal = result.goal;
+    route.revision = result.revision;
+
+    if (m_pathService->collectStats)
     {
-      if (enemy.isStunned())
-      {
-        enemy.unstun();
-      }
-      auto path = m_astar.findPath(enemy.actor.getPos(), m_player.actor.getPos());
-      if (path.size() != 0)
+      if (index >= m_enemyPathStats.size())
       {
-        enemy.actor.move(
-          path[0], m_map
-        );
+        m_enemyPathStats.resize(index + 1);
       }
-      enemy.moveTimer = currentTime;
+      m_enemyPathStats[index].add(result.stats);
+      m_levelPathStats.add(result.stats);
     }
   }
 }
 
+void Engine::scheduleEnemy(ActorId id)
+{
+  int s = m_actors.slot(id);
+  if (s != Actors::NONE && !isAsleep(id))
+  {
+    auto index = static_cast<size_t>(s);
+    m_scheduler.schedule(id, m_actors.moveTimer[index] + m_actors.moveDelay[index]);
+  }
+  else
+  {
+    m_scheduler.cancel(id);
+  }
+}
+
+// Catches every player an enemy stands on, a dashing one stuns it instead.
+// Caught players fade and stay where they fell; the game is over once no
+// player is left in play.
 bool Engine::actorDied()
 {
-  std::vector<std::vector<Enemy>::iterator> enemiesToRemove;
-  for (auto& enemy : m_enemies)
+  ProfileScope scope(m_profiler, ProfileZone::COLLISION);
+  for (Player& player : m_players)
   {
-    if (m_player.actor.getPos() == enemy.actor.getPos())
+    if (!player.inPlay())
+      continue;
+
+    Point pos = m_actors.getPos(player.actor);
+    for (ActorId id = m_enemyGrid.first(pos.x, pos.y); id != SpatialGrid::NONE; id = m_enemyGrid.next(id))
     {
-      if (m_player.isDashing())
+      if (player.isDashing())
       {
-        enemy.stun();
+        m_actors.stun(id);
+        scheduleEnemy(id);
       }
-      else if (!enemy.isStunned())
+      else if (!m_actors.isStunned(id))
       {
-        m_state = GameState::STOPPED;
-        return true;
+        player.caught = true;
+        m_actors.fade(player.actor);
+        break;
       }
     }
   }
-  return false;
+  if (leadPlayer())
+    return false;
+
+  m_state = GameState::STOPPED;
+  return true;
 }
 
 void Engine::collectPowerUp()
 {
-  for (auto& powerUp : m_powerUps)
+  ProfileScope scope(m_profiler, ProfileZone::POWERUPS);
+  for (Player& player : m_players)
   {
-    if (powerUp.isAlive())
+    if (!player.inPlay())
+      continue;
+
+    Point pos = m_actors.getPos(player.actor);
+    ActorId id = m_powerUpGrid.first(pos.x, pos.y);
+    if (id != SpatialGrid::NONE)
     {
-      if (m_player.actor.getPos() == powerUp.getPos())
+      ActorKind kind = m_actors.kind[static_cast<size_t>(m_actors.slot(id))];
+      if (kind == ActorKind::DASH)
       {
-        if (powerUp.getSym() == '>')
-        {
-          m_player.dashes++;
-        }
-        else if (powerUp.getSym() == 'x')
-        {
-          m_player.destroys++;
-        }
-        powerUp.kill();
-        break;
+        player.dashes++;
       }
+      else if (kind == ActorKind::DESTROY)
+      {
+        player.destroys++;
+      }
+      m_actors.destroy(id);
+    }
+  }
+}
+
+// The first player still in play, or null once all are out
+const Player* Engine::leadPlayer() const
+{
+  for (const Player& player : m_players)
+  {
+    if (player.inPlay())
+      return &player;
+  }
+  return nullptr;
+}
+
+// Position of the player in play closest to from, by straight distance.
+// Ties go to the lower slot.
+Point Engine::nearestPlayer(Point from) const
+{
+  Point best = from;
+  int bestDistance = std::numeric_limits<int>::max();
+  for (const Player& player : m_players)
+  {
+    if (!player.inPlay())
+      continue;
+
+    Point pos = m_actors.getPos(player.actor);
+    int distance = std::abs(pos.x - from.x) + std::abs(pos.y - from.y);
+    if (distance < bestDistance)
+    {
+      best = pos;
+      bestDistance = distance;
     }
   }
+  return best;
 }
 
 void Engine::render()
 {
-  terminal_clear();
+  if (m_headless)
+    return;
 
-  m_map.render();
+  TraceScope trace("render");
+  ProfileScope scope(m_profiler, ProfileZone::RENDER);
+  Frame& frame = m_renderer ? m_renderer->back() : m_frame;
+  frame.clear();
 
-  for (auto& powerUp : m_powerUps)
+  m_map.render(frame);
+
+  m_actors.render(ActorKind::DASH, frame);
+  m_actors.render(ActorKind::DESTROY, frame);
+
+  m_actors.render(ActorKind::PLAYER, frame);
+
+  m_actors.render(ActorKind::ENEMY, frame);
+
+  if (m_fovEnabled)
   {
-    powerUp.render();
+    applyFog(frame);
   }
 
-  m_player.actor.render();
+  printGameTime(frame);
 
-  for (auto& enemy : m_enemies)
+  if (m_floorCount > 1)
   {
-    enemy.actor.render();
+    printFloor(frame);
   }
 
-  printGameTime();
+  printDashes(frame);
 
-  printDashes();
+  printDestroys(frame);
 
-  printDestroys();
-
-  printGameState();
+  printGameState(frame);
 
+  if (m_profiler.enabled)
+  {
+    printProfile(frame);
+  }
 
   if (m_state == GameState::STOPPED)
   {
-    printGameOver();
+    printGameOver(frame);
   }
 
+  // The render thread draws it whenever the terminal is ready
+  if (m_renderer)
+  {
+    m_renderer->publish();
+    return;
+  }
+  frame.draw();
   terminal_refresh();
 }
 
-void Engine::printGameTime()
+// Recounts every enemy, after a new level or a bomb
+void Engine::rebuildInfluence()
+{
+  m_influence.resize(m_maxX, m_maxY);
+  for (int s = 0; s < m_actors.size(); s++)
+  {
+    if (m_actors.kind[static_cast<size_t>(s)] == ActorKind::ENEMY)
+    {
+      m_influence.addEnemy(m_actors.pos[static_cast<size_t>(s)]);
+    }
+  }
+  m_influenceStale = false;
+}
+
+// Hides what the player cannot see, tiles seen before stay as a dim memory
+void Engine::applyFog(Frame& frame)
 {
+  const VisibilityMap& visible = m_fov.from(m_map, m_actors.getPos(m_players[0].actor), FOV_RADIUS);
+  m_explored.merge(visible);
+  color_t remembered = color_from_name("darkest grey");
+  for (int y = 0; y < frame.height; y++)
+  {
+    for (int x = 0; x < frame.width; x++)
+    {
+      if (visible.test(x, y))
+        continue;
+
+      FrameCell& cell = frame.tiles[static_cast<size_t>(y) * static_cast<size_t>(frame.width) + static_cast<size_t>(x)];
+      cell = m_explored.test(x, y) ? FrameCell{ remembered, cell.sym } : FrameCell{ 0, ' ' };
+    }
+  }
+  frame.actors.erase(
+    std::remove_if(frame.actors.begin(), frame.actors.end(), [&](const FrameActor& a) { return !visible.test(a.x, a.y); }),
+    frame.actors.end()
+  );
+}
+
+void Engine::printGameTime(Frame& frame)
+{
+  color_t color{};
   if (gameTime < 5)
   {
-    terminal_color(color_from_name("green"));
+    color = color_from_name("green");
   }
   else if (gameTime < 10)
   {
-    terminal_color(color_from_name("yellow"));
+    color = color_from_name("yellow");
   }
   else if (gameTime < 15)
   {
-    terminal_color(color_from_name("orange"));
+    color = color_from_name("orange");
   }
   else
   {
-    terminal_color(color_from_name("red"));
+    color = color_from_name("red");
   }
-  terminal_print(0, 0, ("Time: " + std::to_string(gameTime)).c_str());
+  frame.print(0, 0, color, "Time: " + std::to_string(gameTime));
 }
 
-void Engine::printGameOver() const
+void Engine::printFloor(Frame& frame)
+{
+  frame.print(10, 0, color_from_name("amber"), "Floor: " + std::to_string(m_floor + 1) + "/" + std::to_string(m_floorCount));
+}
+
+void Engine::printGameOver(Frame& frame) const
 {
   if (gameTime > 0)
   {
-    terminal_color(color_from_name("red"));
-    terminal_print(0, 1, "GAME OVER! YOU LOST!");
+    frame.print(0, 1, color_from_name("red"), "GAME OVER! YOU LOST!");
   }
   else
   {
-    terminal_color(color_from_name("green"));
-    terminal_print(0, 1, "GAME OVER! YOU WON!");
+    frame.print(0, 1, color_from_name("green"), "GAME OVER! YOU WON!");
   }
 }
 
-void Engine::printDashes()
+void Engine::printDashes(Frame& frame)
 {
-  if (m_player.dashes > 1)
+  color_t color{};
+  if (m_players[0].dashes > 1)
   {
-    terminal_color(color_from_name("green"));
+    color = color_from_name("green");
   }
-  else if (m_player.dashes > 0)
+  else if (m_players[0].dashes > 0)
   {
-    terminal_color(color_from_name("yellow"));
+    color = color_from_name("yellow");
   }
   else
   {
-    terminal_color(color_from_name("red"));
+    color = color_from_name("red");
   }
-  terminal_print(0, m_maxY - 2, ("Dashes: " + std::to_string(m_player.dashes)).c_str());
+  frame.print(0, m_maxY - 2, color, "Dashes: " + std::to_string(m_players[0].dashes));
 }
 
-void Engine::printDestroys()
+void Engine::printDestroys(Frame& frame)
 {
-  if (m_player.destroys > 1)
+  color_t color{};
+  if (m_players[0].destroys > 1)
   {
-    terminal_color(color_from_name("green"));
+    color = color_from_name("green");
   }
-  else if (m_player.destroys > 0)
+  else if (m_players[0].destroys > 0)
   {
-    terminal_color(color_from_name("yellow"));
+    color = color_from_name("yellow");
   }
   else
   {
-    terminal_color(color_from_name("red"));
+    color = color_from_name("red");
   }
-  terminal_print(9, m_maxY - 2, (", Destroys: " + std::to_string(m_player.destroys)).c_str());
+  frame.print(9, m_maxY - 2, color, ", Destroys: " + std::to_string(m_players[0].destroys));
 }
 
 
 
-void Engine::printGameState()
+void Engine::printGameState(Frame& frame)
 {
   switch (m_state)
   {
     case GameState::RUNNING:
-      terminal_color(color_from_name("green"));
-      terminal_print(0, m_maxY - 1, "State: RUNNING");
+      frame.print(0, m_maxY - 1, color_from_name("green"), "State: RUNNING");
       break;
     case GameState::PAUSED:
-      terminal_color(color_from_name("yellow"));
-      terminal_print(0, m_maxY - 1, "State: PAUSED");
+      frame.print(0, m_maxY - 1, color_from_name("yellow"), "State: PAUSED");
       break;
     case GameState::STOPPED:
-      terminal_color(color_from_name("red"));
-      terminal_print(0, m_maxY - 1, "State: STOPPED");
+      frame.print(0, m_maxY - 1, color_from_name("red"), "State: STOPPED");
       break;
   }
 }
+
+// Recent p50/p99/max of each zone in microseconds, beside the state line
+void Engine::printProfile(Frame& frame)
+{
+  color_t color = color_from_name("grey");
+  for (int i = 0; i < static_cast<int>(ProfileZone::COUNT); i++)
+  {
+    ProfileStats stats = m_profiler.stats(static_cast<ProfileZone>(i));
+    std::string text = std::string(PROFILE_ZONE_NAMES[i]) + " " + std::to_string(stats.p50 / 1000)
+      + "/" + std::to_string(stats.p99 / 1000) + "/" + std::to_string(stats.max / 1000);
+    // Input latency goes on the top line, beside the time
+    if (static_cast<ProfileZone>(i) == ProfileZone::LATENCY)
+      frame.print(28, 0, color, text);
+    else
+      frame.print(28 + (i % 3) * 24, m_maxY - 2 + i / 3, color, text);
+  }
+}
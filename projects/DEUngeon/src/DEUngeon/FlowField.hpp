@@ -0,0 +1,119 @@
+#pragma once
+
+// Walking distance from every tile near a goal to the goal, found with one
+// breadth-first search. Any number of actors can then step towards the goal
+// by moving to a neighbour that is one step closer.
+class FlowField
+{
+public:
+  static constexpr int UNREACHED{ std::numeric_limits<int>::max() };
+
+  void build(const Map& map, Point goal, int maxDistance);
+  bool isCurrent(const Map& map, Point goal) const;
+  void adopt(const Map& map);
+  int distance(Point p) const;
+  bool step(Point from, Point& next) const;
+
+private:
+  int m_width{};
+  int m_height{};
+  Point m_goal{ -1, -1 };
+  unsigned int m_revision{};
+  std::vector<int> m_distance;
+  std::vector<int> m_queue;
+};
+
+void FlowField::build(const Map& map, Point goal, int maxDistance)
+{
+  size_t cells = static_cast<size_t>(map.map_w) * static_cast<size_t>(map.map_h);
+  if (m_distance.size() != cells)
+  {
+    m_distance.assign(cells, UNREACHED);
+  }
+  else
+  {
+    // Only the tiles the last search reached were written
+    for (int cell : m_queue)
+    {
+      m_distance[static_cast<size_t>(cell)] = UNREACHED;
+    }
+  }
+  m_width = map.map_w;
+  m_height = map.map_h;
+  m_goal = goal;
+  m_revision = map.revision;
+  m_queue.clear();
+
+  auto index = [this](int x, int y) { return static_cast<size_t>(y) * static_cast<size_t>(m_width) + static_cast<size_t>(x); };
+  m_distance[index(goal.x, goal.y)] = 0;
+  m_queue.push_back(goal.y * m_width + goal.x);
+
+  // Stop at maxDistance, beyond it actors are not meant to use the field
+  const int dx[] = { 0, 0, -1, 1 };
+  const int dy[] = { -1, 1, 0, 0 };
+  for (size_t head = 0; head < m_queue.size(); head++)
+  {
+    int x = m_queue[head] % m_width;
+    int y = m_queue[head] / m_width;
+    int d = m_distance[index(x, y)];
+    if (d >= maxDistance)
+      continue;
+
+    for (int i = 0; i < 4; i++)
+    {
+      int nx = x + dx[i];
+      int ny = y + dy[i];
+      if (nx < 0 || ny < 0 || nx >= m_width || ny >= m_height || map.board[ny][nx].blocking)
+        continue;
+
+      int& nd = m_distance[index(nx, ny)];
+      if (nd == UNREACHED)
+      {
+        nd = d + 1;
+        m_queue.push_back(ny * m_width + nx);
+      }
+    }
+  }
+}
+
+bool FlowField::isCurrent(const Map& map, Point goal) const
+{
+  return m_goal == goal && m_revision == map.revision && m_width == map.map_w && m_height == map.map_h;
+}
+
+// A field built on a copy of the board is just as good for map, as long as
+// the board did not change since
+void FlowField::adopt(const Map& map)
+{
+  m_revision = map.revision;
+}
+
+int FlowField::distance(Point p) const
+{
+  if (p.x < 0 || p.y < 0 || p.x >= m_width || p.y >= m_height)
+    return UNREACHED;
+
+  return m_distance[static_cast<size_t>(p.y) * static_cast<size_t>(m_width) + static_cast<size_t>(p.x)];
+}
+
+bool FlowField::step(Point from, Point& next) const
+{
+  int best = distance(from);
+  if (best == UNREACHED || best == 0)
+    return false;
+
+  // Fixed neighbour order keeps ties deterministic
+  const Point around[] = { Point(from.x, from.y - 1), Point(from.x, from.y + 1), Point(from.x - 1, from.y), Point(from.x + 1, from.y) };
+  bool found = false;
+  for (const Point& p : around)
+  {
+    int d = distance(p);
+    if (d < best)
+    {
+      best = d;
+      next = p;
+      found = true;
+    }
+  }
+  return found;
+}
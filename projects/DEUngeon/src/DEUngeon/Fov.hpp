@@ -0,0 +1,258 @@
+#pragma once
+
+// One bit per tile of a window of the map, the whole map after resize()
+class VisibilityMap
+{
+public:
+  void resize(int w, int h);
+  void window(int left, int top, int w, int h);
+  void clear();
+  bool test(int x, int y) const;
+  bool test(Point p) const;
+  void set(int x, int y);
+  void merge(const VisibilityMap& other);
+  const std::vector<uint64_t>& words() const;
+  void assign(const std::vector<uint64_t>& words);
+
+private:
+  int m_left{};
+  int m_top{};
+  int m_width{};
+  int m_height{};
+  std::vector<uint64_t> m_words;
+};
+
+void VisibilityMap::resize(int w, int h)
+{
+  window(0, 0, w, h);
+}
+
+// Tiles outside the window read as not set
+void VisibilityMap::window(int left, int top, int w, int h)
+{
+  m_left = left;
+  m_top = top;
+  m_width = w;
+  m_height = h;
+  m_words.assign((static_cast<size_t>(w) * static_cast<size_t>(h) + 63) / 64, 0);
+}
+
+void VisibilityMap::clear()
+{
+  std::fill(m_words.begin(), m_words.end(), 0);
+}
+
+bool VisibilityMap::test(int x, int y) const
+{
+  x -= m_left;
+  y -= m_top;
+  if (x < 0 || y < 0 || x >= m_width || y >= m_height)
+    return false;
+
+  auto bit = static_cast<size_t>(y) * static_cast<size_t>(m_width) + static_cast<size_t>(x);
+  return (m_words[bit / 64] >> (bit % 64)) & 1;
+}
+
+bool VisibilityMap::test(Point p) const
+{
+  return test(p.x, p.y);
+}
+
+// The tile has to be inside the window
+void VisibilityMap::set(int x, int y)
+{
+  x -= m_left;
+  y -= m_top;
+  auto bit = static_cast<size_t>(y) * static_cast<size_t>(m_width) + static_cast<size_t>(x);
+  m_words[bit / 64] |= uint64_t{ 1 } << (bit % 64);
+}
+
+void VisibilityMap::merge(const VisibilityMap& other)
+{
+  if (other.m_left == m_left && other.m_top == m_top && other.m_width == m_width)
+  {
+    for (size_t i = 0; i < m_words.size() && i < other.m_words.size(); i++)
+    {
+      m_words[i] |= other.m_words[i];
+    }
+    return;
+  }
+
+  // Another window, only its set bits are moved over
+  for (size_t i = 0; i < other.m_words.size(); i++)
+  {
+    for (uint64_t word = other.m_words[i]; word != 0; word &= word - 1)
+    {
+      auto bit = i * 64 + static_cast<size_t>(std::countr_zero(word));
+      auto width = static_cast<size_t>(other.m_width);
+      int x = other.m_left + static_cast<int>(bit % width);
+      int y = other.m_top + static_cast<int>(bit / width);
+      if (x >= m_left && y >= m_top && x < m_left + m_width && y < m_top + m_height)
+      {
+        set(x, y);
+      }
+    }
+  }
+}
+
+const std::vector<uint64_t>& VisibilityMap::words() const
+{
+  return m_words;
+}
+
+// Takes the bits of words() from a map of the same size
+void VisibilityMap::assign(const std::vector<uint64_t>& words)
+{
+  if (words.size() == m_words.size())
+  {
+    m_words = words;
+  }
+  else
+  {
+    clear();
+  }
+}
+
+// Recursive shadowcasting over the blocking layer. Results are cached per
+// origin tile and radius until the map revision changes. Each one only
+// covers the square the radius reaches, so the cache takes the same memory
+// on any map size.
+class FieldOfView
+{
+public:
+  static constexpr size_t CACHE_SIZE{ 512 };
+
+  const VisibilityMap& from(const Map& map, Point origin, int radius);
+  bool canSee(const Map& map, Point from, Point to, int radius);
+  void clear();
+  long long computed() const;
+
+private:
+  std::unordered_map<long long, VisibilityMap> m_cache;
+  unsigned int m_revision{};
+  int m_width{};
+  int m_height{};
+  long long m_computed{};
+
+  void compute(const Map& map, Point origin, int radius, VisibilityMap& visible);
+  void castLight(const Map& map, VisibilityMap& visible, Point origin, int radius, int row,
+                 double start, double end, int xx, int xy, int yx, int yy);
+};
+
+const VisibilityMap& FieldOfView::from(const Map& map, Point origin, int radius)
+{
+  if (map.revision != m_revision || map.map_w != m_width || map.map_h != m_height)
+  {
+    m_cache.clear();
+    m_revision = map.revision;
+    m_width = map.map_w;
+    m_height = map.map_h;
+  }
+
+  long long key = (static_cast<long long>(origin.y) * map.map_w + origin.x) << 8 | (radius & 0xFF);
+  auto it = m_cache.find(key);
+  if (it != m_cache.end())
+    return it->second;
+
+  // Start over rather than track ages, origins move in small steps anyway
+  if (m_cache.size() >= CACHE_SIZE)
+  {
+    m_cache.clear();
+  }
+  VisibilityMap& visible = m_cache[key];
+  compute(map, origin, radius, visible);
+  return visible;
+}
+
+bool FieldOfView::canSee(const Map& map, Point from, Point to, int radius)
+{
+  int dx = to.x - from.x;
+  int dy = to.y - from.y;
+  if (dx * dx + dy * dy > radius * radius)
+    return false;
+
+  return this->from(map, from, radius).test(to);
+}
+
+void FieldOfView::clear()
+{
+  m_cache.clear();
+}
+
+long long FieldOfView::computed() const
+{
+  return m_computed;
+}
+
+void FieldOfView::compute(const Map& map, Point origin, int radius, VisibilityMap& visible)
+{
+  m_computed++;
+  visible.window(origin.x - radius, origin.y - radius, 2 * radius + 1, 2 * radius + 1);
+  visible.set(origin.x, origin.y);
+
+  // The eight octants, as transforms of the first one
+  const int mult[4][8] = {
+    { 1, 0, 0, -1, -1, 0, 0, 1 },
+    { 0, 1, -1, 0, 0, -1, 1, 0 },
+    { 0, 1, 1, 0, 0, -1, -1, 0 },
+    { 1, 0, 0, 1, -1, 0, 0, -1 },
+  };
+  for (int oct = 0; oct < 8; oct++)
+  {
+    castLight(map, visible, origin, radius, 1, 1.0, 0.0, mult[0][oct], mult[1][oct], mult[2][oct], mult[3][oct]);
+  }
+}
+
+void FieldOfView::castLight(const Map& map, VisibilityMap& visible, Point origin, int radius, int row,
+                            double start, double end, int xx, int xy, int yx, int yy)
+{
+  if (start < end)
+    return;
+
+  double newStart = 0.0;
+  for (int j = row; j <= radius; j++)
+  {
+    bool blocked = false;
+    for (int dx = -j, dy = -j; dx <= 0; dx++)
+    {
+      // Slopes of the left and right edges of this cell
+      double leftSlope = (dx - 0.5) / (dy + 0.5);
+      double rightSlope = (dx + 0.5) / (dy - 0.5);
+      if (start < rightSlope)
+        continue;
+      if (end > leftSlope)
+        break;
+
+      int x = origin.x + dx * xx + dy * xy;
+      int y = origin.y + dx * yx + dy * yy;
+      if (x < 0 || y < 0 || x >= map.map_w || y >= map.map_h)
+        continue;
+
+      if (dx * dx + dy * dy <= radius * radius)
+      {
+        visible.set(x, y);
+      }
+
+      bool wall = map.board[y][x].blocking;
+      if (blocked)
+      {
+        if (wall)
+        {
+          newStart = rightSlope;
+          continue;
+        }
+        blocked = false;
+        start = newStart;
+      }
+      else if (wall && j < radius)
+      {
+        // Light past this wall continues in the part of the row above it
+        blocked = true;
+        castLight(map, visible, origin, radius, j + 1, start, leftSlope, xx, xy, yx, yy);
+        newStart = rightSlope;
+      }
+    }
+    if (blocked)
+      break;
+  }
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+struct FrameCell
+{
+  color_t color;
+  char sym;
+};
+
+struct FrameActor
+{
+  int x;
+  int y;
+  color_t color;
+  char sym;
+};
+
+struct FrameText
+{
+  int x;
+  int y;
+  color_t color;
+  std::string text;
+};
+
+// Everything one screen shows: the tile layer, the actors drawn over it in
+// order, then the text. Built by the simulation, drawn by whoever owns the
+// terminal.
+class Frame
+{
+public:
+  int width{};
+  int height{};
+  std::vector<FrameCell> tiles;
+  std::vector<FrameActor> actors;
+  std::vector<FrameText> text;
+  // Keys the simulation had read when it made the frame
+  size_t inputs{};
+
+  void resize(int w, int h);
+  void clear();
+  void tile(int x, int y, color_t color, char sym);
+  void actor(int x, int y, color_t color, char sym);
+  void print(int x, int y, color_t color, std::string str);
+  void draw() const;
+};
+
+void Frame::resize(int w, int h)
+{
+  width = w;
+  height = h;
+  tiles.assign(static_cast<size_t>(w) * static_cast<size_t>(h), FrameCell{ 0, ' ' });
+}
+
+void Frame::clear()
+{
+  // Tiles are all overwritten by the map every frame
+  actors.clear();
+  text.clear();
+}
+
+void Frame::tile(int x, int y, color_t color, char sym)
+{
+  tiles[static_cast<size_t>(y) * static_cast<size_t>(width) + static_cast<size_t>(x)] = FrameCell{ color, sym };
+}
+
+void Frame::actor(int x, int y, color_t color, char sym)
+{
+  actors.push_back(FrameActor{ x, y, color, sym });
+}
+
+void Frame::print(int x, int y, color_t color, std::string str)
+{
+  text.push_back(FrameText{ x, y, color, std::move(str) });
+}
+
+void Frame::draw() const
+{
+  terminal_clear();
+  for (int y = 0; y < height; y++)
+  {
+    for (int x = 0; x < width; x++)
+    {
+      const FrameCell& cell = tiles[static_cast<size_t>(y) * static_cast<size_t>(width) + static_cast<size_t>(x)];
+      terminal_color(cell.color);
+      terminal_put(x, y, cell.sym);
+    }
+  }
+  for (const FrameActor& a : actors)
+  {
+    terminal_color(a.color);
+    terminal_put(a.x, a.y, a.sym);
+  }
+  for (const FrameText& t : text)
+  {
+    terminal_color(t.color);
+    terminal_print(t.x, t.y, t.text.c_str());
+  }
+}
@@ -0,0 +1,200 @@
+#pragma once
+
+#include "FlowField.hpp"
+
+// Grid layers enemies can sample instead of searching:
+//   density : enemies per tile, kept up to date move by move
+//   crowd   : density blurred over the neighbouring tiles
+//   reach   : walking distance to the player
+//   danger  : tiles the player's next bomb would hit
+class InfluenceMap
+{
+public:
+  static constexpr int REACH_DISTANCE{ 64 };
+  static constexpr int BOMB_RADIUS{ 5 };
+  static constexpr float CROWD_WEIGHT{ 1.0F };
+  static constexpr float DANGER_WEIGHT{ 0.5F };
+
+  void resize(int w, int h);
+  void clear();
+  void addEnemy(Point p);
+  void moveEnemy(Point from, Point to);
+  void updatePlayer(const Map& map, Point player, bool armed);
+  void blur();
+  float crowd(Point p) const;
+  float danger(Point p) const;
+  int reach(Point p) const;
+  Point steer(const Map& map, Point from, Point preferred) const;
+
+private:
+  int m_width{};
+  int m_height{};
+  std::vector<float> m_density;
+  std::vector<float> m_crowd;
+  std::vector<float> m_scratch;
+  std::vector<float> m_danger;
+  FlowField m_reach;
+  Point m_player{ -1, -1 };
+  bool m_armed{};
+  bool m_dirty{};
+
+  size_t index(Point p) const;
+  void markDanger(Point center, float value);
+  float score(Point p) const;
+};
+
+void InfluenceMap::resize(int w, int h)
+{
+  m_width = w;
+  m_height = h;
+  auto cells = static_cast<size_t>(w) * static_cast<size_t>(h);
+  m_density.assign(cells, 0.0F);
+  m_crowd.assign(cells, 0.0F);
+  m_scratch.assign(cells, 0.0F);
+  m_danger.assign(cells, 0.0F);
+  m_player = Point(-1, -1);
+  m_armed = false;
+  m_dirty = false;
+}
+
+void InfluenceMap::clear()
+{
+  resize(m_width, m_height);
+}
+
+void InfluenceMap::addEnemy(Point p)
+{
+  m_density[index(p)] += 1.0F;
+  m_dirty = true;
+}
+
+void InfluenceMap::moveEnemy(Point from, Point to)
+{
+  if (from == to)
+    return;
+
+  m_density[index(from)] -= 1.0F;
+  m_density[index(to)] += 1.0F;
+  m_dirty = true;
+}
+
+void InfluenceMap::updatePlayer(const Map& map, Point player, bool armed)
+{
+  if (!m_reach.isCurrent(map, player))
+  {
+    m_reach.build(map, player, REACH_DISTANCE);
+  }
+  if (player == m_player && armed == m_armed)
+    return;
+
+  // Only the old and the new blast squares change
+  if (m_armed)
+  {
+    markDanger(m_player, 0.0F);
+  }
+  if (armed)
+  {
+    markDanger(player, 1.0F);
+  }
+  m_player = player;
+  m_armed = armed;
+}
+
+void InfluenceMap::blur()
+{
+  if (!m_dirty)
+    return;
+
+  // Separable 1-2-1 kernel. Both passes are straight loops over contiguous
+  // floats, which the compiler turns into vector code.
+  int w = m_width;
+  int h = m_height;
+  for (int y = 0; y < h; y++)
+  {
+    const float* in = m_density.data() + static_cast<size_t>(y) * static_cast<size_t>(w);
+    float* out = m_scratch.data() + static_cast<size_t>(y) * static_cast<size_t>(w);
+    out[0] = 0.5F * in[0] + 0.25F * in[1];
+    for (int x = 1; x < w - 1; x++)
+    {
+      out[x] = 0.25F * in[x - 1] + 0.5F * in[x] + 0.25F * in[x + 1];
+    }
+    out[w - 1] = 0.25F * in[w - 2] + 0.5F * in[w - 1];
+  }
+  for (int y = 0; y < h; y++)
+  {
+    const float* up = m_scratch.data() + static_cast<size_t>(std::max(y - 1, 0)) * static_cast<size_t>(w);
+    const float* mid = m_scratch.data() + static_cast<size_t>(y) * static_cast<size_t>(w);
+    const float* down = m_scratch.data() + static_cast<size_t>(std::min(y + 1, h - 1)) * static_cast<size_t>(w);
+    float* out = m_crowd.data() + static_cast<size_t>(y) * static_cast<size_t>(w);
+    float upWeight = y > 0 ? 0.25F : 0.0F;
+    float downWeight = y < h - 1 ? 0.25F : 0.0F;
+    for (int x = 0; x < w; x++)
+    {
+      out[x] = upWeight * up[x] + 0.5F * mid[x] + downWeight * down[x];
+    }
+  }
+  m_dirty = false;
+}
+
+float InfluenceMap::crowd(Point p) const
+{
+  return m_crowd[index(p)];
+}
+
+float InfluenceMap::danger(Point p) const
+{
+  return m_danger[index(p)];
+}
+
+int InfluenceMap::reach(Point p) const
+{
+  return m_reach.distance(p);
+}
+
+// Of the neighbours that get at least as close to the player as the
+// preferred step, the least crowded and dangerous one. Enemies on the same
+// path spread over side corridors instead of queueing up.
+Point InfluenceMap::steer(const Map& map, Point from, Point preferred) const
+{
+  int target = reach(preferred);
+  if (target == FlowField::UNREACHED)
+    return preferred;
+
+  Point best = preferred;
+  float bestScore = score(preferred);
+  const Point around[] = { Point(from.x, from.y - 1), Point(from.x, from.y + 1), Point(from.x - 1, from.y), Point(from.x + 1, from.y) };
+  for (const Point& p : around)
+  {
+    if (p == preferred || !map.inBounds(p.x, p.y) || map.board[p.y][p.x].blocking || reach(p) > target)
+      continue;
+
+    float s = score(p);
+    if (s < bestScore)
+    {
+      best = p;
+      bestScore = s;
+    }
+  }
+  return best;
+}
+
+size_t InfluenceMap::index(Point p) const
+{
+  return static_cast<size_t>(p.y) * static_cast<size_t>(m_width) + static_cast<size_t>(p.x);
+}
+
+void InfluenceMap::markDanger(Point center, float value)
+{
+  for (int y = std::max(center.y - BOMB_RADIUS, 0); y <= std::min(center.y + BOMB_RADIUS, m_height - 1); y++)
+  {
+    for (int x = std::max(center.x - BOMB_RADIUS, 0); x <= std::min(center.x + BOMB_RADIUS, m_width - 1); x++)
+    {
+      m_danger[index(Point(x, y))] = value;
+    }
+  }
+}
+
+float InfluenceMap::score(Point p) const
+{
+  return m_crowd[index(p)] * CROWD_WEIGHT + m_danger[index(p)] * DANGER_WEIGHT;
+}
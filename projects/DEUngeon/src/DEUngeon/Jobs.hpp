@@ -0,0 +1,239 @@
+#pragma once
+
+using JobId = int;
+
+// Jobs and the order between them. A job runs once all jobs it depends on
+// have finished; jobs without a path between them may run in parallel.
+class JobGraph
+{
+public:
+  JobId add(std::function<void(int worker)> fn);
+  void depend(JobId job, JobId on);
+  void clear();
+  int size() const;
+
+private:
+  friend class JobSystem;
+
+  struct Job
+  {
+    std::function<void(int worker)> fn;
+    std::vector<JobId> dependents;
+    int dependencies{};
+    std::atomic<int> remaining{};
+  };
+  // A deque so jobs never move, their counters are atomics
+  std::deque<Job> m_jobs;
+  int m_size{};
+};
+
+JobId JobGraph::add(std::function<void(int worker)> fn)
+{
+  // Reuse the slots of the last run to keep their vectors' capacity
+  if (static_cast<size_t>(m_size) == m_jobs.size())
+  {
+    m_jobs.emplace_back();
+  }
+  Job& job = m_jobs[static_cast<size_t>(m_size)];
+  job.fn = std::move(fn);
+  job.dependents.clear();
+  job.dependencies = 0;
+  return m_size++;
+}
+
+void JobGraph::depend(JobId job, JobId on)
+{
+  m_jobs[static_cast<size_t>(on)].dependents.push_back(job);
+  m_jobs[static_cast<size_t>(job)].dependencies++;
+}
+
+void JobGraph::clear()
+{
+  m_size = 0;
+}
+
+int JobGraph::size() const
+{
+  return m_size;
+}
+
+// Fixed pool of worker threads, each with its own deque of ready jobs.
+// A worker takes from the back of its own deque and steals from the front
+// of the others when it runs dry. The thread calling run() is worker 0 and
+// helps until the whole graph is done.
+class JobSystem
+{
+public:
+  explicit JobSystem(unsigned int threads);
+  JobSystem(const JobSystem&) = delete;
+  JobSystem& operator=(const JobSystem&) = delete;
+  ~JobSystem();
+
+  void run(JobGraph& graph);
+  int workers() const;
+
+private:
+  struct Queue
+  {
+    std::mutex mutex;
+    std::deque<JobId> jobs;
+  };
+
+  std::vector<std::thread> m_threads;
+  std::vector<std::unique_ptr<Queue>> m_queues;
+  std::mutex m_wakeMutex;
+  std::condition_variable m_wake;
+  JobGraph* m_graph{};
+  unsigned long long m_run{};
+  bool m_stop{};
+  std::atomic<int> m_pending{};
+
+  void push(int worker, JobId job);
+  bool take(int worker, JobId& job);
+  void execute(int worker, JobId job);
+  void work(int worker);
+};
+
+JobSystem::JobSystem(unsigned int threads)
+{
+  int count = static_cast<int>(std::max(threads, 1u));
+  for (int i = 0; i < count; i++)
+  {
+    m_queues.push_back(std::make_unique<Queue>());
+  }
+  for (int i = 1; i < count; i++)
+  {
+    m_threads.emplace_back([this, i]() {
+      unsigned long long seen = 0;
+      while (true)
+      {
+        {
+          std::unique_lock<std::mutex> lock(m_wakeMutex);
+          m_wake.wait(lock, [&]() { return m_stop || m_run != seen; });
+          if (m_stop)
+            return;
+          seen = m_run;
+        }
+        work(i);
+      }
+    });
+  }
+}
+
+JobSystem::~JobSystem()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_wakeMutex);
+    m_stop = true;
+  }
+  m_wake.notify_all();
+  for (std::thread& thread : m_threads)
+  {
+    thread.join();
+  }
+}
+
+void JobSystem::run(JobGraph& graph)
+{
+  if (graph.m_size == 0)
+    return;
+
+  m_graph = &graph;
+  m_pending.store(graph.m_size, std::memory_order_relaxed);
+  for (JobId id = 0; id < graph.m_size; id++)
+  {
+    JobGraph::Job& job = graph.m_jobs[static_cast<size_t>(id)];
+    job.remaining.store(job.dependencies, std::memory_order_relaxed);
+  }
+
+  // Spread the starting jobs so workers begin without stealing
+  int ready = 0;
+  for (JobId id = 0; id < graph.m_size; id++)
+  {
+    if (graph.m_jobs[static_cast<size_t>(id)].dependencies == 0)
+    {
+      push(ready++ % workers(), id);
+    }
+  }
+
+  // A single ready job gains nothing from waking the pool
+  if (ready > 1 && !m_threads.empty())
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_wakeMutex);
+      m_run++;
+    }
+    m_wake.notify_all();
+  }
+  work(0);
+  m_graph = nullptr;
+}
+
+int JobSystem::workers() const
+{
+  return static_cast<int>(m_queues.size());
+}
+
+void JobSystem::push(int worker, JobId job)
+{
+  Queue& queue = *m_queues[static_cast<size_t>(worker)];
+  std::lock_guard<std::mutex> lock(queue.mutex);
+  queue.jobs.push_back(job);
+}
+
+bool JobSystem::take(int worker, JobId& job)
+{
+  int count = workers();
+  for (int i = 0; i < count; i++)
+  {
+    int victim = (worker + i) % count;
+    Queue& queue = *m_queues[static_cast<size_t>(victim)];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.jobs.empty())
+      continue;
+
+    if (victim == worker)
+    {
+      job = queue.jobs.back();
+      queue.jobs.pop_back();
+    }
+    else
+    {
+      job = queue.jobs.front();
+      queue.jobs.pop_front();
+    }
+    return true;
+  }
+  return false;
+}
+
+void JobSystem::execute(int worker, JobId id)
+{
+  JobGraph::Job& job = m_graph->m_jobs[static_cast<size_t>(id)];
+  job.fn(worker);
+  for (JobId next : job.dependents)
+  {
+    if (m_graph->m_jobs[static_cast<size_t>(next)].remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+      push(worker, next);
+    }
+  }
+  m_pending.fetch_sub(1, std::memory_order_release);
+}
+
+void JobSystem::work(int worker)
+{
+  // Jobs still waiting on dependencies may be unlocked by another worker
+  while (m_pending.load(std::memory_order_acquire) > 0)
+  {
+    JobId job{};
+    if (take(worker, job))
+    {
+      execute(worker, job);
+    }
+    else
+    {
+      std::this_thread::yield();
+    }
+  }
+}
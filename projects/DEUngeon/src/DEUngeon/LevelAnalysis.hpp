@@ -0,0 +1,265 @@
+#pragma once
+
+#include "Engine.hpp"
+#include "Jobs.hpp"
+#include "Snapshot.hpp"
+
+// What a level offers before anyone plays it. Distances are steps from the
+// nearest player, -1 when there is nothing reachable to measure.
+struct LevelReport
+{
+  unsigned int seed{};
+  int floorTiles{};
+  int reachableTiles{};
+  double floorRatio{};
+  int deadEnds{};
+  int powerUps{};
+  int unreachablePowerUps{};
+  int enemies{};
+  int unreachableEnemies{};
+  int stairs{};
+  int unreachableStairs{};
+  int nearestEnemy{ -1 };
+  double meanEnemyDistance{ -1 };
+  int farthestPowerUp{ -1 };
+  // Saved to the pool directory
+  bool pooled{};
+
+  bool playable() const;
+};
+
+// Measures levels with one breadth-first search from every player at once.
+// The buffers are kept between levels, so one analyzer per thread is enough
+// for any number of them.
+class LevelAnalyzer
+{
+public:
+  LevelReport analyze(const Engine& engine);
+  LevelReport analyze(const Map& map, const Actors& actors);
+  // Steps from the nearest player in the last level analyzed, -1 if none
+  int distance(int x, int y) const;
+
+private:
+  int m_width{};
+  std::vector<int> m_distance;
+  std::vector<int> m_queue;
+
+  void spread(const Map& map, const Actors& actors);
+};
+
+struct LevelAnalysisConfig
+{
+  int levels{ 1000 };
+  unsigned int firstSeed{ 1 };
+  unsigned int threads{};
+  int width{ 100 };
+  int height{ 50 };
+  int rooms{ 15 };
+  int floors{ 1 };
+  bool caves{};
+  GameRules rules;
+  HordeConfig horde;
+  // Where to save every playable level as a snapshot, none if empty
+  std::string pool;
+};
+
+std::vector<LevelReport> analyzeLevels(const LevelAnalysisConfig& config);
+void writeLevelCsv(std::ostream& out, const std::vector<LevelReport>& reports, bool header);
+
+// Every power-up, enemy and stairs can be walked to
+bool LevelReport::playable() const
+{
+  return reachableTiles > 0 && unreachablePowerUps == 0 && unreachableEnemies == 0 && unreachableStairs == 0;
+}
+
+LevelReport LevelAnalyzer::analyze(const Engine& engine)
+{
+  LevelReport report = analyze(engine.getMap(), engine.getActors());
+  report.seed = engine.getSeed();
+  return report;
+}
+
+LevelReport LevelAnalyzer::analyze(const Map& map, const Actors& actors)
+{
+  spread(map, actors);
+
+  LevelReport report;
+  for (int y = 0; y < map.map_h; y++)
+  {
+    for (int x = 0; x < map.map_w; x++)
+    {
+      const Point& tile = map.board[y][x];
+      if (tile.blocking)
+        continue;
+
+      report.floorTiles++;
+      report.reachableTiles += distance(x, y) >= 0 ? 1 : 0;
+
+      // Open on one side only, the end of a tunnel or a pocket
+      int open = 0;
+      open += x > 0 && !map.board[y][x - 1].blocking ? 1 : 0;
+      open += x + 1 < map.map_w && !map.board[y][x + 1].blocking ? 1 : 0;
+      open += y > 0 && !map.board[y - 1][x].blocking ? 1 : 0;
+      open += y + 1 < map.map_h && !map.board[y + 1][x].blocking ? 1 : 0;
+      report.deadEnds += open == 1 ? 1 : 0;
+
+      if (tile.terrain == TERRAIN::STAIRS_UP || tile.terrain == TERRAIN::STAIRS_DOWN)
+      {
+        report.stairs++;
+        report.unreachableStairs += distance(x, y) < 0 ? 1 : 0;
+      }
+    }
+  }
+  report.floorRatio = static_cast<double>(report.floorTiles) / (static_cast<double>(map.map_w) * map.map_h);
+
+  long long enemySteps = 0;
+  int reachedEnemies = 0;
+  for (int s = 0; s < actors.size(); s++)
+  {
+    ActorKind kind = actors.kind[static_cast<size_t>(s)];
+    const Point& p = actors.pos[static_cast<size_t>(s)];
+    int d = distance(p.x, p.y);
+    if (kind == ActorKind::ENEMY)
+    {
+      report.enemies++;
+      report.unreachableEnemies += d < 0 ? 1 : 0;
+      if (d >= 0)
+      {
+        report.nearestEnemy = report.nearestEnemy < 0 ? d : std::min(report.nearestEnemy, d);
+        enemySteps += d;
+        reachedEnemies++;
+      }
+    }
+    else if (kind == ActorKind::DASH || kind == ActorKind::DESTROY)
+    {
+      report.powerUps++;
+      report.unreachablePowerUps += d < 0 ? 1 : 0;
+      report.farthestPowerUp = std::max(report.farthestPowerUp, d);
+    }
+  }
+  if (reachedEnemies > 0)
+  {
+    report.meanEnemyDistance = static_cast<double>(enemySteps) / reachedEnemies;
+  }
+  return report;
+}
+
+int LevelAnalyzer::distance(int x, int y) const
+{
+  if (x < 0 || y < 0 || x >= m_width || static_cast<size_t>(y) * m_width + x >= m_distance.size())
+    return -1;
+
+  return m_distance[static_cast<size_t>(y) * m_width + x];
+}
+
+// Steps from the nearest player to every open tile, all players start in
+// the queue so each tile is visited once however many there are
+void LevelAnalyzer::spread(const Map& map, const Actors& actors)
+{
+  m_width = map.map_w;
+  m_distance.assign(static_cast<size_t>(map.map_w) * map.map_h, -1);
+  m_queue.clear();
+  for (int s = 0; s < actors.size(); s++)
+  {
+    const Point& p = actors.pos[static_cast<size_t>(s)];
+    if (actors.kind[static_cast<size_t>(s)] != ActorKind::PLAYER || !map.inBounds(p.x, p.y))
+      continue;
+
+    int tile = p.y * map.map_w + p.x;
+    if (m_distance[static_cast<size_t>(tile)] < 0)
+    {
+      m_distance[static_cast<size_t>(tile)] = 0;
+      m_queue.push_back(tile);
+    }
+  }
+
+  for (size_t head = 0; head < m_queue.size(); head++)
+  {
+    int tile = m_queue[head];
+    int x = tile % map.map_w;
+    int y = tile / map.map_w;
+    int next = m_distance[static_cast<size_t>(tile)] + 1;
+    auto visit = [&](int nx, int ny) {
+      int n = ny * map.map_w + nx;
+      if (map.board[ny][nx].blocking || m_distance[static_cast<size_t>(n)] >= 0)
+        return;
+
+      m_distance[static_cast<size_t>(n)] = next;
+      m_queue.push_back(n);
+    };
+    if (x > 0)
+      visit(x - 1, y);
+    if (x + 1 < map.map_w)
+      visit(x + 1, y);
+    if (y > 0)
+      visit(x, y - 1);
+    if (y + 1 < map.map_h)
+      visit(x, y + 1);
+  }
+}
+
+// Generates and measures config.levels seeded levels, one per job on a
+// work-stealing pool; the reports are in seed order whatever the thread
+// count. Playable levels are saved to the pool directory by the worker that
+// made them.
+std::vector<LevelReport> analyzeLevels(const LevelAnalysisConfig& config)
+{
+  struct Seat
+  {
+    std::unique_ptr<Engine> engine;
+    LevelAnalyzer analyzer;
+  };
+
+  JobSystem jobs(config.threads != 0 ? config.threads : std::thread::hardware_concurrency());
+  std::vector<Seat> seats(static_cast<size_t>(jobs.workers()));
+  std::vector<LevelReport> reports(static_cast<size_t>(std::max(config.levels, 0)));
+  JobGraph graph;
+  for (size_t l = 0; l < reports.size(); l++)
+  {
+    graph.add([&, l](int worker) {
+      auto seed = config.firstSeed + static_cast<unsigned int>(l);
+      Seat& seat = seats[static_cast<size_t>(worker)];
+      if (!seat.engine)
+      {
+        seat.engine = std::make_unique<Engine>(config.width, config.height, config.rooms, seed, true, 1);
+        seat.engine->caves(config.caves);
+        seat.engine->horde(config.horde);
+        seat.engine->rules(config.rules);
+        seat.engine->floors(config.floors);
+      }
+      else
+      {
+        seat.engine->reset(seed);
+      }
+
+      reports[l] = seat.analyzer.analyze(*seat.engine);
+      if (!config.pool.empty() && reports[l].playable())
+      {
+        Snapshot level;
+        seat.engine->capture(level);
+        std::string path = config.pool + "/level-" + std::to_string(seed) + ".bin";
+        reports[l].pooled = level.save(path.c_str());
+      }
+    });
+  }
+  jobs.run(graph);
+  return reports;
+}
+
+// One row per level, to sort and filter seeds by
+void writeLevelCsv(std::ostream& out, const std::vector<LevelReport>& reports, bool header)
+{
+  if (header)
+  {
+    out << "seed,playable,floor_tiles,reachable_tiles,floor_ratio,dead_ends,power_ups,unreachable_power_ups,"
+        << "enemies,unreachable_enemies,stairs,unreachable_stairs,nearest_enemy,mean_enemy_distance,farthest_power_up\n";
+  }
+  for (const LevelReport& r : reports)
+  {
+    out << r.seed << ',' << (r.playable() ? 1 : 0) << ',' << r.floorTiles << ',' << r.reachableTiles << ','
+        << r.floorRatio << ',' << r.deadEnds << ',' << r.powerUps << ',' << r.unreachablePowerUps << ','
+        << r.enemies << ',' << r.unreachableEnemies << ',' << r.stairs << ',' << r.unreachableStairs << ','
+        << r.nearestEnemy << ',' << r.meanEnemyDistance << ',' << r.farthestPowerUp << '\n';
+  }
+  out.flush();
+}
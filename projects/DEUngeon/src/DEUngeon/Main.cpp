@@ -1,39 +1,668 @@
 #include <algorithm>
+#include <atomic>
+#include <bit>
 #include <chrono>
 #include <cmath>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
 #include <iostream>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
 #include <queue>
 #include <random>
+#include <sstream>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
 #include <BearLibTerminal.h>
 
 #include "Actor.hpp"
+#include "AnsiTerminal.hpp"
+#include "Arena.hpp"
+#include "Bot.hpp"
+#include "Caves.hpp"
+#include "Dungeon.hpp"
 #include "Engine.hpp"
+#include "FlowField.hpp"
+#include "Fov.hpp"
+#include "InfluenceMap.hpp"
+#include "Frame.hpp"
+#include "Jobs.hpp"
+#include "LevelAnalysis.hpp"
 #include "Map.hpp"
+#include "Multiplayer.hpp"
+#include "Net.hpp"
 #include "PathFinding.hpp"
+#include "PathService.hpp"
+#include "Profiler.hpp"
+#include "Renderer.hpp"
+#include "Replay.hpp"
+#include "Scheduler.hpp"
+#include "SelfPlay.hpp"
+#include "Snapshot.hpp"
+#include "SpatialGrid.hpp"
+#include "Sync.hpp"
+#include "Trace.hpp"
 
 using namespace std;
 
-static void initBearLib(int wx, int wy)
+static void writePathStatsRow(std::ostream& out, unsigned int seed, const std::string& scope, const PathStats& s)
 {
-  terminal_open();
-  std::string windowSize = "window: size=" + std::to_string(wx) + "x" + std::to_string(wy) + ";";
-  terminal_set(windowSize.c_str());
-  terminal_refresh();
+  out << seed << '\t' << scope << '\t' << s.queries << '\t' << s.failed << '\t' << s.pushed << '\t'
+      << s.popped << '\t' << s.maxOpen << '\t' << s.touched << '\t' << s.totalNs / 1000.0 << '\t'
+      << s.maxNs / 1000.0 << '\n';
 }
 
-int main()
+// One row for the level, then one per enemy that searched
+static void writePathStats(std::ostream& out, const Engine& eng)
+{
+  writePathStatsRow(out, eng.getSeed(), "level", eng.getLevelPathStats());
+  const std::vector<PathStats>& enemies = eng.getEnemyPathStats();
+  for (size_t id = 0; id < enemies.size(); id++)
+  {
+    if (enemies[id].queries > 0)
+    {
+      writePathStatsRow(out, eng.getSeed(), "enemy " + std::to_string(id), enemies[id]);
+    }
+  }
+  out.flush();
+}
+
+// Plays back a recording without a window as fast as possible
+static int replayGames(const char* path, unsigned int threads, std::ostream* pathStats)
+{
+  Replay replay;
+  unsigned int seed{};
+  if (!replay.open(path) || !replay.nextGame(seed))
+  {
+    std::cerr << "Cannot read replay: " << path << std::endl;
+    return 1;
+  }
+
+  Engine eng(replay.width, replay.height, replay.rooms, seed, true, threads);
+  if (replay.horde > 0)
+  {
+    HordeConfig horde;
+    horde.enemies = replay.horde;
+    eng.horde(horde);
+  }
+  if (replay.floors > 1)
+  {
+    eng.floors(replay.floors);
+  }
+  if ((replay.flags & REPLAY_CAVES) != 0)
+  {
+    eng.caves(true);
+  }
+  eng.routedTunnels((replay.flags & REPLAY_ROUTED_TUNNELS) != 0);
+  eng.fieldOfView((replay.flags & REPLAY_FOV) != 0);
+  eng.influence((replay.flags & REPLAY_INFLUENCE) != 0);
+  eng.replay(&replay);
+  eng.collectPathStats(pathStats != nullptr);
+  auto start = std::chrono::steady_clock::now();
+  int games = 0;
+  long long frames = 0;
+  while (true)
+  {
+    eng.gameLoop();
+    games++;
+    frames += eng.getFrames();
+    std::cout << "game " << games << ": seed " << seed << ", time left " << eng.getGameTime()
+              << ", frames " << eng.getFrames() << std::endl;
+    if (replay.floors > 1)
+    {
+      DungeonStats dungeon = eng.getDungeonStats();
+      std::cout << "  floor " << eng.getFloor() + 1 << ", floors prepared " << dungeon.prepared << ", packed "
+                << dungeon.packed << ", spilled " << dungeon.spilled << ", waits " << dungeon.waits << " ("
+                << dungeon.waitUs << " us)" << std::endl;
+    }
+    if (pathStats)
+    {
+      writePathStats(*pathStats, eng);
+    }
+
+    if (!replay.nextGame(seed))
+      break;
+
+    eng.reset(seed);
+  }
+  auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+  std::cout << "replayed " << games << " games, " << frames << " frames in "
+            << elapsed.count() / 1000.0 << " ms" << std::endl;
+  return 0;
+}
+
+// Plays seeded games with a bot on every core and sums them up. With a CSV
+// path the summary row is appended, the header only goes into a new file.
+static int selfPlayGames(const SelfPlayConfig& config, const char* csvPath)
+{
+  if (!makeBot(config.bot))
+  {
+    std::cerr << "Unknown bot: " << config.bot << " (greedy, lookahead, random)" << std::endl;
+    return 1;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<SelfPlayGame> games = selfPlay(config);
+  auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+  double wallMs = elapsed.count() / 1000.0;
+
+  writeSelfPlayCsv(std::cout, config, games, wallMs, true);
+  if (csvPath)
+  {
+    bool header = !std::ifstream(csvPath).good();
+    std::ofstream csv(csvPath, std::ios::app);
+    if (!csv)
+    {
+      std::cerr << "Cannot write CSV: " << csvPath << std::endl;
+      return 1;
+    }
+    writeSelfPlayCsv(csv, config, games, wallMs, header);
+  }
+  return 0;
+}
+
+// Measures config.levels seeded levels, or only the saved one when there is
+// one, and writes a CSV row per level
+static int analyzeGames(const LevelAnalysisConfig& config, const Snapshot* save, const char* csvPath)
+{
+  if (!config.pool.empty())
+  {
+    std::error_code error;
+    std::filesystem::create_directories(config.pool, error);
+    if (error)
+    {
+      std::cerr << "Cannot create level pool: " << config.pool << std::endl;
+      return 1;
+    }
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<LevelReport> reports;
+  if (save)
+  {
+    Engine eng(config.width, config.height, config.rooms, 1, true, 1);
+    eng.floors(config.floors);
+    if (!eng.restore(*save))
+    {
+      std::cerr << "Save is for another map size or floor count" << std::endl;
+      return 1;
+    }
+    LevelAnalyzer analyzer;
+    reports.push_back(analyzer.analyze(eng));
+  }
+  else
+  {
+    reports = analyzeLevels(config);
+  }
+  auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+  std::ofstream csv;
+  if (csvPath)
+  {
+    csv.open(csvPath, std::ios::trunc);
+    if (!csv)
+    {
+      std::cerr << "Cannot write CSV: " << csvPath << std::endl;
+      return 1;
+    }
+  }
+  writeLevelCsv(csvPath ? csv : std::cout, reports, true);
+
+  long long playable = 0;
+  long long pooled = 0;
+  for (const LevelReport& r : reports)
+  {
+    playable += r.playable() ? 1 : 0;
+    pooled += r.pooled ? 1 : 0;
+  }
+  std::cerr << "levels " << reports.size() << ", playable " << playable << ", pooled " << pooled << ", "
+            << elapsed.count() / 1000.0 << " ms" << std::endl;
+  return !config.pool.empty() && pooled < playable ? 1 : 0;
+}
+
+// Runs the authoritative game until the configured number of ticks, then
+// sums up what it sent
+static int serveGames(const ServerConfig& config)
+{
+  GameServer server(config);
+  if (!server.listen())
+  {
+    std::cerr << "Cannot listen on: " << config.address << std::endl;
+    return 1;
+  }
+  std::cout << "serving on " << config.address << ", " << config.tickMs << " ms per tick" << std::endl;
+  server.run();
+
+  const ServerStats& s = server.stats();
+  long long ticks = std::max(s.ticks, 1LL);
+  std::cout << "ticks " << s.ticks << ", joins " << s.joins << ", drops " << s.drops << ", peak clients "
+            << s.peakClients << ", delta " << s.deltaBytes / ticks << " bytes per tick, sent "
+            << s.bytesQueued << " bytes, tick mean " << s.totalTickUs / ticks << " us, max " << s.maxTickUs
+            << " us" << std::endl;
+  return 0;
+}
+
+// Plays on a server in a window of the size it hands out
+static int playOnline(const char* address, bool ansi)
+{
+  GameClient client;
+  if (!client.connect(address))
+  {
+    std::cerr << "Cannot join: " << address << std::endl;
+    return 1;
+  }
+
+  Renderer renderer(client.world.width, client.world.height, ansi);
+  Profiler latency;
+  while (true)
+  {
+    long long latencyUs{};
+    while (renderer.readLatency(latencyUs))
+    {
+      latency.record(ProfileZone::LATENCY, latencyUs * 1000);
+    }
+    for (int key = renderer.readKey(); key != 0; key = renderer.readKey())
+    {
+      if (key == TK_ESCAPE || key == TK_CLOSE)
+      {
+        // Printed once the terminal is back to normal. A key is timed until
+        // the first frame drawn after it was sent, not the server's answer.
+        renderer.stop();
+        ProfileStats stats = latency.stats(ProfileZone::LATENCY);
+        if (stats.count > 0)
+        {
+          std::cout << "Input latency over " << stats.count << " keys: p50 " << stats.p50 / 1000 << " us, p99 "
+                    << stats.p99 / 1000 << " us, max " << stats.max / 1000 << " us" << std::endl;
+        }
+        return 0;
+      }
+      client.send(key);
+    }
+    if (!client.poll())
+    {
+      std::cerr << "Lost the server" << std::endl;
+      return 1;
+    }
+    client.render(renderer.back());
+    renderer.publish();
+    client.wait(5);
+  }
+}
+
+// Clients without a window for testing a server: each holds a random
+// direction for a while, now and then dashing or bombing. Fails when one
+// loses the server or its world stops matching the server's.
+static int scriptedClients(const char* address, int count, int seconds)
+{
+  std::vector<std::unique_ptr<GameClient>> clients;
+  for (int i = 0; i < count; i++)
+  {
+    clients.push_back(std::make_unique<GameClient>());
+    if (!clients.back()->connect(address))
+    {
+      std::cerr << "Cannot join: " << address << std::endl;
+      return 1;
+    }
+  }
+
+  const int keys[] = { TK_UP, TK_DOWN, TK_LEFT, TK_RIGHT, TK_UP, TK_DOWN, TK_LEFT, TK_RIGHT, TK_SHIFT, TK_SPACE };
+  std::mt19937 gen(static_cast<unsigned int>(count));
+  auto start = std::chrono::steady_clock::now();
+  auto end = start + std::chrono::seconds(seconds);
+  std::vector<std::chrono::steady_clock::time_point> nextKey(clients.size(), start);
+  std::vector<bool> lost(clients.size(), false);
+  for (auto now = start; now < end; now = std::chrono::steady_clock::now())
+  {
+    for (size_t i = 0; i < clients.size(); i++)
+    {
+      if (lost[i])
+        continue;
+
+      lost[i] = !clients[i]->poll();
+      if (now >= nextKey[i])
+      {
+        clients[i]->send(keys[std::uniform_int_distribution<int>(0, 9)(gen)]);
+        nextKey[i] = now + std::chrono::milliseconds(std::uniform_int_distribution<int>(100, 400)(gen));
+      }
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  bool failed = false;
+  for (size_t i = 0; i < clients.size(); i++)
+  {
+    const GameClient& c = *clients[i];
+    std::cout << "client " << c.slot << ": ticks " << c.ticks << ", " << c.bytes << " bytes ("
+              << c.bytes / std::max(c.ticks, 1LL) << " per tick), checks " << c.checks << ", mismatches "
+              << c.mismatches << (lost[i] ? ", lost the server" : "") << std::endl;
+    failed = failed || lost[i] || c.mismatches > 0 || c.checks == 0;
+  }
+  return failed ? 1 : 0;
+}
+
+// Reads "350,300,250,200,150" into the five enemy delays
+static bool parseEnemyDelays(const char* text, GameRules& rules)
+{
+  std::string list(text);
+  size_t begin = 0;
+  for (int i = 0; i < 5; i++)
+  {
+    size_t end = list.find(',', begin);
+    if ((end == std::string::npos) != (i == 4))
+      return false;
+
+    rules.enemyDelays[i] = std::max(std::atoi(list.substr(begin, end - begin).c_str()), 1);
+    begin = end + 1;
+  }
+  return true;
+}
+
+// DEUngeon [--record <file> | --replay <file>] [--trace <file>] [--path-stats <file>] [--threads <n>] [--async-paths] [--horde <n>] [--fov] [--influence]
+//          [--load <file>] [--selfplay <games> [--bot <greedy|lookahead|random>] [--csv <file>]]
+//          [--serve <address> [--tick <ms>] [--ticks <n>]] [--connect <address> [--clients <n>] [--seconds <s>]] [--floors <n>] [--caves]
+//          [--analyze <levels> [--pool <dir>] [--csv <file>]] [--ansi]
+//          [--enemy-delays <a,b,c,d,e>] [--power-ups <n>] [--game-time <s>] (with --selfplay, --serve or --analyze)
+int main(int argc, char* argv[])
 {
   int wx = 100;
   int wy = 50;
-  initBearLib(wx, wy);
+  int numRooms = 15;
+  const char* recordPath = nullptr;
+  const char* replayPath = nullptr;
+  const char* tracePath = nullptr;
+  const char* pathStatsPath = nullptr;
+  const char* loadPath = nullptr;
+  unsigned int threads = 0;
+  HordeConfig horde;
+  bool asyncPaths = false;
+  bool fov = false;
+  bool influence = false;
+  bool caves = false;
+  bool ansi = false;
+  int selfPlayGamesCount = 0;
+  const char* csvPath = nullptr;
+  std::string bot = "greedy";
+  GameRules rules;
+  const char* serveAddress = nullptr;
+  const char* connectAddress = nullptr;
+  int tickMs = 20;
+  long long ticks = 0;
+  int scriptedCount = 0;
+  int seconds = 10;
+  int floors = 1;
+  int analyzeCount = 0;
+  const char* poolPath = nullptr;
+  for (int i = 1; i < argc; i++)
+  {
+    if (std::strcmp(argv[i], "--async-paths") == 0)
+      asyncPaths = true;
+    else if (std::strcmp(argv[i], "--fov") == 0)
+      fov = true;
+    else if (std::strcmp(argv[i], "--influence") == 0)
+      influence = true;
+    else if (std::strcmp(argv[i], "--caves") == 0)
+      caves = true;
+    else if (std::strcmp(argv[i], "--ansi") == 0)
+      ansi = true;
+    else if (i + 1 == argc)
+      break;
+    else if (std::strcmp(argv[i], "--record") == 0)
+      recordPath = argv[++i];
+    else if (std::strcmp(argv[i], "--replay") == 0)
+      replayPath = argv[++i];
+    else if (std::strcmp(argv[i], "--trace") == 0)
+      tracePath = argv[++i];
+    else if (std::strcmp(argv[i], "--path-stats") == 0)
+      pathStatsPath = argv[++i];
+    else if (std::strcmp(argv[i], "--load") == 0)
+      loadPath = argv[++i];
+    else if (std::strcmp(argv[i], "--threads") == 0)
+      threads = static_cast<unsigned int>(std::atoi(argv[++i]));
+    else if (std::strcmp(argv[i], "--horde") == 0)
+      horde.enemies = std::max(std::atoi(argv[++i]), 0);
+    else if (std::strcmp(argv[i], "--selfplay") == 0)
+      selfPlayGamesCount = std::max(std::atoi(argv[++i]), 0);
+    else if (std::strcmp(argv[i], "--bot") == 0)
+      bot = argv[++i];
+    else if (std::strcmp(argv[i], "--csv") == 0)
+      csvPath = argv[++i];
+    else if (std::strcmp(argv[i], "--power-ups") == 0)
+      rules.dashPowerUps = rules.destroyPowerUps = std::max(std::atoi(argv[++i]), 0);
+    else if (std::strcmp(argv[i], "--game-time") == 0)
+      rules.gameTime = std::max(std::atoi(argv[++i]), 1);
+    else if (std::strcmp(argv[i], "--serve") == 0)
+      serveAddress = argv[++i];
+    else if (std::strcmp(argv[i], "--connect") == 0)
+      connectAddress = argv[++i];
+    else if (std::strcmp(argv[i], "--tick") == 0)
+      tickMs = std::max(std::atoi(argv[++i]), 1);
+    else if (std::strcmp(argv[i], "--ticks") == 0)
+      ticks = std::max(std::atoll(argv[++i]), 0LL);
+    else if (std::strcmp(argv[i], "--clients") == 0)
+      scriptedCount = std::max(std::atoi(argv[++i]), 0);
+    else if (std::strcmp(argv[i], "--seconds") == 0)
+      seconds = std::max(std::atoi(argv[++i]), 1);
+    else if (std::strcmp(argv[i], "--floors") == 0)
+      floors = std::max(std::atoi(argv[++i]), 1);
+    else if (std::strcmp(argv[i], "--analyze") == 0)
+      analyzeCount = std::max(std::atoi(argv[++i]), 0);
+    else if (std::strcmp(argv[i], "--pool") == 0)
+      poolPath = argv[++i];
+    else if (std::strcmp(argv[i], "--enemy-delays") == 0 && !parseEnemyDelays(argv[++i], rules))
+    {
+      std::cerr << "--enemy-delays takes five comma separated values" << std::endl;
+      return 1;
+    }
+  }
+
+  // Async searches finish whenever the background thread gets to them
+  if (asyncPaths && (recordPath || replayPath || selfPlayGamesCount > 0))
+  {
+    std::cerr << "--async-paths cannot be combined with --record, --replay or --selfplay" << std::endl;
+    return 1;
+  }
+
+  // Async searches move every due enemy along its path, the horde's sleep,
+  // flow and budget and the FOV and influence rules only apply in sync
+  if (asyncPaths && (horde.enemies > 0 || fov || influence))
+  {
+    std::cerr << "--async-paths cannot be combined with --horde, --fov or --influence" << std::endl;
+    return 1;
+  }
+
+  // A recording starts from a seed, not from a save
+  if (loadPath && (recordPath || replayPath || selfPlayGamesCount > 0))
+  {
+    std::cerr << "--load cannot be combined with --record, --replay or --selfplay" << std::endl;
+    return 1;
+  }
+
+  // The server's clock is the only one, nothing is recorded or restored
+  if ((serveAddress || connectAddress) && (recordPath || replayPath || selfPlayGamesCount > 0 || loadPath))
+  {
+    std::cerr << "--serve and --connect cannot be combined with --record, --replay, --selfplay or --load" << std::endl;
+    return 1;
+  }
+
+  // Levels are only generated and measured, never played
+  if (analyzeCount > 0 && (recordPath || replayPath || selfPlayGamesCount > 0 || serveAddress || connectAddress))
+  {
+    std::cerr << "--analyze cannot be combined with --record, --replay, --selfplay, --serve or --connect" << std::endl;
+    return 1;
+  }
+
+  // Recordings and saves do not carry the rules, a game played with others
+  // could not be replayed
+  if (rules != GameRules{} && selfPlayGamesCount == 0 && !serveAddress && analyzeCount == 0)
+  {
+    std::cerr << "--enemy-delays, --power-ups and --game-time only apply to --selfplay, --serve and --analyze" << std::endl;
+    return 1;
+  }
+
+  // Drawing with escape sequences needs a terminal to send them to
+  if (ansi && !AnsiTerminal::available())
+  {
+    std::cerr << "--ansi needs a POSIX terminal on standard input and output" << std::endl;
+    return 1;
+  }
+
+  if (serveAddress)
+  {
+    ServerConfig config;
+    config.address = serveAddress;
+    config.tickMs = tickMs;
+    config.ticks = ticks;
+    config.width = wx;
+    config.height = wy;
+    config.rooms = numRooms;
+    config.floors = floors;
+    config.seed = std::random_device()();
+    config.threads = threads;
+    config.fov = fov;
+    config.influence = influence;
+    config.caves = caves;
+    config.horde = horde;
+    config.rules = rules;
+    return serveGames(config);
+  }
+
+  if (connectAddress)
+  {
+    return scriptedCount > 0 ? scriptedClients(connectAddress, scriptedCount, seconds) : playOnline(connectAddress, ansi);
+  }
+
+  Snapshot save;
+  if (loadPath && !save.load(loadPath))
+  {
+    std::cerr << "Cannot read save: " << loadPath << std::endl;
+    return 1;
+  }
+  if (asyncPaths && (save.header.horde > 0 || (save.header.modes & (REPLAY_FOV | REPLAY_INFLUENCE)) != 0))
+  {
+    std::cerr << "--async-paths cannot continue a save with a horde, FOV or influence" << std::endl;
+    return 1;
+  }
+
+  if (analyzeCount > 0)
+  {
+    LevelAnalysisConfig config;
+    config.levels = analyzeCount;
+    config.threads = threads;
+    config.width = wx;
+    config.height = wy;
+    config.rooms = numRooms;
+    config.floors = floors;
+    config.caves = caves;
+    config.rules = rules;
+    config.horde = horde;
+    config.pool = poolPath ? poolPath : "";
+    return analyzeGames(config, loadPath ? &save : nullptr, csvPath);
+  }
+
+  if (selfPlayGamesCount > 0)
+  {
+    SelfPlayConfig config;
+    config.bot = bot;
+    config.games = selfPlayGamesCount;
+    config.threads = threads;
+    config.width = wx;
+    config.height = wy;
+    config.rooms = numRooms;
+    config.floors = floors;
+    config.fov = fov;
+    config.influence = influence;
+    config.caves = caves;
+    config.rules = rules;
+    config.horde = horde;
+    return selfPlayGames(config, csvPath);
+  }
+
+  std::ofstream pathStats;
+  if (pathStatsPath)
+  {
+    pathStats.open(pathStatsPath, std::ios::trunc);
+    if (!pathStats)
+    {
+      std::cerr << "Cannot write path stats: " << pathStatsPath << std::endl;
+      return 1;
+    }
+    pathStats << "seed\tscope\tqueries\tfailed\tpushed\tpopped\tmax_open\ttouched\ttotal_us\tmax_us\n";
+  }
+
+  Tracer& tracer = Tracer::instance();
+  tracer.enabled = tracePath != nullptr;
+  if (replayPath)
+  {
+    int result = replayGames(replayPath, threads, pathStatsPath ? &pathStats : nullptr);
+    if (tracePath && !tracer.flush(tracePath))
+    {
+      std::cerr << "Cannot write trace: " << tracePath << std::endl;
+      return 1;
+    }
+    return result;
+  }
+
+  Recorder recorder;
+  if (recordPath && !recorder.open(recordPath, wx, wy, numRooms, horde.enemies, (fov ? REPLAY_FOV : 0) | (influence ? REPLAY_INFLUENCE : 0) | (caves ? REPLAY_CAVES : 0) | REPLAY_ROUTED_TUNNELS, floors))
+  {
+    std::cerr << "Cannot write recording: " << recordPath << std::endl;
+    return 1;
+  }
+
+  // Renders and reads input on its own thread, the engine only publishes
+  Renderer renderer(wx, wy, ansi);
+  std::random_device rd;
+  Engine eng(wx, wy, numRooms, rd(), true, threads);
+  if (horde.enemies > 0)
+  {
+    eng.horde(horde);
+  }
+  if (caves)
+  {
+    eng.caves(true);
+  }
+  if (floors > 1)
+  {
+    eng.floors(floors);
+  }
+  eng.fieldOfView(fov);
+  eng.influence(influence);
+  eng.display(&renderer);
+  eng.asyncPaths(asyncPaths);
+  if (recordPath)
+  {
+    eng.record(&recorder);
+  }
+  eng.collectPathStats(pathStatsPath != nullptr);
+  if (loadPath && !eng.restore(save))
+  {
+    std::cerr << "Save is for another map size or floor count: " << loadPath << std::endl;
+    return 1;
+  }
   while (true)
   {
-    Engine eng(wx, wy, 15);
     eng.gameLoop();
+    if (pathStatsPath)
+    {
+      writePathStats(pathStats, eng);
+    }
+    // The window can be closed at any time, keep the file current per game
+    if (tracePath)
+    {
+      tracer.flush(tracePath);
+    }
+    eng.reset(rd());
   }
-  terminal_close();
   return 0;
 }
@@ -1,6 +1,18 @@
 #pragma once
 
+#include "Caves.hpp"
+#include "Frame.hpp"
+#include "Trace.hpp"
+
 constexpr int ROOM_BUFFER{ 2 };
+// Caves start this much rock, are smoothed this many times and keep pockets
+// of at least this many tiles
+constexpr int CAVE_ROCK_PERCENT{ 45 };
+constexpr int CAVE_STEPS{ 4 };
+constexpr int CAVE_MIN_SIZE{ 24 };
+// Routed tunnels pay this per tile of rock dug and 1 per tile already open,
+// so they follow earlier tunnels instead of running alongside them
+constexpr int TUNNEL_ROCK_COST{ 3 };
 
 enum class TERRAIN : uint8_t
 {
@@ -9,6 +21,38 @@ enum class TERRAIN : uint8_t
   ROCK,
   TUNNEL,
   BOMBED,
+  STAIRS_UP,
+  STAIRS_DOWN,
+};
+
+// How each terrain is drawn, in the order of TERRAIN. NONE has no colour
+// and keeps whatever the tile showed before.
+struct TerrainLook
+{
+  char sym;
+  const char* color;
+};
+
+constexpr TerrainLook TERRAIN_LOOKS[]{
+  { ' ', nullptr },
+  { ',', "darker grey" },
+  { '#', "grey" },
+  { ',', "darker grey" },
+  { '.', "darker grey" },
+  { '<', "amber" },
+  { '>', "amber" },
+};
+static_assert(std::size(TERRAIN_LOOKS) == static_cast<size_t>(TERRAIN::STAIRS_DOWN) + 1, "every terrain needs a look");
+
+// The terrain colours looked up by name once, for drawing a whole map
+class TerrainPalette
+{
+public:
+  TerrainPalette();
+  void look(TERRAIN terrain, color_t& color, char& sym) const;
+
+private:
+  color_t m_colors[std::size(TERRAIN_LOOKS)]{};
 };
 
 struct Edge
@@ -61,23 +105,59 @@ public:
   std::vector<std::vector<Point>> board;
   int map_w;
   int map_h;
-  Map(int mw, int mh);
+  std::mt19937 gen;
+  std::pmr::memory_resource* arena;
+  // Bumped by every terrain change after generation, results computed on
+  // an older revision may be out of date
+  unsigned int revision{};
+  // Tunnels between rooms are routed around other rooms along the cheapest
+  // tiles, otherwise dug straight from centre to centre
+  bool routedTunnels{ true };
+  Map(int mw, int mh, std::pmr::memory_resource* mr = std::pmr::get_default_resource());
   Map() {}
+  void reset(unsigned int seed);
   bool inBounds(int x, int y) const;
   void Dig(int sx, int sy, int w, int h, TERRAIN terr);
   void makeRooms(int numRooms);
-  void tunnel(std::vector<Rect>& rooms);
-  void render() const;
+  void makeCaves();
+  void tunnel(std::pmr::vector<Rect>& rooms);
+  void render(Frame& frame) const;
+  Point find(TERRAIN terrain) const;
   Point getStartCoords(bool isPlayer);
   Point getRandomCoords();
 private:
+  // Where two rooms grown over the rock meet, and what a tunnel through
+  // tiles p and q costs
+  struct Link
+  {
+    int a, b;
+    int cost;
+    int p, q;
+  };
+
+  // Tunnel routing state per tile, row by row, kept between levels so a
+  // new level does not allocate it again
+  std::vector<uint8_t> m_step;
+  std::vector<int> m_owner;
+  std::vector<int> m_cost;
+  std::vector<int> m_from;
+  std::vector<int> m_buckets[TUNNEL_ROCK_COST + 1];
+  std::vector<Link> m_links;
+  std::vector<std::vector<int>> m_meets;
+  std::vector<int> m_group;
+
   void createTunnel(Rect& start, Rect& fin);
+  void routeTunnels(std::pmr::vector<Rect>& rooms);
+  void growRooms(const std::pmr::vector<Rect>& rooms);
+  void digRoute(int tile);
+  int group(int room);
 };
 
-Map::Map(int mw, int mh)
+Map::Map(int mw, int mh, std::pmr::memory_resource* mr)
 {
   map_w = mw;
   map_h = mh;
+  arena = mr;
   board.resize(mh, std::vector<Point>(mw));
   for (int y = 0; y < mh; y++)
   {
@@ -88,6 +168,20 @@ Map::Map(int mw, int mh)
   }
 }
 
+// Refills the existing board with rock, no rows are reallocated
+void Map::reset(unsigned int seed)
+{
+  gen.seed(seed);
+  revision++;
+  for (int y = 0; y < map_h; y++)
+  {
+    for (int x = 0; x < map_w; x++)
+    {
+      board[y][x] = Point(x, y, true, TERRAIN::ROCK);
+    }
+  }
+}
+
 //verifies a given coordinate is on the map
 bool Map::inBounds(int x, int y) const
 {
@@ -130,16 +224,17 @@ bool overlaps(Rect a, Rect b)
 
 void Map::makeRooms(int numRooms)
 {
+  TraceScope trace("makeRooms");
   const unsigned int MAX_SIZE = 12;
-  std::random_device rd;
-  std::mt19937 gen(rd());
   std::uniform_int_distribution<int> randRoomSize(6, MAX_SIZE);
   std::uniform_int_distribution<int> randRoomX(3, map_w - MAX_SIZE - 3);
   std::uniform_int_distribution<int> randRoomY(3, map_h - MAX_SIZE - 3);
   int left{}, top{}, right{}, bottom{}, roomWidth{}, roomHeight{}, roomSize{};
   Rect room;
-  std::vector<Rect> rooms;
-  while (rooms.size() < numRooms)
+  std::pmr::vector<Rect> rooms(arena);
+  // Some layouts leave no room for the last rooms, give up instead of spinning
+  int attempts = numRooms * 1000;
+  while (rooms.size() < numRooms && attempts-- > 0)
   {
     roomSize = randRoomSize(gen);
     left = randRoomX(gen);
@@ -165,16 +260,45 @@ void Map::makeRooms(int numRooms)
         rooms.push_back(room);
       }
     }
-    for (auto& r : rooms)
-      Dig(r.left, r.top, r.right, r.bottom, TERRAIN::CAVE);
   }
+  for (auto& r : rooms)
+    Dig(r.left, r.top, r.right, r.bottom, TERRAIN::CAVE);
   tunnel(rooms);
 }
 
-void Map::tunnel(std::vector<Rect>& rooms)
+// Organic caves instead of rooms: random rock worn down by a cellular
+// automaton, then pockets filled and the caves tunnelled together
+void Map::makeCaves()
 {
+  TraceScope trace("makeCaves");
+  CaveGrid caves(map_w, map_h, arena);
+  caves.fill(gen, CAVE_ROCK_PERCENT);
+  for (int i = 0; i < CAVE_STEPS; i++)
+  {
+    caves.smooth();
+  }
+  if (caves.connect(CAVE_MIN_SIZE) == 0)
+  {
+    // Nothing survived on a tiny map, leave the players a room
+    Dig(map_w / 2 - 3, map_h / 2 - 3, map_w / 2 + 3, map_h / 2 + 3, TERRAIN::CAVE);
+    return;
+  }
+  caves.forEachFloor([this](int x, int y) {
+    board[y][x].blocking = false;
+    board[y][x].terrain = TERRAIN::CAVE;
+  });
+}
+
+void Map::tunnel(std::pmr::vector<Rect>& rooms)
+{
+  if (routedTunnels)
+  {
+    routeTunnels(rooms);
+    return;
+  }
+
   auto n = static_cast<int>(rooms.size());
-  std::vector<std::vector<std::pair<int, double>>> adj(n);
+  std::pmr::vector<std::pmr::vector<std::pair<int, double>>> adj(n, arena);
 
   // Step 1: Create a graph
   for (int i = 0; i < n; ++i)
@@ -188,8 +312,9 @@ void Map::tunnel(std::vector<Rect>& rooms)
   }
 
   // Step 2: Use Prim's algorithm to find the MST
-  std::vector<bool> visited(n, false);
-  std::priority_queue<Edge> pq;
+  TraceScope mstTrace("mst");
+  std::pmr::vector<bool> visited(n, false, arena);
+  std::priority_queue<Edge, std::pmr::vector<Edge>> pq{ std::less<Edge>(), std::pmr::vector<Edge>(arena) };
   pq.push(Edge(-1, 0, 0.0)); // start from the first room
 
   while (!pq.empty())
@@ -215,21 +340,25 @@ void Map::tunnel(std::vector<Rect>& rooms)
     }
   }
 
+  mstTrace.stop();
+
   // Step 4: Add some additional random edges
-  std::random_device rd;
-  std::mt19937 gen(rd());
+  TraceScope edgeTrace("extraEdges");
   std::uniform_int_distribution<> dis(0, n - 1);
 
   int extraEdges = n * 3 / 4;
-  for (int i = 0; i < extraEdges; ++i)
+  int attempts = extraEdges * 100;
+  std::pmr::vector<bool> bfsVisited(n, false, arena);
+  std::queue<int, std::pmr::deque<int>> q{ std::pmr::deque<int>(arena) };
+  for (int i = 0; i < extraEdges && attempts > 0; ++i, --attempts)
   {
     int u = dis(gen);
     int v = dis(gen);
     if (u != v)
     {
       // Use BFS to find the shortest path
-      std::vector<bool> visited(n, false);
-      std::queue<int> q;
+      std::fill(bfsVisited.begin(), bfsVisited.end(), false);
+      while (!q.empty()) q.pop();
       q.push(u);
       int pathLength = 0;
 
@@ -238,13 +367,13 @@ void Map::tunnel(std::vector<Rect>& rooms)
         int current = q.front();
         q.pop();
         if (current == v) break;
-        if (visited[current]) continue;
-        visited[current] = true;
+        if (bfsVisited[current]) continue;
+        bfsVisited[current] = true;
         pathLength++;
 
         for (auto& [next, w] : adj[current])
         {
-          if (!visited[next])
+          if (!bfsVisited[next])
           {
             q.push(next);
           }
@@ -319,37 +448,289 @@ void Map::createTunnel(Rect& start, Rect& fin)
   }
 }
 
-void Map::render() const
+// Joins the rooms in one search that grows every room at once. A minimum
+// spanning tree over where they meet is tunnelled first, so no tunnel
+// crosses another room, then the cheapest shortcuts between rooms more than
+// two tunnels apart. Tunnels leaving the same room share the search's paths
+// for as long as they run the same way.
+void Map::routeTunnels(std::pmr::vector<Rect>& rooms)
+{
+  auto n = static_cast<int>(rooms.size());
+  if (n < 2)
+    return;
+
+  // What growing onto each tile costs, 0 on the edge of the map so the
+  // search never needs a bounds check
+  m_step.assign(static_cast<size_t>(map_w) * static_cast<size_t>(map_h), 0);
+  for (int y = 1; y < map_h - 1; y++)
+  {
+    for (int x = 1; x < map_w - 1; x++)
+    {
+      m_step[static_cast<size_t>(y * map_w + x)] = board[y][x].blocking ? TUNNEL_ROCK_COST : 1;
+    }
+  }
+
+  std::pmr::vector<std::pmr::vector<int>> joined(n, std::pmr::vector<int>(arena), arena);
+  auto dig = [&](const Link& link) {
+    digRoute(link.p);
+    digRoute(link.q);
+    joined[link.a].push_back(link.b);
+    joined[link.b].push_back(link.a);
+  };
+
+  TraceScope mstTrace("mst");
+  growRooms(rooms);
+  for (int i = 0; i < n; i++)
+  {
+    m_group[static_cast<size_t>(i)] = i;
+  }
+  for (const Link& link : m_links)
+  {
+    int a = group(link.a);
+    int b = group(link.b);
+    if (a != b)
+    {
+      m_group[static_cast<size_t>(a)] = b;
+      dig(link);
+    }
+  }
+  mstTrace.stop();
+
+  TraceScope edgeTrace("extraEdges");
+  int extraEdges = n * 3 / 4;
+  std::pmr::vector<int> hops(n, 0, arena);
+  std::queue<int, std::pmr::deque<int>> q{ std::pmr::deque<int>(arena) };
+  for (size_t i = 0; i < m_links.size() && extraEdges > 0; i++)
+  {
+    // Rooms at most two tunnels apart are close enough already
+    const Link& link = m_links[i];
+    std::fill(hops.begin(), hops.end(), -1);
+    while (!q.empty()) q.pop();
+    hops[link.a] = 0;
+    q.push(link.a);
+    while (!q.empty() && hops[link.b] < 0)
+    {
+      int room = q.front();
+      q.pop();
+      for (int next : joined[room])
+      {
+        if (hops[next] < 0 && hops[room] < 2)
+        {
+          hops[next] = hops[room] + 1;
+          q.push(next);
+        }
+      }
+    }
+    if (hops[link.b] < 0)
+    {
+      dig(link);
+      extraEdges--;
+    }
+  }
+}
+
+// Grows every room over the map at once, cheapest tile first with a bucket
+// per cost: each tile gets the room reaching it cheapest, that cost and the
+// tile it was reached from. Where two rooms meet is noted as the search
+// goes, the links are the cheapest meeting point of every two rooms that
+// met, cheapest link first.
+void Map::growRooms(const std::pmr::vector<Rect>& rooms)
+{
+  const size_t tiles = static_cast<size_t>(map_w) * static_cast<size_t>(map_h);
+  m_owner.assign(tiles, -1);
+  m_cost.assign(tiles, std::numeric_limits<int>::max());
+  m_from.assign(tiles, -1);
+  m_links.clear();
+  for (auto& bucket : m_buckets)
+  {
+    bucket.clear();
+  }
+  m_group.resize(rooms.size());
+  m_meets.resize(rooms.size());
+  for (size_t r = 0; r < rooms.size(); r++)
+  {
+    m_group[r] = static_cast<int>(r);
+    m_meets[r].clear();
+  }
+
+  int* owner = m_owner.data();
+  int* cost = m_cost.data();
+  int* from = m_from.data();
+  const uint8_t* step = m_step.data();
+  size_t pending = 0;
+  for (int r = 0; r < static_cast<int>(rooms.size()); r++)
+  {
+    // Only the edge of a room can grow, the tiles inside just belong to it
+    const Rect& room = rooms[r];
+    int left = std::max(room.left, 1);
+    int right = std::min(room.right, map_w - 1);
+    int top = std::max(room.top, 1);
+    int bottom = std::min(room.bottom, map_h - 1);
+    for (int y = top; y < bottom; y++)
+    {
+      for (int x = left; x < right; x++)
+      {
+        int tile = y * map_w + x;
+        owner[tile] = r;
+        cost[tile] = 0;
+        if (y == top || y == bottom - 1 || x == left || x == right - 1)
+        {
+          m_buckets[0].push_back(tile);
+          pending++;
+        }
+      }
+    }
+  }
+
+  // A room only meets a few others, a short list of them per room is enough
+  // to keep the cheapest link of every two
+  int apart = static_cast<int>(rooms.size());
+  auto meet = [&](int p, int q) {
+    Link link{ std::min(owner[p], owner[q]), std::max(owner[p], owner[q]), cost[p] + cost[q], p, q };
+    auto& met = m_meets[static_cast<size_t>(link.a)];
+    auto known = std::find_if(met.begin(), met.end(), [&](int i) { return m_links[static_cast<size_t>(i)].b == link.b; });
+    if (known == met.end())
+    {
+      met.push_back(static_cast<int>(m_links.size()));
+      m_links.push_back(link);
+      int a = group(link.a);
+      int b = group(link.b);
+      if (a != b)
+      {
+        m_group[static_cast<size_t>(a)] = b;
+        apart--;
+      }
+    }
+    else if (link.cost < m_links[static_cast<size_t>(*known)].cost)
+    {
+      m_links[static_cast<size_t>(*known)] = link;
+    }
+  };
+
+  // Every room has met the others, directly or not, once apart is 1.
+  // Growing half as far again finds the meetings shortcuts are made of,
+  // the rest of the map is never searched.
+  const int offsets[] = { -map_w, -1, 1, map_w };
+  constexpr int BUCKETS = TUNNEL_ROCK_COST + 1;
+  int stop = std::numeric_limits<int>::max();
+  for (int c = 0; pending > 0 && c < stop; c++)
+  {
+    if (apart == 1 && stop == std::numeric_limits<int>::max())
+    {
+      stop = c + c / 2 + 1;
+    }
+    // Steps cost less than there are buckets, so tiles only ever go into
+    // the ones after this
+    auto& bucket = m_buckets[c % BUCKETS];
+    for (size_t i = 0; i < bucket.size(); i++)
+    {
+      int tile = bucket[i];
+      if (cost[tile] != c)
+        continue;
+
+      for (int offset : offsets)
+      {
+        int n = tile + offset;
+        if (step[n] == 0)
+          continue;
+
+        // A neighbour that costs no more is final, so is where they meet
+        int nc = c + step[n];
+        if (cost[n] <= c)
+        {
+          if (owner[n] != owner[tile])
+            meet(tile, n);
+          continue;
+        }
+        if (nc >= cost[n])
+          continue;
+
+        cost[n] = nc;
+        owner[n] = owner[tile];
+        from[n] = tile;
+        m_buckets[nc % BUCKETS].push_back(n);
+        pending++;
+      }
+    }
+    pending -= bucket.size();
+    bucket.clear();
+  }
+  std::stable_sort(m_links.begin(), m_links.end(), [](const Link& l, const Link& r) { return l.cost < r.cost; });
+}
+
+// Rooms joined so far share a group, by meeting while they grow and then
+// by tunnels
+int Map::group(int room)
+{
+  while (m_group[static_cast<size_t>(room)] != room)
+  {
+    room = m_group[static_cast<size_t>(room)] = m_group[static_cast<size_t>(m_group[static_cast<size_t>(room)])];
+  }
+  return room;
+}
+
+// Opens the tiles from tile back to the room it was reached from
+void Map::digRoute(int tile)
 {
+  for (; m_from[static_cast<size_t>(tile)] >= 0; tile = m_from[static_cast<size_t>(tile)])
+  {
+    Point& point = board[tile / map_w][tile % map_w];
+    if (point.blocking)
+    {
+      point.blocking = false;
+      point.terrain = TERRAIN::TUNNEL;
+    }
+  }
+}
+
+void Map::render(Frame& frame) const
+{
+  TerrainPalette palette;
   char terrsym{};
+  color_t color{};
   for (int y = 0; y < map_h; y++)
   {
     for (int x = 0; x < map_w; x++)
     {
-      switch (board[y][x].terrain)
-      {
-        case TERRAIN::ROCK:
-          terminal_color(color_from_name("grey"));
-          terrsym = '#';
-          break;
-        case TERRAIN::CAVE:
-          terminal_color(color_from_name("darker grey"));
-          terrsym = ',';
-          break;
-        case TERRAIN::TUNNEL:
-          terminal_color(color_from_name("darker grey"));
-          terrsym = ',';
-          break;
-        case TERRAIN::BOMBED:
-          terminal_color(color_from_name("darker grey"));
-          terrsym = '.';
-          break;
-        default:
-          break;
-      }
-      terminal_put(x, y, terrsym);
+      palette.look(board[y][x].terrain, color, terrsym);
+      frame.tile(x, y, color, terrsym);
+    }
+  }
+}
+
+TerrainPalette::TerrainPalette()
+{
+  for (size_t i = 0; i < std::size(TERRAIN_LOOKS); i++)
+  {
+    if (TERRAIN_LOOKS[i].color)
+    {
+      m_colors[i] = color_from_name(TERRAIN_LOOKS[i].color);
+    }
+  }
+}
+
+void TerrainPalette::look(TERRAIN terrain, color_t& color, char& sym) const
+{
+  auto i = static_cast<size_t>(terrain);
+  if (i < std::size(TERRAIN_LOOKS) && TERRAIN_LOOKS[i].color)
+  {
+    color = m_colors[i];
+    sym = TERRAIN_LOOKS[i].sym;
+  }
+}
+
+// First tile of terrain in row order, (-1, -1) when there is none
+Point Map::find(TERRAIN terrain) const
+{
+  for (int y = 0; y < map_h; y++)
+  {
+    for (int x = 0; x < map_w; x++)
+    {
+      if (board[y][x].terrain == terrain)
+        return Point(x, y);
     }
   }
+  return Point(-1, -1);
 }
 
 Point Map::getStartCoords(bool isPlayer)
@@ -394,8 +775,6 @@ Point Map::getStartCoords(bool isPlayer)
 Point Map::getRandomCoords()
 {
   Point p;
-  std::random_device rd;
-  std::mt19937 gen(rd());
   std::uniform_int_distribution<int> randX(3, map_w - 4);
   std::uniform_int_distribution<int> randY(3, map_h - 4);
   int x = randX(gen);
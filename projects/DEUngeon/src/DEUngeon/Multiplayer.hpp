@@ -0,0 +1,525 @@
+#pragma once
+
+#include "Sync.hpp"
+
+// Every message starts with its type:
+//   WELCOME : server, version slot width height tick_ms
+//   TICK    : server, tick, 1 and a checksum of the world after this tick
+//             or 0, the world delta, then the player's own counters
+//   INPUT   : client, a key for its player
+// A new client gets WELCOME and a TICK with the whole world, then the same
+// delta as everyone else each tick.
+constexpr uint64_t NET_VERSION{ 1 };
+
+enum class NetMessage : uint8_t
+{
+  WELCOME,
+  TICK,
+  INPUT
+};
+
+// Counters only the player they belong to sees. Sent as a mask of what
+// changed since the last tick, then those values.
+struct PlayerHud
+{
+  static constexpr uint8_t DASHES{ 1 };
+  static constexpr uint8_t DESTROYS{ 2 };
+  static constexpr uint8_t CAUGHT{ 4 };
+
+  int dashes{ -1 };
+  int destroys{ -1 };
+  bool caught{};
+
+  void encode(const PlayerHud& base, ByteWriter& out) const;
+  bool apply(ByteReader& in);
+};
+
+struct ServerConfig
+{
+  std::string address;
+  int tickMs{ 20 };
+  long long ticks{};
+  int restartMs{ 3000 };
+  int checkInterval{ 50 };
+  int maxClients{ 64 };
+  size_t maxPending{ 1u << 20 };
+  int width{ 100 };
+  int height{ 50 };
+  int rooms{ 15 };
+  int floors{ 1 };
+  unsigned int seed{};
+  unsigned int threads{};
+  bool fov{};
+  bool influence{};
+  bool caves{};
+  HordeConfig horde;
+  GameRules rules;
+};
+
+struct ServerStats
+{
+  long long ticks{};
+  long long joins{};
+  long long drops{};
+  size_t peakClients{};
+  long long bytesQueued{};
+  long long deltaBytes{};
+  long long totalTickUs{};
+  long long maxTickUs{};
+};
+
+// The authoritative game. Runs the engine at a fixed tick, one player per
+// connected client, and sends each the shared world delta plus its own
+// counters. Sockets never block, a client that stops reading is dropped
+// once too much is queued for it.
+class GameServer
+{
+public:
+  explicit GameServer(const ServerConfig& config);
+  bool listen();
+  void run();
+  void tick();
+  size_t clients() const;
+  const ServerStats& stats() const;
+
+private:
+  struct Client
+  {
+    Connection connection;
+    int slot{};
+    bool welcomed{};
+    bool gone{};
+    PlayerHud hud;
+  };
+
+  ServerConfig m_config;
+  Engine m_engine;
+  Socket m_listener;
+  std::vector<Client> m_clients;
+  WorldMirror m_world;
+  WorldMirror m_sent;
+  std::mt19937 m_seeds;
+  long long m_stoppedTicks{};
+  ServerStats m_stats;
+
+  void acceptClients();
+  void readInputs();
+  void simulate();
+  void nextLevel();
+  void broadcast();
+  void dropClients();
+};
+
+// The other end: mirrors the server's world from its deltas and sends keys
+class GameClient
+{
+public:
+  int slot{ -1 };
+  int tickMs{};
+  WorldMirror world;
+  PlayerHud hud;
+  long long ticks{};
+  long long bytes{};
+  long long checks{};
+  long long mismatches{};
+
+  bool connect(const std::string& address, int timeoutMs = 5000);
+  bool poll();
+  bool wait(int timeoutMs);
+  void send(int key);
+  void render(Frame& frame) const;
+
+private:
+  Connection m_connection;
+  std::vector<uint8_t> m_message;
+
+  bool handle(const std::vector<uint8_t>& message);
+};
+
+void PlayerHud::encode(const PlayerHud& base, ByteWriter& out) const
+{
+  uint8_t mask = (dashes != base.dashes ? DASHES : 0) | (destroys != base.destroys ? DESTROYS : 0)
+    | (caught != base.caught ? CAUGHT : 0);
+  out.u8(mask);
+  if (mask & DASHES)
+  {
+    out.varint(static_cast<uint64_t>(dashes));
+  }
+  if (mask & DESTROYS)
+  {
+    out.varint(static_cast<uint64_t>(destroys));
+  }
+  if (mask & CAUGHT)
+  {
+    out.u8(caught ? 1 : 0);
+  }
+}
+
+bool PlayerHud::apply(ByteReader& in)
+{
+  uint8_t mask{};
+  uint64_t value{};
+  if (!in.u8(mask))
+    return false;
+
+  if (mask & DASHES)
+  {
+    if (!in.varint(value))
+      return false;
+    dashes = static_cast<int>(value);
+  }
+  if (mask & DESTROYS)
+  {
+    if (!in.varint(value))
+      return false;
+    destroys = static_cast<int>(value);
+  }
+  if (mask & CAUGHT)
+  {
+    uint8_t flag{};
+    if (!in.u8(flag))
+      return false;
+    caught = flag != 0;
+  }
+  return true;
+}
+
+// The level waits without players; the first client to join starts it
+GameServer::GameServer(const ServerConfig& config)
+  : m_config(config)
+  , m_engine(config.width, config.height, config.rooms, config.seed, true, config.threads)
+  , m_seeds(config.seed)
+{
+  m_config.tickMs = std::max(m_config.tickMs, 1);
+  m_config.checkInterval = std::max(m_config.checkInterval, 1);
+  if (m_config.caves)
+  {
+    m_engine.caves(true);
+  }
+  if (m_config.horde.enemies > 0)
+  {
+    m_engine.horde(m_config.horde);
+  }
+  if (m_config.floors > 1)
+  {
+    m_engine.floors(m_config.floors);
+  }
+  m_engine.rules(m_config.rules);
+  m_engine.fieldOfView(m_config.fov);
+  m_engine.influence(m_config.influence);
+  m_engine.leave(0);
+}
+
+bool GameServer::listen()
+{
+  m_listener = Socket::listen(m_config.address);
+  return m_listener.valid();
+}
+
+// Ticks on the wall clock until the configured number of ticks, or for
+// ever. A tick that runs late starts the next one at once but the server
+// does not try to catch up on the ones it missed.
+void GameServer::run()
+{
+  auto period = std::chrono::milliseconds(m_config.tickMs);
+  auto next = std::chrono::steady_clock::now();
+  while (m_config.ticks == 0 || m_stats.ticks < m_config.ticks)
+  {
+    tick();
+    next += period;
+    auto now = std::chrono::steady_clock::now();
+    if (next < now)
+    {
+      next = now;
+    }
+    std::this_thread::sleep_until(next);
+  }
+}
+
+void GameServer::tick()
+{
+  auto start = std::chrono::steady_clock::now();
+  acceptClients();
+  readInputs();
+  simulate();
+  broadcast();
+  dropClients();
+
+  auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+  m_stats.ticks++;
+  m_stats.totalTickUs += elapsed;
+  m_stats.maxTickUs = std::max(m_stats.maxTickUs, static_cast<long long>(elapsed));
+}
+
+size_t GameServer::clients() const
+{
+  return m_clients.size();
+}
+
+const ServerStats& GameServer::stats() const
+{
+  return m_stats;
+}
+
+void GameServer::acceptClients()
+{
+  for (Socket s = m_listener.accept(); s.valid(); s = m_listener.accept())
+  {
+    if (m_clients.size() >= static_cast<size_t>(m_config.maxClients))
+      continue;
+
+    Client client;
+    client.connection = Connection(std::move(s));
+    client.slot = m_engine.join();
+    m_clients.push_back(std::move(client));
+    m_stats.joins++;
+    m_stats.peakClients = std::max(m_stats.peakClients, m_clients.size());
+  }
+}
+
+void GameServer::readInputs()
+{
+  std::vector<uint8_t> message;
+  for (Client& client : m_clients)
+  {
+    if (!client.connection.receive())
+    {
+      client.gone = true;
+    }
+    while (client.connection.next(message))
+    {
+      ByteReader in(message.data(), message.size());
+      uint8_t type{};
+      uint64_t key{};
+      if (in.u8(type) && type == static_cast<uint8_t>(NetMessage::INPUT) && in.varint(key))
+      {
+        m_engine.press(client.slot, static_cast<int>(key));
+      }
+    }
+    if (client.connection.broken())
+    {
+      client.gone = true;
+    }
+  }
+}
+
+// Nothing moves while nobody plays. A finished level stays on screen for
+// a moment before the next one.
+void GameServer::simulate()
+{
+  if (m_clients.empty())
+    return;
+
+  switch (m_engine.getState())
+  {
+    case GameState::PAUSED:
+      m_engine.step(TK_ENTER, 0);
+      break;
+    case GameState::RUNNING:
+      m_engine.step(0, m_config.tickMs);
+      break;
+    case GameState::STOPPED:
+      if (++m_stoppedTicks * m_config.tickMs >= m_config.restartMs)
+      {
+        nextLevel();
+      }
+      break;
+  }
+}
+
+// A level brings back every slot, slots whose client has left go again
+void GameServer::nextLevel()
+{
+  m_stoppedTicks = 0;
+  m_engine.reset(m_seeds());
+  std::vector<bool> taken(m_engine.getPlayers().size(), false);
+  for (const Client& client : m_clients)
+  {
+    taken[static_cast<size_t>(client.slot)] = true;
+  }
+  for (size_t slot = taken.size(); slot-- > 0;)
+  {
+    if (!taken[slot])
+    {
+      m_engine.leave(static_cast<int>(slot));
+    }
+  }
+}
+
+// The delta is encoded once for everyone, only the player counters differ
+// per client
+void GameServer::broadcast()
+{
+  m_world.capture(m_engine);
+  bool check = m_stats.ticks % m_config.checkInterval == 0;
+  ByteWriter delta;
+  delta.u8(static_cast<uint8_t>(NetMessage::TICK));
+  delta.varint(static_cast<uint64_t>(m_stats.ticks));
+  delta.u8(check ? 1 : 0);
+  if (check)
+  {
+    delta.varint(m_world.checksum());
+  }
+  m_world.encode(m_sent, delta);
+  m_stats.deltaBytes += static_cast<long long>(delta.bytes.size());
+
+  ByteWriter full;
+  const std::vector<Player>& players = m_engine.getPlayers();
+  for (Client& client : m_clients)
+  {
+    size_t before = client.connection.pending();
+    if (!client.welcomed)
+    {
+      ByteWriter welcome;
+      welcome.u8(static_cast<uint8_t>(NetMessage::WELCOME));
+      welcome.varint(NET_VERSION);
+      welcome.varint(static_cast<uint64_t>(client.slot));
+      welcome.varint(static_cast<uint64_t>(m_world.width));
+      welcome.varint(static_cast<uint64_t>(m_world.height));
+      welcome.varint(static_cast<uint64_t>(m_config.tickMs));
+      client.connection.queue(welcome.bytes);
+
+      // Clients that join on the same tick share the encoding
+      if (full.bytes.empty())
+      {
+        full.u8(static_cast<uint8_t>(NetMessage::TICK));
+        full.varint(static_cast<uint64_t>(m_stats.ticks));
+        full.u8(1);
+        full.varint(m_world.checksum());
+        m_world.encode(WorldMirror(), full);
+      }
+    }
+
+    const Player& player = players[static_cast<size_t>(client.slot)];
+    PlayerHud hud{ player.dashes, player.destroys, player.caught };
+    ByteWriter own;
+    hud.encode(client.hud, own);
+    client.hud = hud;
+    client.connection.queue(client.welcomed ? delta.bytes : full.bytes, own.bytes);
+    client.welcomed = true;
+    m_stats.bytesQueued += static_cast<long long>(client.connection.pending() - before);
+
+    if (!client.connection.flush() || client.connection.pending() > m_config.maxPending)
+    {
+      client.gone = true;
+    }
+  }
+  m_sent = m_world;
+}
+
+void GameServer::dropClients()
+{
+  for (size_t i = m_clients.size(); i-- > 0;)
+  {
+    if (m_clients[i].gone)
+    {
+      m_engine.leave(m_clients[i].slot);
+      m_clients.erase(m_clients.begin() + static_cast<std::ptrdiff_t>(i));
+      m_stats.drops++;
+    }
+  }
+}
+
+// Connects and waits for the server to hand out a player
+bool GameClient::connect(const std::string& address, int timeoutMs)
+{
+  m_connection = Connection(Socket::connect(address));
+  if (!m_connection.socket.valid())
+    return false;
+
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+  while (slot < 0)
+  {
+    if (std::chrono::steady_clock::now() >= deadline || !poll())
+      return false;
+    wait(10);
+  }
+  return true;
+}
+
+// Applies everything that has arrived, false once the server is gone or
+// sent something this client cannot read
+bool GameClient::poll()
+{
+  if (!m_connection.receive())
+    return false;
+
+  while (m_connection.next(m_message))
+  {
+    bytes += static_cast<long long>(m_message.size());
+    if (!handle(m_message))
+      return false;
+  }
+  return !m_connection.broken() && m_connection.flush();
+}
+
+bool GameClient::wait(int timeoutMs)
+{
+  return m_connection.socket.wait(timeoutMs);
+}
+
+void GameClient::send(int key)
+{
+  ByteWriter input;
+  input.u8(static_cast<uint8_t>(NetMessage::INPUT));
+  input.varint(static_cast<uint64_t>(key));
+  m_connection.queue(input.bytes);
+  m_connection.flush();
+}
+
+bool GameClient::handle(const std::vector<uint8_t>& message)
+{
+  ByteReader in(message.data(), message.size());
+  uint8_t type{};
+  if (!in.u8(type))
+    return false;
+
+  if (type == static_cast<uint8_t>(NetMessage::WELCOME))
+  {
+    uint64_t version{}, s{}, w{}, h{}, t{};
+    if (!in.varint(version) || version != NET_VERSION || !in.varint(s) || !in.varint(w) || !in.varint(h) || !in.varint(t))
+      return false;
+
+    slot = static_cast<int>(s);
+    tickMs = static_cast<int>(t);
+    world = WorldMirror();
+    world.resize(static_cast<int>(w), static_cast<int>(h));
+    hud = PlayerHud();
+    return true;
+  }
+  if (type != static_cast<uint8_t>(NetMessage::TICK) || slot < 0)
+    return false;
+
+  uint64_t tick{}, checksum{};
+  uint8_t check{};
+  if (!in.varint(tick) || !in.u8(check) || (check && !in.varint(checksum)) || !world.apply(in) || !hud.apply(in))
+    return false;
+
+  ticks++;
+  if (check)
+  {
+    checks++;
+    mismatches += world.checksum() != checksum ? 1 : 0;
+  }
+  return true;
+}
+
+// The world, with this player's counters where the engine puts its own
+void GameClient::render(Frame& frame) const
+{
+  frame.clear();
+  world.render(frame);
+  frame.print(0, 0, color_from_name("white"), "Time: " + std::to_string(world.gameTime));
+  frame.print(0, world.height - 2, color_from_name("white"),
+              "Dashes: " + std::to_string(hud.dashes) + ", Destroys: " + std::to_string(hud.destroys));
+  std::string state = world.state == GameState::RUNNING ? "RUNNING" : world.state == GameState::PAUSED ? "WAITING" : "STOPPED";
+  frame.print(0, world.height - 1, color_from_name("white"), "Player " + std::to_string(slot + 1) + " - State: " + state);
+  if (hud.caught)
+  {
+    frame.print(0, 1, color_from_name("red"), "CAUGHT! Waiting for the next level");
+  }
+  else if (world.state == GameState::STOPPED)
+  {
+    frame.print(0, 1, color_from_name("green"), world.gameTime == 0 ? "GAME OVER! YOU WON!" : "GAME OVER!");
+  }
+}
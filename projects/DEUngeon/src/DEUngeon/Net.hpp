@@ -0,0 +1,547 @@
+#pragma once
+
+// Sockets are the one part of the game that differs per platform: Winsock
+// on Windows, BSD sockets everywhere else. Addresses are "host:port" for
+// TCP or "unix:<path>" for a Unix domain socket where there are those.
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "Ws2_32.lib")
+#else
+#include <arpa/inet.h>
+#include <cerrno>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+// Appends integers as LEB128 varints, signed ones zigzag encoded first
+class ByteWriter
+{
+public:
+  std::vector<uint8_t> bytes;
+
+  void u8(uint8_t value);
+  void varint(uint64_t value);
+  void svarint(long long value);
+  void append(const std::vector<uint8_t>& other);
+};
+
+// Reads what ByteWriter wrote. Every read fails once the data runs out.
+class ByteReader
+{
+public:
+  ByteReader(const uint8_t* data, size_t size);
+
+  bool u8(uint8_t& value);
+  bool varint(uint64_t& value);
+  bool svarint(long long& value);
+  bool done() const;
+  size_t offset() const;
+
+private:
+  const uint8_t* m_data;
+  size_t m_size;
+  size_t m_pos{};
+};
+
+// A non-blocking socket, closed with the object
+class Socket
+{
+public:
+#ifdef _WIN32
+  using Handle = SOCKET;
+  static constexpr Handle INVALID{ INVALID_SOCKET };
+#else
+  using Handle = int;
+  static constexpr Handle INVALID{ -1 };
+#endif
+
+  Socket() = default;
+  Socket(const Socket&) = delete;
+  Socket& operator=(const Socket&) = delete;
+  Socket(Socket&& other) noexcept;
+  Socket& operator=(Socket&& other) noexcept;
+  ~Socket();
+
+  static Socket listen(const std::string& address);
+  static Socket connect(const std::string& address);
+  Socket accept();
+  bool valid() const;
+  long long send(const uint8_t* data, size_t size);
+  long long receive(uint8_t* data, size_t size);
+  bool wait(int timeoutMs);
+  void close();
+
+private:
+  Handle m_handle{ INVALID };
+  std::string m_unixPath;
+
+  explicit Socket(Handle handle);
+  static bool startup();
+  static bool splitHost(const std::string& address, std::string& host, std::string& port);
+  bool nonBlocking();
+};
+
+// Length prefixed messages over a socket. Sends are queued and go out as
+// far as the socket takes them; received bytes are cut into messages.
+class Connection
+{
+public:
+  Socket socket;
+
+  Connection() = default;
+  explicit Connection(Socket s);
+  void queue(const std::vector<uint8_t>& message);
+  void queue(const std::vector<uint8_t>& head, const std::vector<uint8_t>& tail);
+  bool flush();
+  bool receive();
+  bool next(std::vector<uint8_t>& message);
+  bool broken() const;
+  size_t pending() const;
+
+private:
+  static constexpr size_t MAX_MESSAGE{ 16u << 20 };
+
+  std::vector<uint8_t> m_in;
+  size_t m_inPos{};
+  bool m_broken{};
+  std::vector<uint8_t> m_out;
+  size_t m_outPos{};
+};
+
+void ByteWriter::u8(uint8_t value)
+{
+  bytes.push_back(value);
+}
+
+void ByteWriter::varint(uint64_t value)
+{
+  do
+  {
+    auto byte = static_cast<uint8_t>(value & 0x7F);
+    value >>= 7;
+    if (value != 0)
+      byte = static_cast<uint8_t>(byte | 0x80);
+    bytes.push_back(byte);
+  } while (value != 0);
+}
+
+void ByteWriter::svarint(long long value)
+{
+  varint((static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+}
+
+void ByteWriter::append(const std::vector<uint8_t>& other)
+{
+  bytes.insert(bytes.end(), other.begin(), other.end());
+}
+
+ByteReader::ByteReader(const uint8_t* data, size_t size)
+  : m_data(data)
+  , m_size(size)
+{
+}
+
+bool ByteReader::u8(uint8_t& value)
+{
+  if (m_pos >= m_size)
+    return false;
+
+  value = m_data[m_pos++];
+  return true;
+}
+
+bool ByteReader::varint(uint64_t& value)
+{
+  value = 0;
+  for (int shift = 0; m_pos < m_size && shift < 64; shift += 7)
+  {
+    uint8_t byte = m_data[m_pos++];
+    value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0)
+      return true;
+  }
+  return false;
+}
+
+bool ByteReader::svarint(long long& value)
+{
+  uint64_t raw{};
+  if (!varint(raw))
+    return false;
+
+  value = static_cast<long long>(raw >> 1) ^ -static_cast<long long>(raw & 1);
+  return true;
+}
+
+bool ByteReader::done() const
+{
+  return m_pos >= m_size;
+}
+
+size_t ByteReader::offset() const
+{
+  return m_pos;
+}
+
+Socket::Socket(Handle handle)
+  : m_handle(handle)
+{
+}
+
+Socket::Socket(Socket&& other) noexcept
+  : m_handle(other.m_handle)
+  , m_unixPath(std::move(other.m_unixPath))
+{
+  other.m_handle = INVALID;
+  other.m_unixPath.clear();
+}
+
+Socket& Socket::operator=(Socket&& other) noexcept
+{
+  if (this != &other)
+  {
+    close();
+    m_handle = other.m_handle;
+    m_unixPath = std::move(other.m_unixPath);
+    other.m_handle = INVALID;
+    other.m_unixPath.clear();
+  }
+  return *this;
+}
+
+Socket::~Socket()
+{
+  close();
+}
+
+// Binds and listens, an invalid socket when the address is taken or bad
+Socket Socket::listen(const std::string& address)
+{
+  if (!startup())
+    return Socket();
+
+#ifndef _WIN32
+  if (address.rfind("unix:", 0) == 0)
+  {
+    std::string path = address.substr(5);
+    sockaddr_un addr{};
+    if (path.empty() || path.size() >= sizeof(addr.sun_path))
+      return Socket();
+
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, path.c_str(), path.size());
+    // A socket file left by a server that did not shut down would block the
+    // bind. Anything else at the path is not ours to delete, the bind fails.
+    struct stat existing{};
+    if (::lstat(path.c_str(), &existing) == 0 && S_ISSOCK(existing.st_mode))
+    {
+      ::unlink(path.c_str());
+    }
+    Socket s(::socket(AF_UNIX, SOCK_STREAM, 0));
+    if (!s.valid() || ::bind(s.m_handle, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0
+        || ::listen(s.m_handle, SOMAXCONN) != 0 || !s.nonBlocking())
+      return Socket();
+
+    s.m_unixPath = path;
+    return s;
+  }
+#endif
+
+  std::string host, port;
+  addrinfo hints{};
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+  addrinfo* found = nullptr;
+  if (!splitHost(address, host, port) || ::getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &found) != 0)
+    return Socket();
+
+  Socket s(::socket(found->ai_family, found->ai_socktype, found->ai_protocol));
+  int on = 1;
+  bool ok = s.valid()
+    && ::setsockopt(s.m_handle, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&on), sizeof(on)) == 0
+    && ::bind(s.m_handle, found->ai_addr, static_cast<int>(found->ai_addrlen)) == 0
+    && ::listen(s.m_handle, SOMAXCONN) == 0 && s.nonBlocking();
+  ::freeaddrinfo(found);
+  return ok ? std::move(s) : Socket();
+}
+
+// Connects blocking, then switches to non-blocking for the game
+Socket Socket::connect(const std::string& address)
+{
+  if (!startup())
+    return Socket();
+
+#ifndef _WIN32
+  if (address.rfind("unix:", 0) == 0)
+  {
+    std::string path = address.substr(5);
+    sockaddr_un addr{};
+    if (path.empty() || path.size() >= sizeof(addr.sun_path))
+      return Socket();
+
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, path.c_str(), path.size());
+    Socket s(::socket(AF_UNIX, SOCK_STREAM, 0));
+    if (!s.valid() || ::connect(s.m_handle, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || !s.nonBlocking())
+      return Socket();
+
+    return s;
+  }
+#endif
+
+  std::string host, port;
+  addrinfo hints{};
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* found = nullptr;
+  if (!splitHost(address, host, port)
+      || ::getaddrinfo(host.empty() ? "127.0.0.1" : host.c_str(), port.c_str(), &hints, &found) != 0)
+    return Socket();
+
+  Socket s(::socket(found->ai_family, found->ai_socktype, found->ai_protocol));
+  int on = 1;
+  bool ok = s.valid() && ::connect(s.m_handle, found->ai_addr, static_cast<int>(found->ai_addrlen)) == 0
+    && ::setsockopt(s.m_handle, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&on), sizeof(on)) == 0
+    && s.nonBlocking();
+  ::freeaddrinfo(found);
+  return ok ? std::move(s) : Socket();
+}
+
+// The next waiting connection, an invalid socket when there is none
+Socket Socket::accept()
+{
+  Socket s(::accept(m_handle, nullptr, nullptr));
+  if (!s.valid() || !s.nonBlocking())
+    return Socket();
+
+  // Ticks are small, do not hold them back to fill packets. Fails
+  // harmlessly on Unix sockets.
+  int on = 1;
+  ::setsockopt(s.m_handle, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&on), sizeof(on));
+  return s;
+}
+
+bool Socket::valid() const
+{
+  return m_handle != INVALID;
+}
+
+// Bytes the socket took, 0 when it is full for now, -1 when the peer is gone
+long long Socket::send(const uint8_t* data, size_t size)
+{
+#ifdef _WIN32
+  int sent = ::send(m_handle, reinterpret_cast<const char*>(data), static_cast<int>(size), 0);
+  if (sent < 0)
+    return WSAGetLastError() == WSAEWOULDBLOCK ? 0 : -1;
+#else
+  int flags = 0;
+#ifdef MSG_NOSIGNAL
+  // A closed peer must not kill the server with SIGPIPE
+  flags = MSG_NOSIGNAL;
+#endif
+  ssize_t sent = ::send(m_handle, data, size, flags);
+  if (sent < 0)
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+#endif
+  return static_cast<long long>(sent);
+}
+
+// Bytes read, 0 when nothing has arrived, -1 when the peer is gone
+long long Socket::receive(uint8_t* data, size_t size)
+{
+#ifdef _WIN32
+  int got = ::recv(m_handle, reinterpret_cast<char*>(data), static_cast<int>(size), 0);
+  if (got < 0)
+    return WSAGetLastError() == WSAEWOULDBLOCK ? 0 : -1;
+#else
+  ssize_t got = ::recv(m_handle, data, size, 0);
+  if (got < 0)
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+#endif
+  return got == 0 ? -1 : static_cast<long long>(got);
+}
+
+// Waits up to timeoutMs for something to read
+bool Socket::wait(int timeoutMs)
+{
+  pollfd fd{};
+  fd.fd = m_handle;
+  fd.events = POLLIN;
+#ifdef _WIN32
+  return ::WSAPoll(&fd, 1, timeoutMs) > 0;
+#else
+  return ::poll(&fd, 1, timeoutMs) > 0;
+#endif
+}
+
+void Socket::close()
+{
+  if (!valid())
+    return;
+
+#ifdef _WIN32
+  ::closesocket(m_handle);
+#else
+  ::close(m_handle);
+  if (!m_unixPath.empty())
+  {
+    ::unlink(m_unixPath.c_str());
+    m_unixPath.clear();
+  }
+#endif
+  m_handle = INVALID;
+}
+
+bool Socket::startup()
+{
+#ifdef _WIN32
+  static bool started = [] {
+    WSADATA data;
+    return ::WSAStartup(MAKEWORD(2, 2), &data) == 0;
+  }();
+  return started;
+#else
+  return true;
+#endif
+}
+
+// "host:port" or just "port", the host may be left empty
+bool Socket::splitHost(const std::string& address, std::string& host, std::string& port)
+{
+  size_t colon = address.rfind(':');
+  host = colon == std::string::npos ? std::string() : address.substr(0, colon);
+  port = colon == std::string::npos ? address : address.substr(colon + 1);
+  return !port.empty();
+}
+
+bool Socket::nonBlocking()
+{
+#ifdef _WIN32
+  u_long on = 1;
+  return ::ioctlsocket(m_handle, FIONBIO, &on) == 0;
+#else
+  int flags = ::fcntl(m_handle, F_GETFL, 0);
+  return flags >= 0 && ::fcntl(m_handle, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+}
+
+Connection::Connection(Socket s)
+  : socket(std::move(s))
+{
+}
+
+void Connection::queue(const std::vector<uint8_t>& message)
+{
+  queue(message, {});
+}
+
+// One message made of two parts, so a part shared by many connections
+// need not be copied into a whole message first
+void Connection::queue(const std::vector<uint8_t>& head, const std::vector<uint8_t>& tail)
+{
+  ByteWriter length;
+  length.varint(head.size() + tail.size());
+  m_out.insert(m_out.end(), length.bytes.begin(), length.bytes.end());
+  m_out.insert(m_out.end(), head.begin(), head.end());
+  m_out.insert(m_out.end(), tail.begin(), tail.end());
+}
+
+// Sends what the socket takes, false once the peer is gone
+bool Connection::flush()
+{
+  while (m_outPos < m_out.size())
+  {
+    long long sent = socket.send(m_out.data() + m_outPos, m_out.size() - m_outPos);
+    if (sent < 0)
+      return false;
+    if (sent == 0)
+      break;
+    m_outPos += static_cast<size_t>(sent);
+  }
+  if (m_outPos == m_out.size())
+  {
+    m_out.clear();
+    m_outPos = 0;
+  }
+  return true;
+}
+
+// Reads everything that has arrived, false once the peer is gone
+bool Connection::receive()
+{
+  // No more than one message is held unread, the rest waits in the socket
+  uint8_t buffer[16 * 1024];
+  while (!m_broken && m_in.size() - m_inPos <= MAX_MESSAGE + 10)
+  {
+    long long got = socket.receive(buffer, sizeof(buffer));
+    if (got < 0)
+      return false;
+    if (got == 0)
+      return true;
+    m_in.insert(m_in.end(), buffer, buffer + got);
+  }
+  return !m_broken;
+}
+
+// Takes the next complete message, if one has arrived in full. A message
+// longer than MAX_MESSAGE breaks the connection, see broken().
+bool Connection::next(std::vector<uint8_t>& message)
+{
+  ByteReader reader(m_in.data() + m_inPos, m_in.size() - m_inPos);
+  uint64_t length{};
+  if (m_broken || !reader.varint(length))
+    return false;
+  if (length > MAX_MESSAGE)
+  {
+    m_broken = true;
+    return false;
+  }
+
+  size_t header = reader.offset();
+  if (m_in.size() - m_inPos < header + length)
+    return false;
+
+  auto begin = m_in.begin() + static_cast<std::ptrdiff_t>(m_inPos + header);
+  message.assign(begin, begin + static_cast<std::ptrdiff_t>(length));
+  m_inPos += header + static_cast<size_t>(length);
+  if (m_inPos == m_in.size())
+  {
+    m_in.clear();
+    m_inPos = 0;
+  }
+  else if (m_inPos > m_in.size() / 2)
+  {
+    // A stream that keeps ending mid-message would otherwise never shrink
+    m_in.erase(m_in.begin(), m_in.begin() + static_cast<std::ptrdiff_t>(m_inPos));
+    m_inPos = 0;
+  }
+  return true;
+}
+
+// True once the peer sent something no message can be read from, it
+// should be dropped
+bool Connection::broken() const
+{
+  return m_broken;
+}
+
+// Bytes queued but not sent yet
+size_t Connection::pending() const
+{
+  return m_out.size() - m_outPos;
+}
@@ -1,5 +1,33 @@
 #pragma once
 
+#include "Trace.hpp"
+
+// Search effort of one or more findPath queries. Times are only measured
+// when AStar::collectStats is set.
+struct PathStats
+{
+  long long queries{};
+  long long failed{};
+  long long pushed{};
+  long long popped{};
+  long long maxOpen{};
+  long long touched{};
+  long long totalNs{};
+  long long maxNs{};
+
+  void add(const PathStats& other)
+  {
+    queries += other.queries;
+    failed += other.failed;
+    pushed += other.pushed;
+    popped += other.popped;
+    maxOpen = std::max(maxOpen, other.maxOpen);
+    touched += other.touched;
+    totalNs += other.totalNs;
+    maxNs = std::max(maxNs, other.maxNs);
+  }
+};
+
 struct ComparePair
 {
   bool operator()(const std::pair<Point, double>& a, const std::pair<Point, double>& b) const
@@ -9,99 +37,134 @@ struct ComparePair
 };
 
 
+// Map sizes known when compiling, so the index maths and bounds checks of
+// a search fold to constants. Maps of other sizes are searched with their
+// size read at run time.
+template <int W, int H>
+struct FixedGrid
+{
+  static constexpr int width{ W };
+  static constexpr int height{ H };
+};
+
+struct DynamicGrid
+{
+  int width;
+  int height;
+};
+
 class AStar
 {
 public:
-  AStar(Map& map) : m_map(map) {}
+  bool collectStats{};
+
+  AStar(const Map& map) : m_map(map) {}
   std::vector<Point> findPath(Point start, Point end);
+  const PathStats& lastStats() const;
 
 private:
-  Map& m_map;
-  std::vector<std::vector<bool>> m_visitedArr;
-  std::vector<std::vector<Point>> m_cameFromArr;
-  std::vector<std::vector<double>> m_gScoreArr;
-  std::vector<std::vector<double>> m_fScoreArr;
+  const Map& m_map;
+  PathStats m_last;
+  // One entry per tile, row by row
+  std::vector<uint8_t> m_visited;
+  std::vector<Point> m_cameFrom;
+  std::vector<double> m_gScore;
 
   void init();
+  template <typename Grid>
+  bool search(Grid grid, Point start, Point end);
   std::vector<Point> reconstructPath(Point start, Point end);
-  double heuristic(Point a, Point b);
+  static double heuristic(Point a, Point b);
+  void finishStats(long long startNs);
+  static long long now();
 };
 
+const PathStats& AStar::lastStats() const
+{
+  return m_last;
+}
+
 void AStar::init()
 {
-  // Reset all data structures
-  m_visitedArr.clear();
-  m_cameFromArr.clear();
-  m_gScoreArr.clear();
-  m_fScoreArr.clear();
-
-  // Resize all data structures to the size of the map
-  m_visitedArr.resize(m_map.map_h, std::vector<bool>(m_map.map_w, false));
-  m_cameFromArr.resize(m_map.map_h, std::vector<Point>(m_map.map_w));
-  m_gScoreArr.resize(m_map.map_h, std::vector<double>(m_map.map_w, std::numeric_limits<double>::infinity()));
-  m_fScoreArr.resize(m_map.map_h, std::vector<double>(m_map.map_w, std::numeric_limits<double>::infinity()));
+  // Same map size keeps the buffers, only their contents are reset
+  size_t tiles = static_cast<size_t>(m_map.map_w) * static_cast<size_t>(m_map.map_h);
+  m_visited.assign(tiles, 0);
+  m_cameFrom.resize(tiles);
+  m_gScore.assign(tiles, std::numeric_limits<double>::infinity());
 }
 
+// The game's level size gets a search of its own
 std::vector<Point> AStar::findPath(Point start, Point end)
 {
+  TraceScope trace("findPath");
+  long long startNs = collectStats ? now() : 0;
+  m_last = PathStats();
+  m_last.queries = 1;
   init();
+
+  bool found{};
+  if (m_map.map_w == 100 && m_map.map_h == 50)
+    found = search(FixedGrid<100, 50>{}, start, end);
+  else
+    found = search(DynamicGrid{ m_map.map_w, m_map.map_h }, start, end);
+
+  trace.setArg("expanded", m_last.popped);
+  m_last.failed = found ? 0 : 1;
+  finishStats(startNs);
+  return found ? reconstructPath(start, end) : std::vector<Point>();
+}
+
+template <typename Grid>
+bool AStar::search(Grid grid, Point start, Point end)
+{
+  const int w = grid.width;
+  const int h = grid.height;
   std::priority_queue<std::pair<Point, double>, std::vector<std::pair<Point, double>>, ComparePair> queue;
   queue.push({ start, 0 });
-  m_visitedArr[start.y][start.x] = true;
-  m_gScoreArr[start.y][start.x] = 0;
-  m_fScoreArr[start.y][start.x] = heuristic(start, end);
+  m_last.pushed = 1;
+  m_last.maxOpen = 1;
+  m_visited[static_cast<size_t>(start.y * w + start.x)] = 1;
+  m_gScore[static_cast<size_t>(start.y * w + start.x)] = 0;
 
   while (!queue.empty())
   {
     Point current = queue.top().first;
     queue.pop();
+    m_last.popped++;
 
     if (current.x == end.x && current.y == end.y)
-    {
-      return reconstructPath(start, end);
-    }
-
-    for (int dx = -1; dx <= 1; dx++)
-    {
-      for (int dy = -1; dy <= 1; dy++)
-      {
-        if (dx == 0 && dy == 0) continue;
-
-        // Not allowing diagonal movement
-        if (dx != 0 && dy != 0) continue;
-
-        int newX = current.x + dx;
-        int newY = current.y + dy;
-
-        if (newX >= 0 && newX < m_map.map_w && newY >= 0 && newY < m_map.map_h)
-        {
-          if (!m_visitedArr[newY][newX] && !m_map.board[newY][newX].blocking)
-          {
-            double tentative_gScore = m_gScoreArr[current.y][current.x] + 1;
-            if (tentative_gScore < m_gScoreArr[newY][newX])
-            {
-              m_cameFromArr[newY][newX] = current;
-              m_gScoreArr[newY][newX] = tentative_gScore;
-              m_fScoreArr[newY][newX] = m_gScoreArr[newY][newX] + heuristic(Point(newX, newY), end);
-              if (!m_visitedArr[newY][newX])
-              {
-                queue.push({ Point(newX, newY), m_fScoreArr[newY][newX] });
-                m_visitedArr[newY][newX] = true;
-              }
-            }
-          }
-        }
-      }
-    }
+      return true;
+
+    // No diagonal moves, neighbours in the order ties are broken by
+    double tentative_gScore = m_gScore[static_cast<size_t>(current.y * w + current.x)] + 1;
+    auto visit = [&](int newX, int newY) {
+      if (newX < 0 || newX >= w || newY < 0 || newY >= h)
+        return;
+
+      m_last.touched++;
+      auto i = static_cast<size_t>(newY * w + newX);
+      if (m_visited[i] || m_map.board[newY][newX].blocking || tentative_gScore >= m_gScore[i])
+        return;
+
+      m_cameFrom[i] = current;
+      m_gScore[i] = tentative_gScore;
+      queue.push({ Point(newX, newY), tentative_gScore + heuristic(Point(newX, newY), end) });
+      m_visited[i] = 1;
+      m_last.pushed++;
+      m_last.maxOpen = std::max(m_last.maxOpen, static_cast<long long>(queue.size()));
+    };
+    visit(current.x - 1, current.y);
+    visit(current.x, current.y - 1);
+    visit(current.x, current.y + 1);
+    visit(current.x + 1, current.y);
   }
-
-  return {};  // return empty path if no path found
+  return false;
 }
 
 std::vector<Point> AStar::reconstructPath(Point start, Point end)
 {
   std::vector<Point> path;
-  for (Point p = end; p.x != start.x || p.y != start.y; p = m_cameFromArr[p.y][p.x])
+  for (Point p = end; p.x != start.x || p.y != start.y; p = m_cameFrom[static_cast<size_t>(p.y * m_map.map_w + p.x)])
   {
     path.push_back(p);
   }
@@ -112,5 +175,23 @@ std::vector<Point> AStar::reconstructPath(Point start, Point end)
 double AStar::heuristic(Point a, Point b)
 {
   // Using Euclidean distance as heuristic
-  return std::sqrt(std::pow(b.x - a.x, 2) + std::pow(b.y - a.y, 2));
+  double dx = b.x - a.x;
+  double dy = b.y - a.y;
+  return std::sqrt(dx * dx + dy * dy);
+}
+
+void AStar::finishStats(long long startNs)
+{
+  if (collectStats)
+  {
+    m_last.totalNs = now() - startNs;
+    m_last.maxNs = m_last.totalNs;
+  }
+}
+
+long long AStar::now()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()
+  ).count();
 }
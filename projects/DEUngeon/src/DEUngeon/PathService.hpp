@@ -0,0 +1,119 @@
+#pragma once
+
+#include "PathFinding.hpp"
+
+struct PathRequest
+{
+  int id;
+  Point start;
+  Point goal;
+  unsigned int revision;
+  std::shared_ptr<const Map> map;
+};
+
+// A finished search, tagged with what it was computed for so the caller can
+// decide whether it is still worth following
+struct PathResult
+{
+  int id;
+  Point start;
+  Point goal;
+  unsigned int revision;
+  std::vector<Point> path;
+  PathStats stats;
+};
+
+// Runs searches on a background thread. Requests carry an immutable copy of
+// the map, so terrain edits on the game thread never race with a search.
+class PathService
+{
+public:
+  std::atomic<bool> collectStats{ false };
+
+  PathService();
+  PathService(const PathService&) = delete;
+  PathService& operator=(const PathService&) = delete;
+  ~PathService();
+
+  void submit(PathRequest request);
+  bool poll(PathResult& result);
+
+private:
+  std::mutex m_mutex;
+  std::condition_variable m_wake;
+  std::deque<PathRequest> m_requests;
+  std::deque<PathResult> m_results;
+  bool m_stop{};
+  std::thread m_thread;
+
+  void loop();
+};
+
+PathService::PathService()
+  : m_thread([this]() { loop(); })
+{
+}
+
+PathService::~PathService()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_wake.notify_one();
+  m_thread.join();
+}
+
+void PathService::submit(PathRequest request)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_requests.push_back(std::move(request));
+  }
+  m_wake.notify_one();
+}
+
+bool PathService::poll(PathResult& result)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (m_results.empty())
+    return false;
+
+  result = std::move(m_results.front());
+  m_results.pop_front();
+  return true;
+}
+
+void PathService::loop()
+{
+  // The search scratch grids belong to one map copy, rebuild them when a
+  // request brings a newer one
+  std::shared_ptr<const Map> map;
+  std::unique_ptr<AStar> astar;
+  while (true)
+  {
+    PathRequest request;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_wake.wait(lock, [this]() { return m_stop || !m_requests.empty(); });
+      if (m_stop)
+        return;
+
+      request = std::move(m_requests.front());
+      m_requests.pop_front();
+    }
+
+    if (request.map != map)
+    {
+      map = request.map;
+      astar = std::make_unique<AStar>(*map);
+    }
+    astar->collectStats = collectStats.load(std::memory_order_relaxed);
+
+    PathResult result{ request.id, request.start, request.goal, request.revision, astar->findPath(request.start, request.goal), {} };
+    result.stats = astar->lastStats();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_results.push_back(std::move(result));
+  }
+}
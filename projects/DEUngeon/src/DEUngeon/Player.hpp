@@ -0,0 +1,121 @@
+#pragma once
+
+#include "Actor.hpp"
+
+// One player of a game, the local one or a client of a server. A slot
+// whose actor is NONE is free; a caught player stays on the map but is out.
+// Keys are held in keypress until the next move uses them.
+struct Player
+{
+  ActorId actor;
+  int moveDelay;
+  long long moveTimer;
+  int dashes;
+  int destroys;
+  char keypress;
+  char lastDir;
+  bool caught;
+  Point lastWakeScan;
+  Player(ActorId actor, int moveDelay, long long moveTimer)
+    : actor(actor)
+    , moveDelay(moveDelay)
+    , moveTimer(moveTimer)
+    , lastWakeScan(-1, -1)
+  {
+    dashes = 0;
+    destroys = 0;
+    keypress = 0;
+    lastDir = 0;
+    caught = false;
+    dashing = false;
+  }
+  Player() : Player(Actors::NONE, 0, 0) {}
+  bool inPlay() const
+  {
+    return actor != Actors::NONE && !caught;
+  }
+  bool isDashing() const
+  {
+    return dashing;
+  }
+  void dash(Actors& actors)
+  {
+    if (dashes > 0)
+    {
+      actors.changeColor(actor, actors.color("white"));
+      dashing = true;
+      dashes--;
+    }
+  }
+  bool destroy(Map& map, Actors& actors, SpatialGrid& enemyGrid, std::vector<ActorId>& killed)
+  {
+    if (destroys > 0)
+    {
+      actors.changeColor(actor, actors.color("red"));
+      Point pos = actors.getPos(actor);
+      int kills = 0;
+      uint8_t rageColor{};
+      for (int dx = -5; dx <= 5; dx++)
+      {
+        for (int dy = -5; dy <= 5; dy++)
+        {
+          if (dx == 0 && dy == 0) continue;
+
+          int newX = pos.x + dx;
+          int newY = pos.y + dy;
+
+          // Stairs are the only way between floors, bombs leave them be
+          if (map.inBounds(newX, newY) && map.board[newY][newX].terrain != TERRAIN::STAIRS_UP
+              && map.board[newY][newX].terrain != TERRAIN::STAIRS_DOWN)
+          {
+            map.board[newY][newX].terrain = TERRAIN::BOMBED;
+            map.board[newY][newX].blocking = false;
+          }
+
+          for (int id = enemyGrid.first(newX, newY); id != SpatialGrid::NONE;)
+          {
+            // Destroying unlinks the enemy, so step ahead first
+            int nextId = enemyGrid.next(id);
+            if (kills == 0)
+            {
+              // Every later victim was already raged into this color
+              rageColor = actors.getColor(id);
+            }
+            actors.destroy(id);
+            killed.push_back(id);
+            kills++;
+            id = nextId;
+          }
+        }
+      }
+      map.revision++;
+
+      // Other enemies get speed boost, once per kill
+      if (kills > 0)
+      {
+        for (int s = 0; s < actors.size(); s++)
+        {
+          if (actors.kind[static_cast<size_t>(s)] == ActorKind::ENEMY)
+          {
+            actors.rage(actors.id[static_cast<size_t>(s)], rageColor, kills);
+          }
+        }
+      }
+      actors.revertColor(actor);
+      destroys--;
+      return true;
+    }
+    return false;
+  }
+  void stopDash(Actors& actors)
+  {
+    actors.revertColor(actor);
+    dashing = false;
+  }
+  void setDashing(bool d)
+  {
+    dashing = d;
+  }
+private:
+  bool dashing;
+};
@@ -0,0 +1,144 @@
+#pragma once
+
+enum class ProfileZone : uint8_t
+{
+  FRAME,
+  INPUT,
+  ENEMIES,
+  COLLISION,
+  POWERUPS,
+  RENDER,
+  LATENCY,
+  COUNT
+};
+
+constexpr const char* PROFILE_ZONE_NAMES[]{ "frame", "input", "enemy", "hit", "pickup", "render", "latency" };
+
+struct ProfileStats
+{
+  long long count{};
+  long long p50{};
+  long long p99{};
+  long long max{};
+};
+
+// Keeps the last SAMPLES timings of every zone in nanoseconds. Recording is
+// a ring buffer write; percentiles are only computed when asked for.
+class Profiler
+{
+public:
+  static constexpr size_t SAMPLES{ 512 };
+
+  bool enabled{};
+
+  static long long now();
+  void record(ProfileZone zone, long long ns);
+  ProfileStats stats(ProfileZone zone) const;
+  bool dump(const char* path) const;
+  void clear();
+
+private:
+  struct Zone
+  {
+    long long samples[SAMPLES]{};
+    long long count{};
+    long long max{};
+  };
+  Zone m_zones[static_cast<int>(ProfileZone::COUNT)];
+};
+
+// Times the enclosing scope, or until stop(). Costs one branch when the
+// profiler is off.
+class ProfileScope
+{
+public:
+  ProfileScope(Profiler& profiler, ProfileZone zone)
+    : m_profiler(nullptr)
+    , m_zone(zone)
+    , m_start(0)
+  {
+    if (profiler.enabled)
+    {
+      m_profiler = &profiler;
+      m_start = Profiler::now();
+    }
+  }
+  ProfileScope(const ProfileScope&) = delete;
+  ProfileScope& operator=(const ProfileScope&) = delete;
+  ~ProfileScope()
+  {
+    stop();
+  }
+  void stop()
+  {
+    if (m_profiler)
+    {
+      m_profiler->record(m_zone, Profiler::now() - m_start);
+      m_profiler = nullptr;
+    }
+  }
+
+private:
+  Profiler* m_profiler;
+  ProfileZone m_zone;
+  long long m_start;
+};
+
+long long Profiler::now()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()
+  ).count();
+}
+
+void Profiler::record(ProfileZone zone, long long ns)
+{
+  Zone& z = m_zones[static_cast<int>(zone)];
+  z.samples[static_cast<size_t>(z.count) % SAMPLES] = ns;
+  z.count++;
+  z.max = std::max(z.max, ns);
+}
+
+ProfileStats Profiler::stats(ProfileZone zone) const
+{
+  const Zone& z = m_zones[static_cast<int>(zone)];
+  ProfileStats s;
+  s.count = z.count;
+  if (z.count == 0)
+    return s;
+
+  // Percentiles over the recent window, max over the whole run
+  size_t n = std::min(static_cast<size_t>(z.count), SAMPLES);
+  long long window[SAMPLES];
+  std::copy(z.samples, z.samples + n, window);
+  std::nth_element(window, window + n / 2, window + n);
+  s.p50 = window[n / 2];
+  std::nth_element(window, window + n * 99 / 100, window + n);
+  s.p99 = window[n * 99 / 100];
+  s.max = z.max;
+  return s;
+}
+
+bool Profiler::dump(const char* path) const
+{
+  std::ofstream out(path, std::ios::trunc);
+  if (!out)
+    return false;
+
+  out << "zone\tcount\tp50_us\tp99_us\tmax_us\n";
+  for (int i = 0; i < static_cast<int>(ProfileZone::COUNT); i++)
+  {
+    ProfileStats s = stats(static_cast<ProfileZone>(i));
+    out << PROFILE_ZONE_NAMES[i] << '\t' << s.count << '\t' << s.p50 / 1000.0 << '\t'
+        << s.p99 / 1000.0 << '\t' << s.max / 1000.0 << '\n';
+  }
+  return true;
+}
+
+void Profiler::clear()
+{
+  for (Zone& z : m_zones)
+  {
+    z = Zone();
+  }
+}
@@ -0,0 +1,275 @@
+#pragma once
+
+#include "AnsiTerminal.hpp"
+#include "Frame.hpp"
+
+// Three slots shared by one producer and one consumer without locks. The
+// producer fills back() and publishes it; the consumer takes the latest
+// published slot with update(). Frames the consumer was too slow for are
+// skipped, neither side ever waits for the other.
+template <typename T>
+class TripleBuffer
+{
+public:
+  T& back()
+  {
+    return m_slots[m_back];
+  }
+
+  void publish()
+  {
+    m_back = m_middle.exchange(m_back | FRESH, std::memory_order_acq_rel) & INDEX;
+  }
+
+  bool update()
+  {
+    if ((m_middle.load(std::memory_order_relaxed) & FRESH) == 0)
+      return false;
+
+    m_front = m_middle.exchange(m_front, std::memory_order_acq_rel) & INDEX;
+    return true;
+  }
+
+  const T& front() const
+  {
+    return m_slots[m_front];
+  }
+
+  T& slot(int index)
+  {
+    return m_slots[index];
+  }
+
+private:
+  static constexpr int INDEX{ 3 };
+  static constexpr int FRESH{ 4 };
+
+  T m_slots[3];
+  int m_back{ 0 };
+  std::atomic<int> m_middle{ 1 };
+  int m_front{ 2 };
+};
+
+// A key and when the render thread read it, in microseconds of the steady
+// clock
+struct InputEvent
+{
+  int key;
+  long long timeUs;
+};
+
+// Owns the terminal on a thread of its own: opens the window, draws the
+// latest published frame and forwards key presses. The simulation never
+// blocks on terminal output. With ansi set the frames go to the terminal
+// the game was started from instead of a window. Key presses are timed
+// from when they are read until the first frame made after the simulation
+// read them is on screen.
+class Renderer
+{
+public:
+  static constexpr size_t KEY_CAPACITY{ 64 };
+  static constexpr size_t LATENCY_CAPACITY{ 256 };
+
+  static long long nowUs();
+
+  Renderer(int width, int height, bool ansi = false);
+  Renderer(const Renderer&) = delete;
+  Renderer& operator=(const Renderer&) = delete;
+  ~Renderer();
+
+  // Closes the window, or hands the terminal back, before the destructor
+  void stop();
+  Frame& back();
+  void publish();
+  int readKey();
+  bool readInput(InputEvent& event);
+  // Next input latency in microseconds, false if none was measured since
+  bool readLatency(long long& us);
+
+private:
+  TripleBuffer<Frame> m_frames;
+  InputEvent m_keys[KEY_CAPACITY]{};
+  std::atomic<size_t> m_keyHead{};
+  std::atomic<size_t> m_keyTail{};
+  // Keys up to here have been timed, only the render thread uses it
+  size_t m_measured{};
+  long long m_latency[LATENCY_CAPACITY]{};
+  std::atomic<size_t> m_latencyHead{};
+  std::atomic<size_t> m_latencyTail{};
+  std::atomic<bool> m_stop{};
+  std::thread m_thread;
+
+  void loop(int width, int height);
+  void ansiLoop();
+  void pushKey(int key);
+  void shown(const Frame& frame);
+};
+
+Renderer::Renderer(int width, int height, bool ansi)
+{
+  for (int i = 0; i < 3; i++)
+  {
+    m_frames.slot(i).resize(width, height);
+  }
+  if (ansi)
+  {
+    m_thread = std::thread([this]() { ansiLoop(); });
+    return;
+  }
+  m_thread = std::thread([this, width, height]() { loop(width, height); });
+}
+
+Renderer::~Renderer()
+{
+  stop();
+}
+
+void Renderer::stop()
+{
+  if (!m_thread.joinable())
+    return;
+
+  m_stop = true;
+  m_thread.join();
+}
+
+Frame& Renderer::back()
+{
+  return m_frames.back();
+}
+
+void Renderer::publish()
+{
+  m_frames.back().inputs = m_keyTail.load(std::memory_order_relaxed);
+  m_frames.publish();
+}
+
+long long Renderer::nowUs()
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()
+  ).count();
+}
+
+// Next key pressed since the last call, 0 if there is none
+int Renderer::readKey()
+{
+  InputEvent event{};
+  return readInput(event) ? event.key : 0;
+}
+
+bool Renderer::readInput(InputEvent& event)
+{
+  size_t tail = m_keyTail.load(std::memory_order_relaxed);
+  if (tail == m_keyHead.load(std::memory_order_acquire))
+    return false;
+
+  event = m_keys[tail % KEY_CAPACITY];
+  m_keyTail.store(tail + 1, std::memory_order_release);
+  return true;
+}
+
+bool Renderer::readLatency(long long& us)
+{
+  size_t tail = m_latencyTail.load(std::memory_order_relaxed);
+  if (tail == m_latencyHead.load(std::memory_order_acquire))
+    return false;
+
+  us = m_latency[tail % LATENCY_CAPACITY];
+  m_latencyTail.store(tail + 1, std::memory_order_release);
+  return true;
+}
+
+void Renderer::loop(int width, int height)
+{
+  // The window belongs to the thread that opened it, so every terminal
+  // call, input included, happens here
+  terminal_open();
+  std::string windowSize = "window: size=" + std::to_string(width) + "x" + std::to_string(height) + ";";
+  terminal_set(windowSize.c_str());
+  terminal_refresh();
+
+  while (!m_stop)
+  {
+    while (terminal_has_input())
+    {
+      pushKey(terminal_read());
+    }
+
+    if (m_frames.update())
+    {
+      TraceScope trace("draw");
+      m_frames.front().draw();
+      terminal_refresh();
+      shown(m_frames.front());
+    }
+    else
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+  terminal_close();
+}
+
+void Renderer::ansiLoop()
+{
+  AnsiTerminal terminal;
+  if (!terminal.open())
+  {
+    pushKey(TK_CLOSE);
+    return;
+  }
+
+  while (!m_stop)
+  {
+    while (terminal.hasInput())
+    {
+      pushKey(terminal.read());
+    }
+
+    if (m_frames.update())
+    {
+      TraceScope trace("draw");
+      trace.setArg("bytes", static_cast<long long>(terminal.draw(m_frames.front())));
+      shown(m_frames.front());
+    }
+    else
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+  terminal.close();
+}
+
+void Renderer::pushKey(int key)
+{
+  // Keys beyond a full queue are dropped, the game reads every frame
+  size_t head = m_keyHead.load(std::memory_order_relaxed);
+  if (head - m_keyTail.load(std::memory_order_acquire) == KEY_CAPACITY)
+    return;
+
+  // A slot is only reused once its key has been timed, or given up on
+  if (head - m_measured == KEY_CAPACITY)
+  {
+    m_measured++;
+  }
+  m_keys[head % KEY_CAPACITY] = InputEvent{ key, nowUs() };
+  m_keyHead.store(head + 1, std::memory_order_release);
+}
+
+// Every key the frame's simulation had read is now on screen. Releases are
+// not timed, and times beyond a full queue are dropped.
+void Renderer::shown(const Frame& frame)
+{
+  long long now = nowUs();
+  for (; m_measured < frame.inputs; m_measured++)
+  {
+    const InputEvent& event = m_keys[m_measured % KEY_CAPACITY];
+    size_t head = m_latencyHead.load(std::memory_order_relaxed);
+    if ((event.key & TK_KEY_RELEASED) != 0 || head - m_latencyTail.load(std::memory_order_acquire) == LATENCY_CAPACITY)
+      continue;
+
+    m_latency[head % LATENCY_CAPACITY] = now - event.timeUs;
+    m_latencyHead.store(head + 1, std::memory_order_release);
+  }
+}
@@ -0,0 +1,263 @@
+#pragma once
+
+// Recording stream layout, all integers are LEB128 varints:
+//   "DEUR" version width height rooms horde flags floors
+//   (version 1 files end the header after rooms, version 2 after horde,
+//   version 3 after flags)
+//   then records, each a tag (value << 2 | type) where type is
+//     GAME  : a new game starts, value is its seed
+//     IDLE  : value game loop iterations without input or clock change
+//     TICK  : one iteration, value is the milliseconds since the last one
+//     KEY   : like TICK, followed by the key read in that iteration
+enum class RecordType : uint8_t
+{
+  GAME,
+  IDLE,
+  TICK,
+  KEY
+};
+
+constexpr char REPLAY_MAGIC[4]{ 'D', 'E', 'U', 'R' };
+constexpr uint64_t REPLAY_VERSION{ 4 };
+
+// Header flags for the game modes that change how enemies behave or how
+// levels are generated
+constexpr uint64_t REPLAY_FOV{ 1 };
+constexpr uint64_t REPLAY_INFLUENCE{ 2 };
+constexpr uint64_t REPLAY_CAVES{ 4 };
+// Set for every new recording, older ones were made with straight tunnels
+constexpr uint64_t REPLAY_ROUTED_TUNNELS{ 8 };
+
+class Recorder
+{
+public:
+  bool open(const char* path, int width, int height, int rooms, int horde = 0, uint64_t flags = 0, int floors = 1);
+  void beginGame(unsigned int seed);
+  void frame(long long dt, int key);
+  void flush();
+
+private:
+  std::ofstream m_out;
+  uint64_t m_idle{};
+
+  void write(uint64_t value);
+  void write(RecordType type, uint64_t value);
+};
+
+bool Recorder::open(const char* path, int width, int height, int rooms, int horde, uint64_t flags, int floors)
+{
+  m_out.open(path, std::ios::binary | std::ios::trunc);
+  if (!m_out)
+    return false;
+
+  m_out.write(REPLAY_MAGIC, sizeof(REPLAY_MAGIC));
+  write(REPLAY_VERSION);
+  write(static_cast<uint64_t>(width));
+  write(static_cast<uint64_t>(height));
+  write(static_cast<uint64_t>(rooms));
+  write(static_cast<uint64_t>(horde));
+  write(flags);
+  write(static_cast<uint64_t>(floors));
+  return true;
+}
+
+void Recorder::beginGame(unsigned int seed)
+{
+  flush();
+  write(RecordType::GAME, seed);
+}
+
+void Recorder::frame(long long dt, int key)
+{
+  // Most iterations see neither input nor a new millisecond, count them
+  if (dt <= 0 && key == 0)
+  {
+    m_idle++;
+    return;
+  }
+
+  if (m_idle > 0)
+  {
+    write(RecordType::IDLE, m_idle);
+    m_idle = 0;
+  }
+
+  auto delta = static_cast<uint64_t>(std::max(dt, 0LL));
+  if (key == 0)
+  {
+    write(RecordType::TICK, delta);
+  }
+  else
+  {
+    write(RecordType::KEY, delta);
+    write(static_cast<uint64_t>(key));
+  }
+}
+
+void Recorder::flush()
+{
+  if (m_idle > 0)
+  {
+    write(RecordType::IDLE, m_idle);
+    m_idle = 0;
+  }
+  m_out.flush();
+}
+
+void Recorder::write(uint64_t value)
+{
+  do
+  {
+    auto byte = static_cast<char>(value & 0x7F);
+    value >>= 7;
+    if (value != 0)
+      byte = static_cast<char>(byte | 0x80);
+    m_out.put(byte);
+  } while (value != 0);
+}
+
+void Recorder::write(RecordType type, uint64_t value)
+{
+  write(value << 2 | static_cast<uint64_t>(type));
+}
+
+
+class Replay
+{
+public:
+  int width{};
+  int height{};
+  int rooms{};
+  int horde{};
+  uint64_t flags{};
+  int floors{ 1 };
+
+  bool open(const char* path);
+  bool nextGame(unsigned int& seed);
+  bool nextFrame(long long& dt, int& key);
+
+private:
+  std::vector<uint8_t> m_data;
+  size_t m_pos{};
+  uint64_t m_idle{};
+
+  bool read(uint64_t& value);
+  bool peek(RecordType& type, uint64_t& value);
+};
+
+bool Replay::open(const char* path)
+{
+  std::ifstream in(path, std::ios::binary);
+  if (!in)
+    return false;
+
+  m_data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+  if (m_data.size() < sizeof(REPLAY_MAGIC) || !std::equal(REPLAY_MAGIC, REPLAY_MAGIC + 4, m_data.begin()))
+    return false;
+
+  m_pos = sizeof(REPLAY_MAGIC);
+  uint64_t version{}, w{}, h{}, r{}, n{}, f{}, d{ 1 };
+  if (!read(version) || version == 0 || version > REPLAY_VERSION || !read(w) || !read(h) || !read(r))
+    return false;
+  if (version >= 2 && !read(n))
+    return false;
+  if (version >= 3 && !read(f))
+    return false;
+  if (version >= 4 && !read(d))
+    return false;
+
+  width = static_cast<int>(w);
+  height = static_cast<int>(h);
+  rooms = static_cast<int>(r);
+  horde = static_cast<int>(n);
+  flags = f;
+  floors = static_cast<int>(d);
+  return true;
+}
+
+bool Replay::nextGame(unsigned int& seed)
+{
+  // Skip whatever is left of the current game
+  RecordType type{};
+  uint64_t value{};
+  m_idle = 0;
+  while (peek(type, value))
+  {
+    read(value);
+    if (type == RecordType::GAME)
+    {
+      seed = static_cast<unsigned int>(value >> 2);
+      return true;
+    }
+    if (type == RecordType::KEY)
+    {
+      read(value);
+    }
+  }
+  return false;
+}
+
+bool Replay::nextFrame(long long& dt, int& key)
+{
+  dt = 0;
+  key = 0;
+  if (m_idle > 0)
+  {
+    m_idle--;
+    return true;
+  }
+
+  RecordType type{};
+  uint64_t value{};
+  if (!peek(type, value) || type == RecordType::GAME)
+    return false;
+
+  read(value);
+  switch (type)
+  {
+    case RecordType::IDLE:
+      m_idle = (value >> 2) - 1;
+      break;
+    case RecordType::TICK:
+      dt = static_cast<long long>(value >> 2);
+      break;
+    case RecordType::KEY:
+    {
+      dt = static_cast<long long>(value >> 2);
+      uint64_t k{};
+      if (!read(k))
+        return false;
+      key = static_cast<int>(k);
+      break;
+    }
+    default:
+      break;
+  }
+  return true;
+}
+
+bool Replay::read(uint64_t& value)
+{
+  value = 0;
+  for (int shift = 0; m_pos < m_data.size() && shift < 64; shift += 7)
+  {
+    uint8_t byte = m_data[m_pos++];
+    value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0)
+      return true;
+  }
+  return false;
+}
+
+bool Replay::peek(RecordType& type, uint64_t& value)
+{
+  size_t pos = m_pos;
+  if (!read(value))
+  {
+    m_pos = pos;
+    return false;
+  }
+  m_pos = pos;
+  type = static_cast<RecordType>(value & 0x3);
+  return true;
+}
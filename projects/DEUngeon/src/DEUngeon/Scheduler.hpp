@@ -0,0 +1,165 @@
+#pragma once
+
+struct ScheduledAction
+{
+  long long due;
+  int id;
+  unsigned int generation;
+  ScheduledAction() : due(0), id(0), generation(0) {}
+  ScheduledAction(long long d, int i, unsigned int g) : due(d), id(i), generation(g) {}
+};
+
+struct CompareAction
+{
+  bool operator()(const ScheduledAction& a, const ScheduledAction& b) const
+  {
+    return a.due > b.due;
+  }
+};
+
+class Scheduler
+{
+public:
+  void schedule(int id, long long due);
+  void cancel(int id);
+  bool popDue(long long now, int& id);
+  bool isScheduled(int id) const;
+  void clear();
+  void save(std::vector<ScheduledAction>& queue, std::vector<unsigned int>& generations, std::vector<uint8_t>& scheduled) const;
+  void restore(const std::vector<ScheduledAction>& queue, const std::vector<unsigned int>& generations,
+               const std::vector<uint8_t>& scheduled, long long shift = 0);
+
+private:
+  // A binary heap kept with push_heap/pop_heap, so it can be saved and
+  // restored as is and pops in the same order afterwards
+  std::vector<ScheduledAction> m_queue;
+  std::vector<unsigned int> m_generation;
+  std::vector<bool> m_scheduled;
+  int m_live{};
+
+  void compact();
+  void pop();
+};
+
+void Scheduler::schedule(int id, long long due)
+{
+  auto index = static_cast<size_t>(id);
+  if (index >= m_generation.size())
+  {
+    m_generation.resize(index + 1, 0);
+    m_scheduled.resize(index + 1, false);
+  }
+
+  // Rescheduling invalidates the previous entry, it is dropped lazily on pop
+  m_generation[index]++;
+  if (!m_scheduled[index])
+  {
+    m_scheduled[index] = true;
+    m_live++;
+  }
+  m_queue.push_back(ScheduledAction(due, id, m_generation[index]));
+  std::push_heap(m_queue.begin(), m_queue.end(), CompareAction());
+
+  if (m_queue.size() > static_cast<size_t>(m_live) * 2 + 16)
+  {
+    compact();
+  }
+}
+
+void Scheduler::cancel(int id)
+{
+  auto index = static_cast<size_t>(id);
+  if (index >= m_generation.size() || !m_scheduled[index])
+    return;
+
+  m_generation[index]++;
+  m_scheduled[index] = false;
+  m_live--;
+}
+
+bool Scheduler::popDue(long long now, int& id)
+{
+  while (!m_queue.empty())
+  {
+    const ScheduledAction& top = m_queue.front();
+    auto index = static_cast<size_t>(top.id);
+
+    // Skip entries that were rescheduled or cancelled
+    if (top.generation != m_generation[index])
+    {
+      pop();
+      continue;
+    }
+
+    if (top.due > now)
+      return false;
+
+    id = top.id;
+    m_scheduled[index] = false;
+    m_live--;
+    pop();
+    return true;
+  }
+
+  return false;
+}
+
+bool Scheduler::isScheduled(int id) const
+{
+  auto index = static_cast<size_t>(id);
+  return index < m_scheduled.size() && m_scheduled[index];
+}
+
+void Scheduler::clear()
+{
+  m_queue.clear();
+  m_generation.clear();
+  m_scheduled.clear();
+  m_live = 0;
+}
+
+void Scheduler::compact()
+{
+  // Rebuild the heap with only the current entry of every scheduled id
+  std::vector<ScheduledAction> live;
+  live.reserve(static_cast<size_t>(m_live));
+  while (!m_queue.empty())
+  {
+    const ScheduledAction& top = m_queue.front();
+    if (top.generation == m_generation[static_cast<size_t>(top.id)])
+    {
+      live.push_back(top);
+    }
+    pop();
+  }
+  m_queue = std::move(live);
+  std::make_heap(m_queue.begin(), m_queue.end(), CompareAction());
+}
+
+void Scheduler::pop()
+{
+  std::pop_heap(m_queue.begin(), m_queue.end(), CompareAction());
+  m_queue.pop_back();
+}
+
+void Scheduler::save(std::vector<ScheduledAction>& queue, std::vector<unsigned int>& generations,
+                     std::vector<uint8_t>& scheduled) const
+{
+  queue = m_queue;
+  generations = m_generation;
+  scheduled.assign(m_scheduled.begin(), m_scheduled.end());
+}
+
+// shift moves every due time, the heap order stays the same
+void Scheduler::restore(const std::vector<ScheduledAction>& queue, const std::vector<unsigned int>& generations,
+                        const std::vector<uint8_t>& scheduled, long long shift)
+{
+  m_queue = queue;
+  for (ScheduledAction& action : m_queue)
+  {
+    action.due += shift;
+  }
+  m_generation = generations;
+  m_scheduled.assign(scheduled.begin(), scheduled.end());
+  m_live = static_cast<int>(std::count(m_scheduled.begin(), m_scheduled.end(), true));
+}
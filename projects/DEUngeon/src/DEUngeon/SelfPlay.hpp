@@ -0,0 +1,511 @@
+#pragma once
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "Bot.hpp"
+#include "Engine.hpp"
+#include "FlowField.hpp"
+#include "Jobs.hpp"
+#include "Snapshot.hpp"
+
+// Presses a random direction every player step, now and then a power-up.
+// A baseline the other policies should beat.
+class RandomBot : public BotPolicy
+{
+public:
+  const char* name() const override;
+  void newGame(unsigned int seed) override;
+  int nextKey(const Engine& engine) override;
+
+private:
+  std::mt19937 m_gen;
+  long long m_nextMove{};
+};
+
+// Steps to the neighbour farthest from the enemies around it, collects
+// power-ups while nothing is close, dashes when an enemy is adjacent and
+// bombs when a blast would catch several enemies or there is no way out.
+// With nothing left to collect it heads down the stairs, if there are any.
+class GreedyEvadeBot : public BotPolicy
+{
+public:
+  static constexpr int SCAN_RADIUS{ 8 };
+  static constexpr int SAFE_DISTANCE{ 4 };
+  static constexpr int BOMB_RADIUS{ 5 };
+  static constexpr int LOOT_DISTANCE{ 48 };
+
+  const char* name() const override;
+  void newGame(unsigned int seed) override;
+  int nextKey(const Engine& engine) override;
+
+private:
+  std::vector<Point> m_threats;
+  FlowField m_loot;
+  FlowField m_stairs;
+  Point m_stairsAt{ -1, -1 };
+  unsigned int m_stairsRevision{};
+  long long m_nextMove{};
+
+  void scanThreats(const Engine& engine, Point from);
+  int threatDistance(Point p) const;
+  bool findLoot(const Engine& engine, Point from, Point& next);
+  bool findStairs(const Engine& engine, Point from, Point& next);
+};
+
+// Plays every choice out on a copy of the game, restored from a snapshot of
+// the real one, and takes the one that stays alive longest and ends farthest
+// from the enemies. Slow next to the others, a yardstick for what they miss.
+class LookaheadBot : public BotPolicy
+{
+public:
+  static constexpr int HORIZON_MS{ 1500 };
+  static constexpr int STEP_MS{ 25 };
+  static constexpr int SCAN_RADIUS{ 8 };
+
+  const char* name() const override;
+  void newGame(unsigned int seed) override;
+  int nextKey(const Engine& engine) override;
+
+private:
+  Snapshot m_root;
+  std::unique_ptr<Engine> m_sim;
+  long long m_nextMove{};
+
+  int nearestThreat() const;
+};
+
+std::unique_ptr<BotPolicy> makeBot(const std::string& name);
+
+struct SelfPlayConfig
+{
+  std::string bot{ "greedy" };
+  int games{ 1000 };
+  unsigned int firstSeed{ 1 };
+  unsigned int threads{};
+  int frameMs{ 5 };
+  int width{ 100 };
+  int height{ 50 };
+  int rooms{ 15 };
+  int floors{ 1 };
+  bool fov{};
+  bool influence{};
+  bool caves{};
+  GameRules rules;
+  HordeConfig horde;
+};
+
+// costUs is the CPU time the game took on its worker, so games that wait
+// for a core on a busy machine do not look slower
+struct SelfPlayGame
+{
+  unsigned int seed;
+  bool won;
+  long long playMs;
+  long long frames;
+  long long costUs;
+};
+
+long long threadCpuUs();
+std::vector<SelfPlayGame> selfPlay(const SelfPlayConfig& config);
+void writeSelfPlayCsv(std::ostream& out, const SelfPlayConfig& config, const std::vector<SelfPlayGame>& games,
+                      double wallMs, bool header);
+
+const char* RandomBot::name() const
+{
+  return "random";
+}
+
+void RandomBot::newGame(unsigned int seed)
+{
+  m_gen.seed(seed);
+  m_nextMove = 0;
+}
+
+int RandomBot::nextKey(const Engine& engine)
+{
+  if (engine.getNow() < m_nextMove)
+    return 0;
+
+  m_nextMove = engine.getNow() + engine.getPlayer().moveDelay;
+  const int keys[] = { TK_UP, TK_DOWN, TK_LEFT, TK_RIGHT };
+  int roll = std::uniform_int_distribution<int>(0, 99)(m_gen);
+  if (roll < 3)
+    return TK_SHIFT;
+  if (roll < 5)
+    return TK_SPACE;
+
+  return keys[roll % 4];
+}
+
+const char* GreedyEvadeBot::name() const
+{
+  return "greedy";
+}
+
+void GreedyEvadeBot::newGame(unsigned int)
+{
+  m_nextMove = 0;
+}
+
+int GreedyEvadeBot::nextKey(const Engine& engine)
+{
+  const Player& player = engine.getPlayer();
+  if (player.isDashing() || engine.getNow() < m_nextMove)
+    return 0;
+
+  m_nextMove = engine.getNow() + player.moveDelay;
+  const Map& map = engine.getMap();
+  Point pos = engine.getActors().getPos(player.actor);
+  scanThreats(engine, pos);
+
+  int nearest = threatDistance(pos);
+  int inBlast = 0;
+  for (const Point& t : m_threats)
+  {
+    if (std::abs(t.x - pos.x) <= BOMB_RADIUS && std::abs(t.y - pos.y) <= BOMB_RADIUS)
+    {
+      inBlast++;
+    }
+  }
+
+  // Dashing through an enemy stuns it, so an adjacent one is the cue
+  if (nearest <= 1 && player.dashes > 0)
+    return TK_SHIFT;
+  if (player.destroys > 0 && (inBlast >= 3 || (nearest <= 1 && inBlast > 0)))
+    return TK_SPACE;
+
+  const Point around[] = { Point(pos.x, pos.y - 1), Point(pos.x, pos.y + 1), Point(pos.x - 1, pos.y), Point(pos.x + 1, pos.y) };
+  const int keys[] = { TK_UP, TK_DOWN, TK_LEFT, TK_RIGHT };
+  Point next;
+  if (nearest > SAFE_DISTANCE
+      && (findLoot(engine, pos, next) || findStairs(engine, pos, next)) && threatDistance(next) > SAFE_DISTANCE)
+  {
+    for (int i = 0; i < 4; i++)
+    {
+      if (around[i] == next)
+        return keys[i];
+    }
+  }
+
+  // Fixed neighbour order keeps ties, and so whole games, deterministic
+  int best = -1;
+  int bestDistance = nearest;
+  for (int i = 0; i < 4; i++)
+  {
+    const Point& p = around[i];
+    if (!map.inBounds(p.x, p.y) || map.board[p.y][p.x].blocking)
+      continue;
+
+    int d = threatDistance(p);
+    if (d > bestDistance)
+    {
+      best = i;
+      bestDistance = d;
+    }
+  }
+  return best < 0 ? 0 : keys[best];
+}
+
+// Enemies around the player that are not stunned
+void GreedyEvadeBot::scanThreats(const Engine& engine, Point from)
+{
+  const Actors& actors = engine.getActors();
+  const SpatialGrid& enemies = engine.getEnemyGrid();
+  m_threats.clear();
+  for (int y = from.y - SCAN_RADIUS; y <= from.y + SCAN_RADIUS; y++)
+  {
+    for (int x = from.x - SCAN_RADIUS; x <= from.x + SCAN_RADIUS; x++)
+    {
+      if (!enemies.inBounds(x, y))
+        continue;
+
+      for (int id = enemies.first(x, y); id != SpatialGrid::NONE; id = enemies.next(id))
+      {
+        if (!actors.faded[static_cast<size_t>(actors.slot(id))])
+        {
+          m_threats.push_back(Point(x, y));
+        }
+      }
+    }
+  }
+}
+
+// Steps to the nearest threat, ignoring walls; past the scan radius if none
+int GreedyEvadeBot::threatDistance(Point p) const
+{
+  int nearest = SCAN_RADIUS * 2 + 1;
+  for (const Point& t : m_threats)
+  {
+    nearest = std::min(nearest, std::abs(t.x - p.x) + std::abs(t.y - p.y));
+  }
+  return nearest;
+}
+
+// Next step towards the closest power-up. The field is rebuilt only when the
+// target or the terrain changed.
+bool GreedyEvadeBot::findLoot(const Engine& engine, Point from, Point& next)
+{
+  const Actors& actors = engine.getActors();
+  Point goal(-1, -1);
+  int goalDistance = LOOT_DISTANCE + 1;
+  for (int s = 0; s < actors.size(); s++)
+  {
+    ActorKind kind = actors.kind[static_cast<size_t>(s)];
+    if (kind != ActorKind::DASH && kind != ActorKind::DESTROY)
+      continue;
+
+    const Point& p = actors.pos[static_cast<size_t>(s)];
+    int d = std::abs(p.x - from.x) + std::abs(p.y - from.y);
+    if (d < goalDistance)
+    {
+      goal = p;
+      goalDistance = d;
+    }
+  }
+  if (goal.x < 0)
+    return false;
+
+  if (!m_loot.isCurrent(engine.getMap(), goal))
+  {
+    m_loot.build(engine.getMap(), goal, LOOT_DISTANCE);
+  }
+  return m_loot.step(from, next);
+}
+
+// Next step towards the stairs down. They are looked up again only when
+// the terrain changed, by a blast or by taking stairs.
+bool GreedyEvadeBot::findStairs(const Engine& engine, Point from, Point& next)
+{
+  const Map& map = engine.getMap();
+  if (m_stairsRevision != map.revision)
+  {
+    m_stairsRevision = map.revision;
+    m_stairsAt = map.find(TERRAIN::STAIRS_DOWN);
+  }
+  if (m_stairsAt.x < 0)
+    return false;
+
+  if (!m_stairs.isCurrent(map, m_stairsAt))
+  {
+    m_stairs.build(map, m_stairsAt, map.map_w * map.map_h);
+  }
+  return m_stairs.step(from, next);
+}
+
+const char* LookaheadBot::name() const
+{
+  return "lookahead";
+}
+
+void LookaheadBot::newGame(unsigned int)
+{
+  m_nextMove = 0;
+}
+
+int LookaheadBot::nextKey(const Engine& engine)
+{
+  const Player& player = engine.getPlayer();
+  if (player.isDashing() || engine.getNow() < m_nextMove)
+    return 0;
+
+  m_nextMove = engine.getNow() + player.moveDelay;
+  engine.capture(m_root);
+  if (!m_sim)
+  {
+    m_sim = std::make_unique<Engine>(engine.getMap().map_w, engine.getMap().map_h, 1, engine.getSeed(), true, 1);
+    m_sim->settingsFrom(engine);
+  }
+
+  const int keys[] = { 0, TK_UP, TK_DOWN, TK_LEFT, TK_RIGHT, TK_SHIFT, TK_SPACE };
+  int best = 0;
+  long long bestScore = -1;
+  for (int key : keys)
+  {
+    if ((key == TK_SHIFT && player.dashes == 0) || (key == TK_SPACE && player.destroys == 0))
+      continue;
+
+    // A direction is held for the whole branch, power-ups are used once.
+    // A game the copy cannot take up is left to carry on as it is.
+    if (!m_sim->restore(m_root))
+      return 0;
+
+    int hold = key == TK_SHIFT || key == TK_SPACE ? 0 : key;
+    long long survived = 0;
+    bool alive = m_sim->step(key, STEP_MS);
+    while (alive && survived < HORIZON_MS)
+    {
+      alive = m_sim->step(hold, STEP_MS);
+      survived += STEP_MS;
+    }
+    if (m_sim->won())
+    {
+      survived = HORIZON_MS;
+    }
+
+    // Power-ups are spent only when they buy time
+    long long score = survived * 100 + nearestThreat() - (key == TK_SHIFT || key == TK_SPACE ? 50 : 0);
+    if (score > bestScore)
+    {
+      best = key;
+      bestScore = score;
+    }
+  }
+  return best;
+}
+
+// Steps from the simulated player to the closest enemy that is not stunned
+int LookaheadBot::nearestThreat() const
+{
+  const Actors& actors = m_sim->getActors();
+  const SpatialGrid& enemies = m_sim->getEnemyGrid();
+  Point from = actors.getPos(m_sim->getPlayer().actor);
+  int nearest = SCAN_RADIUS * 2 + 1;
+  for (int y = from.y - SCAN_RADIUS; y <= from.y + SCAN_RADIUS; y++)
+  {
+    for (int x = from.x - SCAN_RADIUS; x <= from.x + SCAN_RADIUS; x++)
+    {
+      if (!enemies.inBounds(x, y))
+        continue;
+
+      for (int id = enemies.first(x, y); id != SpatialGrid::NONE; id = enemies.next(id))
+      {
+        if (!actors.faded[static_cast<size_t>(actors.slot(id))])
+        {
+          nearest = std::min(nearest, std::abs(x - from.x) + std::abs(y - from.y));
+        }
+      }
+    }
+  }
+  return nearest;
+}
+
+std::unique_ptr<BotPolicy> makeBot(const std::string& name)
+{
+  if (name == "greedy")
+    return std::make_unique<GreedyEvadeBot>();
+  if (name == "random")
+    return std::make_unique<RandomBot>();
+  if (name == "lookahead")
+    return std::make_unique<LookaheadBot>();
+
+  return nullptr;
+}
+
+// CPU time the calling thread has used so far
+long long threadCpuUs()
+{
+#ifdef _WIN32
+  FILETIME creation, exit, kernel, user;
+  if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user))
+    return 0;
+
+  // Both are counts of 100 ns
+  auto ticks = [](const FILETIME& t) {
+    return static_cast<long long>(t.dwHighDateTime) << 32 | t.dwLowDateTime;
+  };
+  return (ticks(kernel) + ticks(user)) / 10;
+#else
+  timespec now{};
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now) != 0)
+    return 0;
+
+  return static_cast<long long>(now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+#endif
+}
+
+// Plays config.games seeded games headless, one per job on a work-stealing
+// pool. Every worker keeps one engine and one bot and resets them between
+// games; the results are in seed order whatever the thread count.
+std::vector<SelfPlayGame> selfPlay(const SelfPlayConfig& config)
+{
+  struct Seat
+  {
+    std::unique_ptr<Engine> engine;
+    std::unique_ptr<BotPolicy> bot;
+  };
+
+  JobSystem jobs(config.threads != 0 ? config.threads : std::thread::hardware_concurrency());
+  std::vector<Seat> seats(static_cast<size_t>(jobs.workers()));
+  std::vector<SelfPlayGame> games(static_cast<size_t>(std::max(config.games, 0)));
+  JobGraph graph;
+  for (size_t g = 0; g < games.size(); g++)
+  {
+    graph.add([&, g](int worker) {
+      long long start = threadCpuUs();
+      auto seed = config.firstSeed + static_cast<unsigned int>(g);
+      Seat& seat = seats[static_cast<size_t>(worker)];
+      if (!seat.engine)
+      {
+        // The games run side by side already, each one searches on its own
+        seat.engine = std::make_unique<Engine>(config.width, config.height, config.rooms, seed, true, 1);
+        seat.engine->caves(config.caves);
+        seat.engine->horde(config.horde);
+        if (config.floors > 1)
+        {
+          seat.engine->floors(config.floors);
+        }
+        seat.engine->fieldOfView(config.fov);
+        seat.engine->influence(config.influence);
+        seat.engine->rules(config.rules);
+        seat.bot = makeBot(config.bot);
+        seat.engine->autoplay(seat.bot.get(), config.frameMs);
+      }
+      else
+      {
+        seat.engine->reset(seed);
+      }
+
+      Engine& eng = *seat.engine;
+      eng.gameLoop();
+      games[g] = SelfPlayGame{ seed, eng.won(), eng.getPlayTime(), eng.getFrames(), threadCpuUs() - start };
+    });
+  }
+  jobs.run(graph);
+  return games;
+}
+
+// One aggregated row per run, so sweeps over rules can append to one file
+void writeSelfPlayCsv(std::ostream& out, const SelfPlayConfig& config, const std::vector<SelfPlayGame>& games,
+                      double wallMs, bool header)
+{
+  if (header)
+  {
+    out << "bot,enemy_delays,dash_power_ups,destroy_power_ups,game_time,horde,games,wins,win_rate,"
+        << "mean_survival_s,min_survival_s,mean_cost_us,max_cost_us,frames,wall_ms\n";
+  }
+
+  long long wins = 0;
+  long long playMs = 0;
+  long long minPlayMs = games.empty() ? 0 : std::numeric_limits<long long>::max();
+  long long costUs = 0;
+  long long maxCostUs = 0;
+  long long frames = 0;
+  for (const SelfPlayGame& g : games)
+  {
+    wins += g.won ? 1 : 0;
+    playMs += g.playMs;
+    minPlayMs = std::min(minPlayMs, g.playMs);
+    costUs += g.costUs;
+    maxCostUs = std::max(maxCostUs, g.costUs);
+    frames += g.frames;
+  }
+  double count = games.empty() ? 1.0 : static_cast<double>(games.size());
+
+  const GameRules& rules = config.rules;
+  out << config.bot << ',' << rules.enemyDelays[0] << '/' << rules.enemyDelays[1] << '/' << rules.enemyDelays[2] << '/'
+      << rules.enemyDelays[3] << '/' << rules.enemyDelays[4] << ',' << rules.dashPowerUps << ','
+      << rules.destroyPowerUps << ',' << rules.gameTime << ',' << config.horde.enemies << ',' << games.size() << ','
+      << wins << ',' << wins / count << ',' << playMs / count / 1000.0 << ',' << minPlayMs / 1000.0 << ','
+      << costUs / count << ',' << maxCostUs << ',' << frames << ',' << wallMs << '\n';
+  out.flush();
+}
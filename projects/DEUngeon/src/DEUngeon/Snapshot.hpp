@@ -0,0 +1,218 @@
+#pragma once
+
+#include "Actor.hpp"
+#include "Player.hpp"
+#include "Replay.hpp"
+#include "Scheduler.hpp"
+
+// Save file layout: "DEUS" version, the SnapshotHeader, the tiles as one
+// (blocking, terrain) byte pair each, then every array as a 32-bit count
+// followed by its elements as they are in memory, and the horde generator
+// as text. A file is only meant to be read by the build that wrote it.
+constexpr char SNAPSHOT_MAGIC[4]{ 'D', 'E', 'U', 'S' };
+constexpr uint32_t SNAPSHOT_VERSION{ 3 };
+
+using TileRow = std::vector<Point>;
+
+// The fixed-size part of a snapshot. modes holds the REPLAY_ flags of the
+// game modes it was taken in, floor the floor of the dungeon it shows.
+struct SnapshotHeader
+{
+  int width;
+  int height;
+  unsigned int seed;
+  uint8_t state;
+  long long now;
+  long long startTime;
+  long long frames;
+  long long gameTimer;
+  int gameTime;
+  int actorIds;
+  int horde;
+  int floor;
+  uint64_t modes;
+};
+
+// Everything of a running game that is not derived from other state. The
+// parts are flat arrays of plain data, so taking or restoring one is a few
+// vector copies. Map rows are shared with the engine and other snapshots
+// and only copied once a row changed.
+class Snapshot
+{
+public:
+  SnapshotHeader header{};
+  std::vector<std::shared_ptr<const TileRow>> rows;
+  std::vector<Player> players;
+  std::vector<ActorRecord> actors;
+  std::vector<ActorId> freeIds;
+  std::vector<ColorName> palette;
+  std::vector<ScheduledAction> schedule;
+  std::vector<unsigned int> generations;
+  std::vector<uint8_t> scheduled;
+  std::vector<uint8_t> asleep;
+  std::vector<uint64_t> explored;
+  std::mt19937 hordeGen;
+
+  bool save(const char* path) const;
+  bool save(std::ostream& out) const;
+  bool load(const char* path);
+  bool load(std::istream& in);
+
+private:
+  static constexpr uint32_t MAX_COUNT{ 1u << 24 };
+
+  template <typename T>
+  static void write(std::ostream& out, const std::vector<T>& items);
+  template <typename T>
+  static bool read(std::istream& in, std::vector<T>& items);
+};
+
+bool Snapshot::save(const char* path) const
+{
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  return out && save(out);
+}
+
+bool Snapshot::save(std::ostream& out) const
+{
+  out.write(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+  out.write(reinterpret_cast<const char*>(&SNAPSHOT_VERSION), sizeof(SNAPSHOT_VERSION));
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+  std::vector<uint8_t> tiles;
+  tiles.reserve(static_cast<size_t>(header.width) * static_cast<size_t>(header.height) * 2);
+  for (const auto& row : rows)
+  {
+    for (const Point& tile : *row)
+    {
+      tiles.push_back(tile.blocking ? 1 : 0);
+      tiles.push_back(static_cast<uint8_t>(tile.terrain));
+    }
+  }
+  write(out, tiles);
+  write(out, players);
+  write(out, actors);
+  write(out, freeIds);
+  write(out, palette);
+  write(out, schedule);
+  write(out, generations);
+  write(out, scheduled);
+  write(out, asleep);
+  write(out, explored);
+
+  std::ostringstream gen;
+  gen << hordeGen;
+  std::string text = gen.str();
+  write(out, std::vector<char>(text.begin(), text.end()));
+  return static_cast<bool>(out);
+}
+
+bool Snapshot::load(const char* path)
+{
+  std::ifstream in(path, std::ios::binary);
+  return in && load(in);
+}
+
+bool Snapshot::load(std::istream& in)
+{
+  char magic[4]{};
+  uint32_t version{};
+  in.read(magic, sizeof(magic));
+  in.read(reinterpret_cast<char*>(&version), sizeof(version));
+  if (!in || !std::equal(magic, magic + 4, SNAPSHOT_MAGIC) || version != SNAPSHOT_VERSION)
+    return false;
+
+  in.read(reinterpret_cast<char*>(&header), sizeof(header));
+  std::vector<uint8_t> tiles;
+  if (!in || header.width <= 0 || header.height <= 0 || header.floor < 0 || !read(in, tiles)
+      || tiles.size() != static_cast<size_t>(header.width) * static_cast<size_t>(header.height) * 2)
+    return false;
+
+  rows.clear();
+  size_t t = 0;
+  for (int y = 0; y < header.height; y++)
+  {
+    auto row = std::make_shared<TileRow>(static_cast<size_t>(header.width));
+    for (int x = 0; x < header.width; x++, t += 2)
+    {
+      (*row)[static_cast<size_t>(x)] = Point(x, y, tiles[t] != 0, static_cast<TERRAIN>(tiles[t + 1]));
+    }
+    rows.push_back(std::move(row));
+  }
+
+  std::vector<char> gen;
+  if (!read(in, players) || !read(in, actors) || !read(in, freeIds) || !read(in, palette) || !read(in, schedule)
+      || !read(in, generations) || !read(in, scheduled) || !read(in, asleep) || !read(in, explored) || !read(in, gen))
+    return false;
+
+  // Ids, kinds, positions and colors index other arrays, refuse files where
+  // they would not
+  if (header.actorIds < 0 || static_cast<uint32_t>(header.actorIds) > MAX_COUNT)
+    return false;
+
+  for (ColorName& color : palette)
+  {
+    color.name[sizeof(color.name) - 1] = '\0';
+  }
+  std::vector<bool> alive(static_cast<size_t>(header.actorIds));
+  for (const ActorRecord& a : actors)
+  {
+    if (a.id < 0 || a.id >= header.actorIds || alive[static_cast<size_t>(a.id)] || a.kind >= ActorKind::COUNT
+        || a.pos.x < 0 || a.pos.y < 0 || a.pos.x >= header.width || a.pos.y >= header.height
+        || a.colorId >= palette.size() || a.originalColorId >= palette.size())
+      return false;
+
+    alive[static_cast<size_t>(a.id)] = true;
+  }
+  for (ActorId id : freeIds)
+  {
+    if (id < 0 || id >= header.actorIds)
+      return false;
+  }
+  for (const Player& player : players)
+  {
+    if (player.actor < Actors::NONE || player.actor >= header.actorIds
+        || (player.actor != Actors::NONE && !alive[static_cast<size_t>(player.actor)]))
+      return false;
+  }
+  if (players.empty() || scheduled.size() != generations.size())
+    return false;
+  // Entries of removed actors stay behind cancelled, only current ones are
+  // ever popped and need a live actor
+  for (const ScheduledAction& action : schedule)
+  {
+    if (action.id < 0 || static_cast<size_t>(action.id) >= generations.size())
+      return false;
+
+    auto index = static_cast<size_t>(action.id);
+    if (action.generation == generations[index] && (action.id >= header.actorIds || !alive[index]))
+      return false;
+  }
+
+  std::istringstream genText(std::string(gen.begin(), gen.end()));
+  genText >> hordeGen;
+  return static_cast<bool>(genText);
+}
+
+template <typename T>
+void Snapshot::write(std::ostream& out, const std::vector<T>& items)
+{
+  static_assert(std::is_trivially_copyable_v<T>);
+  auto count = static_cast<uint32_t>(items.size());
+  out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+  out.write(reinterpret_cast<const char*>(items.data()), static_cast<std::streamsize>(items.size() * sizeof(T)));
+}
+
+template <typename T>
+bool Snapshot::read(std::istream& in, std::vector<T>& items)
+{
+  static_assert(std::is_trivially_copyable_v<T>);
+  uint32_t count{};
+  in.read(reinterpret_cast<char*>(&count), sizeof(count));
+  if (!in || count > MAX_COUNT)
+    return false;
+
+  items.resize(count);
+  in.read(reinterpret_cast<char*>(items.data()), static_cast<std::streamsize>(count * sizeof(T)));
+  return static_cast<bool>(in);
+}
@@ -0,0 +1,165 @@
+#pragma once
+
+#include "Map.hpp"
+
+// Per-tile occupancy lists of actor ids, linked through per-id arrays so that
+// insert, remove and move are O(1) and a tile query only touches its occupants
+class SpatialGrid
+{
+public:
+  static constexpr int NONE{ -1 };
+
+  SpatialGrid() {}
+  SpatialGrid(int w, int h);
+  void resize(int w, int h);
+  void clear();
+  bool inBounds(int x, int y) const;
+  void insert(int id, Point pos);
+  void remove(int id);
+  void move(int id, Point pos);
+  bool contains(int id) const;
+  int first(int x, int y) const;
+  int next(int id) const;
+
+private:
+  int m_w{};
+  int m_h{};
+  std::vector<int> m_head;
+  std::vector<int> m_next;
+  std::vector<int> m_prev;
+  std::vector<int> m_cell;
+
+  void link(int id, int cell);
+  void unlink(int id);
+};
+
+SpatialGrid::SpatialGrid(int w, int h)
+{
+  resize(w, h);
+}
+
+void SpatialGrid::resize(int w, int h)
+{
+  m_w = w;
+  m_h = h;
+  m_head.assign(static_cast<size_t>(w * h), NONE);
+  m_next.clear();
+  m_prev.clear();
+  m_cell.clear();
+}
+
+void SpatialGrid::clear()
+{
+  std::fill(m_head.begin(), m_head.end(), NONE);
+  m_next.clear();
+  m_prev.clear();
+  m_cell.clear();
+}
+
+bool SpatialGrid::inBounds(int x, int y) const
+{
+  return x >= 0 && x < m_w && y >= 0 && y < m_h;
+}
+
+void SpatialGrid::insert(int id, Point pos)
+{
+  auto index = static_cast<size_t>(id);
+  if (index >= m_cell.size())
+  {
+    m_next.resize(index + 1, NONE);
+    m_prev.resize(index + 1, NONE);
+    m_cell.resize(index + 1, NONE);
+  }
+
+  if (m_cell[index] != NONE)
+  {
+    unlink(id);
+  }
+
+  if (inBounds(pos.x, pos.y))
+  {
+    link(id, pos.y * m_w + pos.x);
+  }
+}
+
+void SpatialGrid::remove(int id)
+{
+  if (contains(id))
+  {
+    unlink(id);
+  }
+}
+
+void SpatialGrid::move(int id, Point pos)
+{
+  if (!contains(id))
+    return;
+
+  if (!inBounds(pos.x, pos.y))
+  {
+    unlink(id);
+    return;
+  }
+
+  int cell = pos.y * m_w + pos.x;
+  if (m_cell[static_cast<size_t>(id)] != cell)
+  {
+    unlink(id);
+    link(id, cell);
+  }
+}
+
+bool SpatialGrid::contains(int id) const
+{
+  auto index = static_cast<size_t>(id);
+  return index < m_cell.size() && m_cell[index] != NONE;
+}
+
+int SpatialGrid::first(int x, int y) const
+{
+  if (!inBounds(x, y))
+    return NONE;
+
+  return m_head[static_cast<size_t>(y * m_w + x)];
+}
+
+int SpatialGrid::next(int id) const
+{
+  return m_next[static_cast<size_t>(id)];
+}
+
+void SpatialGrid::link(int id, int cell)
+{
+  auto index = static_cast<size_t>(id);
+  int head = m_head[static_cast<size_t>(cell)];
+  m_next[index] = head;
+  m_prev[index] = NONE;
+  if (head != NONE)
+  {
+    m_prev[static_cast<size_t>(head)] = id;
+  }
+  m_head[static_cast<size_t>(cell)] = id;
+  m_cell[index] = cell;
+}
+
+void SpatialGrid::unlink(int id)
+{
+  auto index = static_cast<size_t>(id);
+  int prev = m_prev[index];
+  int next = m_next[index];
+  if (prev != NONE)
+  {
+    m_next[static_cast<size_t>(prev)] = next;
+  }
+  else
+  {
+    m_head[static_cast<size_t>(m_cell[index])] = next;
+  }
+  if (next != NONE)
+  {
+    m_prev[static_cast<size_t>(next)] = prev;
+  }
+  m_next[index] = NONE;
+  m_prev[index] = NONE;
+  m_cell[index] = NONE;
+}
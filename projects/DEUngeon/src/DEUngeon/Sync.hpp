@@ -0,0 +1,439 @@
+#pragma once
+
+#include "Engine.hpp"
+#include "Net.hpp"
+
+// Delta layout, all integers are varints:
+//   tiles  : mode, then for SPARSE a count and (index gap, tile) pairs, for
+//            RUNS (length, tile) pairs covering the whole map
+//   actors : count, then (id gap, flags) per changed actor, followed by
+//            SPAWN : kind sym color x y
+//            MOVE  : dx dy, zigzag encoded
+//            LOOK  : sym color
+//            REMOVE: nothing
+//   hud    : mask, then the game time and state where their bit is set
+// A tile is one byte, blocking << 7 | terrain.
+enum class TileMode : uint8_t
+{
+  SAME,
+  SPARSE,
+  RUNS
+};
+
+// An actor as a client sees it, ids index the array
+struct MirrorActor
+{
+  bool alive;
+  ActorKind kind;
+  char sym;
+  color_t color;
+  int x;
+  int y;
+};
+
+// What everyone in a game sees: tiles, actors and the shared counters. The
+// server keeps the one it sent last and encodes only what changed since,
+// once per tick for all clients. A client applies the deltas to its own
+// copy; a delta from an empty mirror is the whole game.
+class WorldMirror
+{
+public:
+  static constexpr uint8_t SPAWN{ 1 };
+  static constexpr uint8_t MOVE{ 2 };
+  static constexpr uint8_t LOOK{ 4 };
+  static constexpr uint8_t REMOVE{ 8 };
+  static constexpr uint8_t HUD_TIME{ 1 };
+  static constexpr uint8_t HUD_STATE{ 2 };
+  static constexpr uint64_t MAX_ACTORS{ 1u << 20 };
+
+  int width{};
+  int height{};
+  std::vector<uint8_t> tiles;
+  std::vector<MirrorActor> actors;
+  int gameTime{};
+  GameState state{ GameState::PAUSED };
+
+  void resize(int w, int h);
+  void capture(const Engine& engine);
+  void encode(const WorldMirror& base, ByteWriter& out) const;
+  bool apply(ByteReader& in);
+  uint64_t checksum() const;
+  void render(Frame& frame) const;
+
+private:
+  unsigned int m_revision{};
+
+  void encodeTiles(const WorldMirror& base, ByteWriter& out) const;
+  void encodeActors(const WorldMirror& base, ByteWriter& out) const;
+  bool applyTiles(ByteReader& in);
+  bool applyActors(ByteReader& in);
+};
+
+void WorldMirror::resize(int w, int h)
+{
+  width = w;
+  height = h;
+  tiles.assign(static_cast<size_t>(w) * static_cast<size_t>(h), 0);
+  actors.clear();
+  m_revision = 0;
+}
+
+// Takes the state of the game. Tiles are only copied when the board has a
+// new revision.
+void WorldMirror::capture(const Engine& engine)
+{
+  const Map& map = engine.getMap();
+  if (width != map.map_w || height != map.map_h)
+  {
+    resize(map.map_w, map.map_h);
+  }
+  if (m_revision != map.revision)
+  {
+    size_t i = 0;
+    for (const auto& row : map.board)
+    {
+      for (const Point& tile : row)
+      {
+        tiles[i++] = static_cast<uint8_t>((tile.blocking ? 0x80 : 0) | static_cast<uint8_t>(tile.terrain));
+      }
+    }
+    m_revision = map.revision;
+  }
+
+  const Actors& a = engine.getActors();
+  for (MirrorActor& actor : actors)
+  {
+    actor.alive = false;
+  }
+  for (int s = 0; s < a.size(); s++)
+  {
+    auto slot = static_cast<size_t>(s);
+    auto id = static_cast<size_t>(a.id[slot]);
+    if (id >= actors.size())
+    {
+      actors.resize(id + 1, MirrorActor{});
+    }
+    actors[id] = MirrorActor{ true, a.kind[slot], a.sym[slot], a.drawColor(s), a.pos[slot].x, a.pos[slot].y };
+  }
+  gameTime = engine.getGameTime();
+  state = engine.getState();
+}
+
+void WorldMirror::encode(const WorldMirror& base, ByteWriter& out) const
+{
+  encodeTiles(base, out);
+  encodeActors(base, out);
+
+  uint8_t mask = (gameTime != base.gameTime ? HUD_TIME : 0) | (state != base.state ? HUD_STATE : 0);
+  out.u8(mask);
+  if (mask & HUD_TIME)
+  {
+    out.varint(static_cast<uint64_t>(gameTime));
+  }
+  if (mask & HUD_STATE)
+  {
+    out.u8(static_cast<uint8_t>(state));
+  }
+}
+
+// Bombs change a few hundred tiles at most, those go as a list. A new
+// level or a new client gets the whole map in runs, rock and floor come in
+// long stretches.
+void WorldMirror::encodeTiles(const WorldMirror& base, ByteWriter& out) const
+{
+  // Captures of the same board revision hold the same tiles
+  bool runs = base.tiles.size() != tiles.size();
+  if (!runs && m_revision != 0 && m_revision == base.m_revision)
+  {
+    out.u8(static_cast<uint8_t>(TileMode::SAME));
+    return;
+  }
+
+  size_t changed = 0;
+  if (!runs)
+  {
+    for (size_t i = 0; i < tiles.size(); i++)
+    {
+      changed += tiles[i] != base.tiles[i] ? 1 : 0;
+    }
+    runs = changed > tiles.size() / 16;
+  }
+
+  if (runs)
+  {
+    out.u8(static_cast<uint8_t>(TileMode::RUNS));
+    for (size_t i = 0; i < tiles.size();)
+    {
+      size_t end = i + 1;
+      while (end < tiles.size() && tiles[end] == tiles[i])
+      {
+        end++;
+      }
+      out.varint(end - i);
+      out.u8(tiles[i]);
+      i = end;
+    }
+    return;
+  }
+  if (changed == 0)
+  {
+    out.u8(static_cast<uint8_t>(TileMode::SAME));
+    return;
+  }
+
+  out.u8(static_cast<uint8_t>(TileMode::SPARSE));
+  out.varint(changed);
+  size_t last = 0;
+  for (size_t i = 0; i < tiles.size(); i++)
+  {
+    if (tiles[i] != base.tiles[i])
+    {
+      out.varint(i - last);
+      out.u8(tiles[i]);
+      last = i;
+    }
+  }
+}
+
+void WorldMirror::encodeActors(const WorldMirror& base, ByteWriter& out) const
+{
+  ByteWriter changes;
+  size_t count = 0;
+  size_t last = 0;
+  size_t ids = std::max(actors.size(), base.actors.size());
+  for (size_t id = 0; id < ids; id++)
+  {
+    MirrorActor now = id < actors.size() ? actors[id] : MirrorActor{};
+    MirrorActor was = id < base.actors.size() ? base.actors[id] : MirrorActor{};
+    if (!now.alive && !was.alive)
+      continue;
+
+    uint8_t flags{};
+    if (!now.alive)
+    {
+      flags = REMOVE;
+    }
+    else if (!was.alive || was.kind != now.kind)
+    {
+      flags = SPAWN;
+    }
+    else
+    {
+      flags = static_cast<uint8_t>((now.x != was.x || now.y != was.y ? MOVE : 0)
+                                   | (now.sym != was.sym || now.color != was.color ? LOOK : 0));
+    }
+    if (flags == 0)
+      continue;
+
+    changes.varint(id - last);
+    changes.u8(flags);
+    last = id;
+    count++;
+    if (flags & SPAWN)
+    {
+      changes.u8(static_cast<uint8_t>(now.kind));
+      changes.u8(static_cast<uint8_t>(now.sym));
+      changes.varint(now.color);
+      changes.varint(static_cast<uint64_t>(now.x));
+      changes.varint(static_cast<uint64_t>(now.y));
+    }
+    if (flags & MOVE)
+    {
+      changes.svarint(now.x - was.x);
+      changes.svarint(now.y - was.y);
+    }
+    if (flags & LOOK)
+    {
+      changes.u8(static_cast<uint8_t>(now.sym));
+      changes.varint(now.color);
+    }
+  }
+  out.varint(count);
+  out.append(changes.bytes);
+}
+
+// False for a delta that does not fit this mirror, which is then left half
+// applied
+bool WorldMirror::apply(ByteReader& in)
+{
+  if (!applyTiles(in) || !applyActors(in))
+    return false;
+
+  uint8_t mask{};
+  if (!in.u8(mask))
+    return false;
+
+  uint64_t time{};
+  if ((mask & HUD_TIME) && !in.varint(time))
+    return false;
+
+  uint8_t newState{};
+  if ((mask & HUD_STATE) && !in.u8(newState))
+    return false;
+
+  if (mask & HUD_TIME)
+  {
+    gameTime = static_cast<int>(time);
+  }
+  if (mask & HUD_STATE)
+  {
+    state = static_cast<GameState>(newState);
+  }
+  return true;
+}
+
+bool WorldMirror::applyTiles(ByteReader& in)
+{
+  uint8_t mode{};
+  if (!in.u8(mode))
+    return false;
+
+  if (mode == static_cast<uint8_t>(TileMode::RUNS))
+  {
+    for (size_t i = 0; i < tiles.size();)
+    {
+      uint64_t length{};
+      uint8_t tile{};
+      if (!in.varint(length) || !in.u8(tile) || length == 0 || length > tiles.size() - i)
+        return false;
+
+      std::fill_n(tiles.begin() + static_cast<std::ptrdiff_t>(i), length, tile);
+      i += static_cast<size_t>(length);
+    }
+    return true;
+  }
+  if (mode == static_cast<uint8_t>(TileMode::SPARSE))
+  {
+    uint64_t count{};
+    if (!in.varint(count))
+      return false;
+
+    size_t index = 0;
+    for (uint64_t n = 0; n < count; n++)
+    {
+      uint64_t gap{};
+      uint8_t tile{};
+      if (!in.varint(gap) || !in.u8(tile) || gap >= tiles.size() - index)
+        return false;
+
+      index += static_cast<size_t>(gap);
+      tiles[index] = tile;
+    }
+    return true;
+  }
+  return mode == static_cast<uint8_t>(TileMode::SAME);
+}
+
+bool WorldMirror::applyActors(ByteReader& in)
+{
+  uint64_t count{};
+  if (!in.varint(count))
+    return false;
+
+  uint64_t id = 0;
+  for (uint64_t n = 0; n < count; n++)
+  {
+    uint64_t gap{};
+    uint8_t flags{};
+    if (!in.varint(gap) || !in.u8(flags) || id + gap >= MAX_ACTORS)
+      return false;
+
+    id += gap;
+    if (id >= actors.size())
+    {
+      actors.resize(static_cast<size_t>(id) + 1, MirrorActor{});
+    }
+    MirrorActor& actor = actors[static_cast<size_t>(id)];
+    if (flags & REMOVE)
+    {
+      actor.alive = false;
+    }
+    if (flags & SPAWN)
+    {
+      uint8_t kind{}, sym{};
+      uint64_t color{}, x{}, y{};
+      if (!in.u8(kind) || !in.u8(sym) || !in.varint(color) || !in.varint(x) || !in.varint(y)
+          || kind >= static_cast<uint8_t>(ActorKind::COUNT))
+        return false;
+
+      actor = MirrorActor{ true, static_cast<ActorKind>(kind), static_cast<char>(sym), static_cast<color_t>(color),
+                           static_cast<int>(x), static_cast<int>(y) };
+    }
+    if (flags & MOVE)
+    {
+      long long dx{}, dy{};
+      if (!in.svarint(dx) || !in.svarint(dy))
+        return false;
+
+      actor.x += static_cast<int>(dx);
+      actor.y += static_cast<int>(dy);
+    }
+    if (flags & LOOK)
+    {
+      uint8_t sym{};
+      uint64_t color{};
+      if (!in.u8(sym) || !in.varint(color))
+        return false;
+
+      actor.sym = static_cast<char>(sym);
+      actor.color = static_cast<color_t>(color);
+    }
+  }
+  return true;
+}
+
+// FNV-1a over everything a delta carries, for clients to check that their
+// copy still matches the server's
+uint64_t WorldMirror::checksum() const
+{
+  uint64_t hash = 14695981039346656037ull;
+  auto mix = [&hash](uint64_t value) {
+    hash = (hash ^ value) * 1099511628211ull;
+  };
+  for (uint8_t tile : tiles)
+  {
+    mix(tile);
+  }
+  for (size_t id = 0; id < actors.size(); id++)
+  {
+    const MirrorActor& a = actors[id];
+    if (!a.alive)
+      continue;
+
+    mix(id);
+    mix(static_cast<uint64_t>(a.kind) << 8 | static_cast<uint8_t>(a.sym));
+    mix(a.color);
+    mix(static_cast<uint64_t>(a.x) << 32 | static_cast<uint32_t>(a.y));
+  }
+  mix(static_cast<uint64_t>(gameTime));
+  mix(static_cast<uint64_t>(state));
+  return hash;
+}
+
+// Tiles, then the actors in the order the engine draws them
+void WorldMirror::render(Frame& frame) const
+{
+  TerrainPalette palette;
+  char sym{};
+  color_t color{};
+  for (int y = 0; y < height; y++)
+  {
+    for (int x = 0; x < width; x++)
+    {
+      uint8_t tile = tiles[static_cast<size_t>(y) * static_cast<size_t>(width) + static_cast<size_t>(x)];
+      palette.look(static_cast<TERRAIN>(tile & 0x7F), color, sym);
+      frame.tile(x, y, color, sym);
+    }
+  }
+  const ActorKind order[] = { ActorKind::DASH, ActorKind::DESTROY, ActorKind::PLAYER, ActorKind::ENEMY };
+  for (ActorKind kind : order)
+  {
+    for (const MirrorActor& a : actors)
+    {
+      if (a.alive && a.kind == kind && a.x >= 0 && a.x < width && a.y >= 0 && a.y < height)
+      {
+        frame.actor(a.x, a.y, a.color, a.sym);
+      }
+    }
+  }
+}
@@ -0,0 +1,232 @@
+#pragma once
+
+struct TraceEvent
+{
+  const char* name;
+  const char* argName;
+  long long ts;
+  long long arg;
+  char phase;
+};
+
+// Single-writer ring of events owned by one thread. The writer never
+// blocks; once full, the oldest events are overwritten.
+class TraceBuffer
+{
+public:
+  static constexpr size_t CAPACITY{ 1 << 16 };
+
+  TraceBuffer(int tid)
+    : m_tid(tid)
+    , m_head(0)
+    , m_claim(0)
+    , m_events(new TraceEvent[CAPACITY])
+  {
+  }
+
+  void push(const TraceEvent& event)
+  {
+    // The slot is claimed before it is written, so a copy taken meanwhile
+    // knows to drop it
+    size_t head = m_head.load(std::memory_order_relaxed);
+    m_claim.store(head + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    m_events[head % CAPACITY] = event;
+    m_head.store(head + 1, std::memory_order_release);
+  }
+
+  int tid() const
+  {
+    return m_tid;
+  }
+
+  void copy(std::vector<TraceEvent>& events) const;
+
+private:
+  int m_tid;
+  std::atomic<size_t> m_head;
+  std::atomic<size_t> m_claim;
+  std::unique_ptr<TraceEvent[]> m_events;
+};
+
+// Collects begin/end events from every thread and writes them in the
+// Chrome trace JSON format (chrome://tracing, ui.perfetto.dev)
+class Tracer
+{
+public:
+  std::atomic<bool> enabled{ false };
+
+  static Tracer& instance();
+  void begin(const char* name);
+  void end(const char* name, const char* argName = nullptr, long long arg = 0);
+  bool flush(const char* path);
+
+private:
+  std::mutex m_mutex;
+  std::vector<std::unique_ptr<TraceBuffer>> m_buffers;
+  // Buffers of threads that ended, for the next threads to write on
+  std::vector<TraceBuffer*> m_free;
+  long long m_epoch{ now() };
+
+  static long long now();
+  TraceBuffer& local();
+  void release(TraceBuffer* buffer);
+};
+
+// Emits a begin event now and the matching end event at stop() or when it
+// goes out of scope; the end event can carry one named counter
+class TraceScope
+{
+public:
+  TraceScope(const char* name)
+    : m_name(nullptr)
+    , m_argName(nullptr)
+    , m_arg(0)
+  {
+    Tracer& tracer = Tracer::instance();
+    if (tracer.enabled.load(std::memory_order_relaxed))
+    {
+      m_name = name;
+      tracer.begin(name);
+    }
+  }
+  TraceScope(const TraceScope&) = delete;
+  TraceScope& operator=(const TraceScope&) = delete;
+  ~TraceScope()
+  {
+    stop();
+  }
+  void stop()
+  {
+    if (m_name)
+    {
+      Tracer::instance().end(m_name, m_argName, m_arg);
+      m_name = nullptr;
+    }
+  }
+  void setArg(const char* name, long long value)
+  {
+    m_argName = name;
+    m_arg = value;
+  }
+
+private:
+  const char* m_name;
+  const char* m_argName;
+  long long m_arg;
+};
+
+// Copies the events out while the owner keeps pushing. Slots the owner
+// claimed during the copy may be half written and are dropped, like a
+// seqlock read that failed.
+void TraceBuffer::copy(std::vector<TraceEvent>& events) const
+{
+  size_t head = m_head.load(std::memory_order_acquire);
+  size_t tail = head > CAPACITY ? head - CAPACITY : 0;
+  events.clear();
+  for (size_t i = tail; i < head; i++)
+  {
+    events.push_back(m_events[i % CAPACITY]);
+  }
+
+  std::atomic_thread_fence(std::memory_order_acquire);
+  size_t claim = m_claim.load(std::memory_order_relaxed);
+  size_t valid = claim > CAPACITY ? claim - CAPACITY : 0;
+  if (valid > tail)
+  {
+    events.erase(events.begin(), events.begin() + static_cast<std::ptrdiff_t>(std::min(valid - tail, events.size())));
+  }
+}
+
+Tracer& Tracer::instance()
+{
+  static Tracer tracer;
+  return tracer;
+}
+
+void Tracer::begin(const char* name)
+{
+  local().push(TraceEvent{ name, nullptr, now() - m_epoch, 0, 'B' });
+}
+
+void Tracer::end(const char* name, const char* argName, long long arg)
+{
+  local().push(TraceEvent{ name, argName, now() - m_epoch, arg, 'E' });
+}
+
+bool Tracer::flush(const char* path)
+{
+  std::ofstream out(path, std::ios::trunc);
+  if (!out)
+    return false;
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  bool first = true;
+  std::vector<TraceEvent> events;
+  for (auto& buffer : m_buffers)
+  {
+    buffer->copy(events);
+    for (const TraceEvent& event : events)
+    {
+      out << (first ? "\n" : ",\n") << "{\"name\":\"" << event.name << "\",\"ph\":\"" << event.phase
+          << "\",\"ts\":" << event.ts / 1000 << '.' << std::setw(3) << std::setfill('0') << event.ts % 1000
+          << std::setfill(' ') << ",\"pid\":1,\"tid\":" << buffer->tid();
+      if (event.argName)
+      {
+        out << ",\"args\":{\"" << event.argName << "\":" << event.arg << '}';
+      }
+      out << '}';
+      first = false;
+    }
+  }
+  out << "\n]}\n";
+  return true;
+}
+
+long long Tracer::now()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()
+  ).count();
+}
+
+TraceBuffer& Tracer::local()
+{
+  // Each thread takes a buffer once, pushes after that take no lock. One
+  // that ends hands it back, so threads started per game or per floor do
+  // not each keep one; their events share its tid.
+  struct Owner
+  {
+    TraceBuffer* buffer{};
+    ~Owner()
+    {
+      if (buffer)
+      {
+        Tracer::instance().release(buffer);
+      }
+    }
+  };
+  thread_local Owner owner;
+  if (!owner.buffer)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_free.empty())
+    {
+      owner.buffer = m_free.back();
+      m_free.pop_back();
+    }
+    else
+    {
+      m_buffers.push_back(std::make_unique<TraceBuffer>(static_cast<int>(m_buffers.size()) + 1));
+      owner.buffer = m_buffers.back().get();
+    }
+  }
+  return *owner.buffer;
+}
+
+void Tracer::release(TraceBuffer* buffer)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_free.push_back(buffer);
+}